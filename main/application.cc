@@ -13,6 +13,7 @@
 #include "iot_handler.h"
 
 #include <cstring>
+#include <algorithm>
 #include <esp_log.h>
 #include <cJSON.h>
 #include <driver/gpio.h>
@@ -21,6 +22,12 @@
 
 #define TAG "Application"
 
+#if CONFIG_USE_CONNECTION_PREWARM
+#define PREWARM_IDLE_TIMEOUT_US (CONFIG_CONNECTION_PREWARM_IDLE_TIMEOUT_SEC * 1000000LL)
+// The wait after unused pre-warms doubles up to 16 times the idle timeout
+#define PREWARM_MAX_BACKOFF_SHIFT 4
+#endif
+
 
 static const char* const STATE_STRINGS[] = {
     "unknown",
@@ -225,7 +232,8 @@ void Application::ShowActivationCode(const std::string& code, const std::string&
         auto it = std::find_if(digit_sounds.begin(), digit_sounds.end(),
             [digit](const digit_sound& ds) { return ds.digit == digit; });
         if (it != digit_sounds.end()) {
-            audio_service_.PlaySound(it->sound);
+            // Same channel as the alert, so the digits follow the sentence instead of overlapping it
+            audio_service_.PlaySound(it->sound, kMixerChannelAlarm);
         }
     }
 }
@@ -237,7 +245,7 @@ void Application::Alert(const char* status, const char* message, const char* emo
     display->SetEmotion(emotion);
     display->SetChatMessage("system", message);
     if (!sound.empty()) {
-        audio_service_.PlaySound(sound);
+        audio_service_.PlaySound(sound, kMixerChannelAlarm);
     }
 }
 
@@ -370,13 +378,34 @@ void Application::Start() {
         xEventGroupSetBits(event_group_, MAIN_EVENT_SEND_AUDIO);
     };
     callbacks.on_wake_word_detected = [this](const std::string& wake_word) {
+        wake_word_time_us_ = esp_timer_get_time();
         xEventGroupSetBits(event_group_, MAIN_EVENT_WAKE_WORD_DETECTED);
     };
     callbacks.on_vad_change = [this](bool speaking) {
         xEventGroupSetBits(event_group_, MAIN_EVENT_VAD_CHANGE);
     };
+#if CONFIG_USE_CONNECTION_PREWARM
+    callbacks.on_speech_energy = [this]() {
+        Schedule([this]() {
+            PrewarmAudioChannel();
+        });
+    };
+#endif
     audio_service_.SetCallbacks(callbacks);
 
+#if CONFIG_USE_SOUND_PCM_CACHE
+    /* Short notification sounds are kept as PCM, the long prompts still go through the decoder */
+#ifdef CONFIG_SOUND_PCM_CACHE_PRELOAD
+    bool preload = true;
+#else
+    bool preload = false;
+#endif
+    for (const auto& sound : {Lang::Sounds::OGG_SUCCESS, Lang::Sounds::OGG_POPUP,
+            Lang::Sounds::OGG_VIBRATION, Lang::Sounds::OGG_EXCLAMATION}) {
+        audio_service_.CacheSound(sound, preload);
+    }
+#endif
+
     // Start the main event loop task with priority 3
     xTaskCreate([](void* arg) {
         ((Application*)arg)->MainEventLoop();
@@ -425,6 +454,11 @@ void Application::Start() {
     });
 
     protocol_->OnNetworkError([this](const std::string& message) {
+        if (prewarming_) {
+            // Nobody is waiting for the channel yet, the wake word tries again
+            ESP_LOGW(TAG, "Audio channel pre-warm failed: %s", message.c_str());
+            return;
+        }
         network_error_count_++;
         last_error_message_ = message;
         
@@ -459,21 +493,33 @@ void Application::Start() {
         
         xEventGroupSetBits(event_group_, MAIN_EVENT_ERROR);
     });
-    protocol_->OnIncomingAudio([this](std::unique_ptr<AudioStreamPacket> packet) {
+    protocol_->OnIncomingAudio([this](AudioStreamPacketPtr packet) {
         if (device_state_ == kDeviceStateSpeaking) {
             audio_service_.PushPacketToDecodeQueue(std::move(packet));
         }
     });
     protocol_->OnAudioChannelOpened([this, codec, &board]() {
-        board.SetPowerSaveMode(false);
+        // A pre-warmed channel may never be used, power up when the wake word comes
+        if (!prewarming_) {
+            board.SetPowerSaveMode(false);
+            audio_service_.PrepareAudio(true, true);
+        }
         if (protocol_->server_sample_rate() != codec->output_sample_rate()) {
             ESP_LOGW(TAG, "Server sample rate %d does not match device output sample rate %d, resampling may cause distortion",
                 protocol_->server_sample_rate(), codec->output_sample_rate());
         }
+        audio_service_.SetUplinkMaxFrameDuration(protocol_->uplink_frame_duration_max());
     });
     protocol_->OnAudioChannelClosed([this, &board]() {
         board.SetPowerSaveMode(true);
+        // The next hello offers the base frame duration and the full bitrate again
+        audio_service_.SetUplinkMaxFrameDuration(0);
+        audio_service_.ResetUplinkRate();
         Schedule([this]() {
+            // The main loop owns the batch, the next session measures its own send times
+            audio_batch_.clear();
+            audio_batch_policy_.Reset();
+            audio_send_retry_us_ = 0;
             auto display = Board::GetInstance().GetDisplay();
             display->SetChatMessage("system", "");
             SetDeviceState(kDeviceStateIdle);
@@ -485,6 +531,8 @@ void Application::Start() {
         if (strcmp(type->valuestring, "tts") == 0) {
             auto state = cJSON_GetObjectItem(root, "state");
             if (strcmp(state->valuestring, "start") == 0) {
+                // The first audio packet follows right behind
+                audio_service_.PrepareAudio(false, true);
                 Schedule([this]() {
                     aborted_ = false;
                     if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
@@ -632,13 +680,23 @@ void Application::Schedule(std::function<void()> callback) {
 // If other tasks need to access the websocket or chat state,
 // they should use Schedule to call this function
 void Application::MainEventLoop() {
+    audio_batch_.reserve(MAX_SEND_PACKETS_IN_QUEUE);
     while (true) {
+        /* A batch that is waiting for more frames goes out when its time is up */
+        TickType_t wait_ticks = portMAX_DELAY;
+        if (!audio_batch_.empty()) {
+            int64_t deadline_us = std::max(audio_send_retry_us_, audio_batch_start_us_ + audio_batch_policy_.GetMaxWaitUs(
+                audio_batch_.front()->frame_duration, protocol_->audio_batch_frames()));
+            // A deadline already passed, e.g. behind a slow scheduled task, only polls the events
+            int64_t remaining_us = std::max<int64_t>(deadline_us - esp_timer_get_time(), 0);
+            wait_ticks = remaining_us > 0 ? std::max<TickType_t>(1, pdMS_TO_TICKS(remaining_us / 1000)) : 0;
+        }
         auto bits = xEventGroupWaitBits(event_group_, MAIN_EVENT_SCHEDULE |
             MAIN_EVENT_SEND_AUDIO |
             MAIN_EVENT_WAKE_WORD_DETECTED |
             MAIN_EVENT_VAD_CHANGE |
             MAIN_EVENT_CLOCK_TICK |
-            MAIN_EVENT_ERROR, pdTRUE, pdFALSE, portMAX_DELAY);
+            MAIN_EVENT_ERROR, pdTRUE, pdFALSE, wait_ticks);
 
         if (bits & MAIN_EVENT_ERROR) {
             SetDeviceState(kDeviceStateIdle);
@@ -647,12 +705,8 @@ void Application::MainEventLoop() {
             ESP_LOGW(TAG, "Network error handled, device state set to idle");
         }
 
-        if (bits & MAIN_EVENT_SEND_AUDIO) {
-            while (auto packet = audio_service_.PopPacketFromSendQueue()) {
-                if (protocol_ && !protocol_->SendAudio(std::move(packet))) {
-                    break;
-                }
-            }
+        if ((bits & MAIN_EVENT_SEND_AUDIO) || !audio_batch_.empty()) {
+            SendQueuedAudio();
         }
 
         if (bits & MAIN_EVENT_WAKE_WORD_DETECTED) {
@@ -679,17 +733,123 @@ void Application::MainEventLoop() {
             clock_ticks_++;
             auto display = Board::GetInstance().GetDisplay();
             display->UpdateStatusBar();
+#if CONFIG_USE_CONNECTION_PREWARM
+            CheckPrewarmTimeout();
+#endif
+            // Flash writes stall the audio tasks, so they wait until there is no conversation
+            if (device_state_ == kDeviceStateIdle) {
+                audio_service_.StoreCodecSettleTime();
+            }
         
             // Print the debug info every 10 seconds
             if (clock_ticks_ % 10 == 0) {
                 // SystemInfo::PrintTaskCpuUsage(pdMS_TO_TICKS(1000));
                 // SystemInfo::PrintTaskList();
                 SystemInfo::PrintHeapStats();
+                audio_service_.PrintCodecTaskUsage();
             }
         }
     }
 }
 
+void Application::SendQueuedAudio() {
+    int64_t now_us = esp_timer_get_time();
+    while (auto packet = audio_service_.PopPacketFromSendQueue()) {
+        if (audio_batch_.empty()) {
+            audio_batch_start_us_ = now_us;
+        }
+        /* Packets kept from failed sends are bounded like the send queue, the oldest are dropped */
+        if (audio_batch_.size() >= MAX_SEND_PACKETS_IN_QUEUE) {
+            audio_batch_.erase(audio_batch_.begin());
+        }
+        audio_batch_.push_back(std::move(packet));
+    }
+    if (audio_batch_.empty()) {
+        return;
+    }
+    if (!protocol_) {
+        audio_batch_.clear();
+        return;
+    }
+
+    /* After a failed send the packets wait before the next attempt */
+    if (now_us < audio_send_retry_us_) {
+        return;
+    }
+    /* Without batching on the server side every packet goes out right away, as before */
+    if (!audio_batch_policy_.ShouldSend(audio_batch_.size(), now_us - audio_batch_start_us_,
+            audio_batch_.front()->frame_duration, protocol_->audio_batch_frames())) {
+        return;
+    }
+    size_t pending = audio_batch_.size();
+    for (size_t i = 0; i < pending; i++) {
+        audio_batch_trace_us_[i] = audio_batch_[i]->trace_time_us;
+    }
+    // The time a send blocks follows the round trip on the slow links, it sets the size of the next batches
+    int64_t start_us = esp_timer_get_time();
+    size_t sent = protocol_->SendAudioBatch(audio_batch_);
+    audio_batch_policy_.OnSent(esp_timer_get_time() - start_us);
+    for (size_t i = 0; i < sent; i++) {
+        audio_service_.GetLatencyTracer().Record(kLatencyMicToSent, audio_batch_trace_us_[i]);
+    }
+    bool all_sent = audio_batch_.empty();
+    audio_service_.ReportSendResult(all_sent);
+    if (sent > 0) {
+        RecordFirstUplink();
+    }
+    if (!all_sent) {
+        audio_batch_start_us_ = esp_timer_get_time();
+        audio_send_retry_us_ = audio_batch_start_us_ + AUDIO_SEND_RETRY_DELAY_MS * 1000;
+    }
+}
+
+void Application::RecordFirstUplink() {
+    if (wake_word_time_us_.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+    int64_t wake_word_time_us = wake_word_time_us_.exchange(0);
+    audio_service_.GetLatencyTracer().Record(kLatencyWakeWordToFirstUplink, wake_word_time_us);
+}
+
+#if CONFIG_USE_CONNECTION_PREWARM
+void Application::PrewarmAudioChannel() {
+    if (!protocol_ || device_state_ != kDeviceStateIdle || protocol_->IsAudioChannelOpened()) {
+        return;
+    }
+    /* Talk that never leads to the wake word (TV, people in the room) waits longer after each unused channel */
+    int64_t now_us = esp_timer_get_time();
+    int64_t backoff_us = PREWARM_IDLE_TIMEOUT_US << std::min(prewarm_unused_, PREWARM_MAX_BACKOFF_SHIFT);
+    if (prewarm_unused_ > 0 && now_us - last_prewarm_us_ < backoff_us) {
+        return;
+    }
+    last_prewarm_us_ = now_us;
+
+    // The wake word detection goes on meanwhile, and the wake word audio is encoded in the background
+    ESP_LOGI(TAG, "Speech heard, opening the audio channel ahead of the wake word");
+    prewarming_ = true;
+    bool opened = protocol_->OpenAudioChannel();
+    prewarming_ = false;
+    if (!opened) {
+        prewarm_unused_++;
+        return;
+    }
+    prewarm_time_us_ = esp_timer_get_time();
+    ESP_LOGI(TAG, "Audio channel pre-warmed in %lld ms", (prewarm_time_us_ - now_us) / 1000);
+}
+
+void Application::CheckPrewarmTimeout() {
+    if (prewarm_time_us_ == 0 || esp_timer_get_time() - prewarm_time_us_ < PREWARM_IDLE_TIMEOUT_US) {
+        return;
+    }
+    prewarm_time_us_ = 0;
+    prewarm_unused_++;
+    if (device_state_ == kDeviceStateIdle && protocol_->IsAudioChannelOpened()) {
+        ESP_LOGI(TAG, "No wake word after the pre-warm, closing the audio channel");
+        protocol_->CloseAudioChannel();
+    }
+}
+#endif
+
 void Application::OnWakeWordDetected() {
     if (!protocol_) {
         return;
@@ -697,13 +857,20 @@ void Application::OnWakeWordDetected() {
 
     if (device_state_ == kDeviceStateIdle) {
         audio_service_.EncodeWakeWord();
+        // A reply or the pop up sound follows, power up the speaker while the channel opens
+        audio_service_.PrepareAudio(true, true);
 
         if (!protocol_->IsAudioChannelOpened()) {
             SetDeviceState(kDeviceStateConnecting);
             if (!protocol_->OpenAudioChannel()) {
+                wake_word_time_us_ = 0;
                 audio_service_.EnableWakeWordDetection(true);
                 return;
             }
+        } else if (prewarm_time_us_ != 0) {
+            ESP_LOGI(TAG, "Using the audio channel pre-warmed %lld ms ago", (esp_timer_get_time() - prewarm_time_us_) / 1000);
+            // Left on while the pre-warmed channel was waiting for the wake word
+            Board::GetInstance().SetPowerSaveMode(false);
         }
 
         auto wake_word = audio_service_.GetLastWakeWord();
@@ -715,6 +882,7 @@ void Application::OnWakeWordDetected() {
                 ESP_LOGW(TAG, "Failed to send wake word audio packet");
                 break;
             }
+            RecordFirstUplink();
         }
         // Set the chat state to wake word detected
         if (protocol_) {
@@ -726,10 +894,14 @@ void Application::OnWakeWordDetected() {
         // Play the pop up sound to indicate the wake word is detected
         audio_service_.PlaySound(Lang::Sounds::OGG_POPUP);
 #endif
-    } else if (device_state_ == kDeviceStateSpeaking) {
-        AbortSpeaking(kAbortReasonWakeWordDetected);
-    } else if (device_state_ == kDeviceStateActivating) {
-        SetDeviceState(kDeviceStateIdle);
+    } else {
+        // Only the wake word that starts a conversation is measured
+        wake_word_time_us_ = 0;
+        if (device_state_ == kDeviceStateSpeaking) {
+            AbortSpeaking(kAbortReasonWakeWordDetected);
+        } else if (device_state_ == kDeviceStateActivating) {
+            SetDeviceState(kDeviceStateIdle);
+        }
     }
 }
 
@@ -752,6 +924,11 @@ void Application::SetDeviceState(DeviceState state) {
     }
     
     clock_ticks_ = 0;
+    if (state != kDeviceStateIdle && prewarm_time_us_ != 0) {
+        // The pre-warmed channel is in use now
+        prewarm_time_us_ = 0;
+        prewarm_unused_ = 0;
+    }
     auto previous_state = device_state_;
     device_state_ = state;
     ESP_LOGI(TAG, "STATE: %s", STATE_STRINGS[device_state_]);
@@ -775,6 +952,7 @@ void Application::SetDeviceState(DeviceState state) {
             display->SetStatus(Lang::Strings::CONNECTING);
             display->SetEmotion("neutral");
             display->SetChatMessage("system", "");
+            audio_service_.PrepareAudio(true, true);
             break;
         case kDeviceStateListening:
             display->SetStatus(Lang::Strings::LISTENING);
@@ -830,6 +1008,10 @@ bool Application::UpgradeFirmware(Ota& ota, const std::string& url) {
         ESP_LOGI(TAG, "Closing audio channel before firmware upgrade");
         protocol_->CloseAudioChannel();
     }
+    if (protocol_) {
+        // The upgrade needs the memory of a connection kept open between sessions
+        protocol_->ReleaseIdleConnection();
+    }
     ESP_LOGI(TAG, "Starting firmware upgrade from URL: %s", upgrade_url.c_str());
     
     Alert(Lang::Strings::OTA_UPGRADE, Lang::Strings::UPGRADING, "download", Lang::Sounds::OGG_UPGRADE);
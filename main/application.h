@@ -10,8 +10,10 @@
 #include <mutex>
 #include <deque>
 #include <memory>
+#include <atomic>
 
 #include "protocol.h"
+#include "audio_batch_policy.h"
 #include "ota.h"
 #include "audio_service.h"
 #include "device_state_event.h"
@@ -25,6 +27,9 @@
 #define MAIN_EVENT_CHECK_NEW_VERSION_DONE (1 << 5)
 #define MAIN_EVENT_CLOCK_TICK (1 << 6)
 
+// Uplink packets a send failed on are kept and tried again one frame later
+#define AUDIO_SEND_RETRY_DELAY_MS OPUS_FRAME_DURATION_MS
+
 
 enum AecMode {
     kAecOff,
@@ -63,6 +68,7 @@ public:
     AecMode GetAecMode() const { return aec_mode_; }
     void PlaySound(const std::string_view& sound);
     AudioService& GetAudioService() { return audio_service_; }
+    Protocol* GetProtocol() { return protocol_.get(); }
 
 private:
     Application();
@@ -91,7 +97,26 @@ private:
     TaskHandle_t check_new_version_task_handle_ = nullptr;
     TaskHandle_t main_event_loop_task_handle_ = nullptr;
 
+    // Uplink packets waiting to go out together as one batched message
+    std::vector<AudioStreamPacketPtr> audio_batch_;
+    int64_t audio_batch_start_us_ = 0;
+    int64_t audio_send_retry_us_ = 0;      // No send before this time, after one failed
+    int64_t audio_batch_trace_us_[MAX_SEND_PACKETS_IN_QUEUE];     // Capture times of the packets being sent
+    AudioBatchPolicy audio_batch_policy_;
+
+    // Audio channel opened when speech was heard while idle, before the wake word
+    int64_t prewarm_time_us_ = 0;           // When it opened, 0 once used or closed
+    int64_t last_prewarm_us_ = 0;
+    int prewarm_unused_ = 0;                // Pre-warms in a row that timed out unused
+    std::atomic<bool> prewarming_{false};    // Read by the protocol callbacks while OpenAudioChannel() runs
+    // Set by the wake word task, cleared when the first uplink packet is sent
+    std::atomic<int64_t> wake_word_time_us_{0};
+
     void OnWakeWordDetected();
+    void PrewarmAudioChannel();
+    void CheckPrewarmTimeout();
+    void RecordFirstUplink();
+    void SendQueuedAudio();
     void CheckNewVersion(Ota& ota);
     void CheckAssetsVersion();
     void ShowActivationCode(const std::string& code, const std::string& message);
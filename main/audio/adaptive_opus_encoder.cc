@@ -0,0 +1,84 @@
+#include "adaptive_opus_encoder.h"
+
+#include <esp_log.h>
+
+#define TAG "AdaptiveOpusEncoder"
+
+// Upper bound for one packet, libopus lowers the quality to fit if ever needed
+#define ADAPTIVE_OPUS_MAX_PACKET_BYTES 1500
+
+
+AdaptiveOpusEncoder::AdaptiveOpusEncoder(int sample_rate, int channels, int frame_duration_ms)
+    : sample_rate_(sample_rate), channels_(channels), frame_duration_ms_(frame_duration_ms),
+      next_frame_duration_ms_(frame_duration_ms) {
+    int error;
+    encoder_ = opus_encoder_create(sample_rate, channels, OPUS_APPLICATION_VOIP, &error);
+    if (encoder_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create audio encoder, error code: %d", error);
+        return;
+    }
+    packet_buffer_.resize(ADAPTIVE_OPUS_MAX_PACKET_BYTES);
+    // Room for the longest Opus packet, so changing the duration never reallocates
+    buffer_.reserve(sample_rate / 1000 * 120 * channels);
+}
+
+AdaptiveOpusEncoder::~AdaptiveOpusEncoder() {
+    if (encoder_ != nullptr) {
+        opus_encoder_destroy(encoder_);
+    }
+}
+
+void AdaptiveOpusEncoder::SetBitrate(int bitrate) {
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_SET_BITRATE(bitrate));
+    }
+}
+
+void AdaptiveOpusEncoder::SetDtx(bool enable) {
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_SET_DTX(enable ? 1 : 0));
+    }
+}
+
+void AdaptiveOpusEncoder::SetComplexity(int complexity) {
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_SET_COMPLEXITY(complexity));
+    }
+}
+
+void AdaptiveOpusEncoder::SetFrameDuration(int frame_duration_ms) {
+    next_frame_duration_ms_ = frame_duration_ms;
+}
+
+bool AdaptiveOpusEncoder::Encode(const std::vector<int16_t>& pcm, std::vector<uint8_t>& opus) {
+    if (encoder_ == nullptr) {
+        ESP_LOGE(TAG, "Audio encoder is not configured");
+        return false;
+    }
+
+    /* A packet never mixes two durations, the new one starts with an empty buffer */
+    if (buffer_.empty()) {
+        frame_duration_ms_ = next_frame_duration_ms_;
+    }
+    buffer_.insert(buffer_.end(), pcm.begin(), pcm.end());
+    size_t frame_size = sample_rate_ / 1000 * frame_duration_ms_;
+    if (buffer_.size() < frame_size * channels_) {
+        return false;
+    }
+
+    int ret = opus_encode(encoder_, buffer_.data(), frame_size, packet_buffer_.data(), packet_buffer_.size());
+    buffer_.erase(buffer_.begin(), buffer_.begin() + frame_size * channels_);
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Failed to encode audio, error code: %d", ret);
+        return false;
+    }
+    opus.assign(packet_buffer_.begin(), packet_buffer_.begin() + ret);
+    return true;
+}
+
+void AdaptiveOpusEncoder::ResetState() {
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_RESET_STATE);
+    }
+    buffer_.clear();
+}
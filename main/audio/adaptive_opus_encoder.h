@@ -0,0 +1,46 @@
+#ifndef ADAPTIVE_OPUS_ENCODER_H
+#define ADAPTIVE_OPUS_ENCODER_H
+
+#include <vector>
+#include <cstdint>
+
+#include <opus.h>
+
+/*
+ * Opus encoder whose bitrate, DTX and packet duration can be changed between packets.
+ *
+ * OpusEncoderWrapper has no bitrate control, so this owns the libopus encoder directly.
+ * PCM is accepted in frames of any size and buffered until a packet of the current duration
+ * is complete. A new duration applies when the buffer is empty, so callers should feed frames
+ * whose size divides every duration they use.
+ */
+class AdaptiveOpusEncoder {
+public:
+    AdaptiveOpusEncoder(int sample_rate, int channels, int frame_duration_ms);
+    ~AdaptiveOpusEncoder();
+
+    // OPUS_AUTO lets libopus pick the bitrate from the sample rate and packet duration
+    void SetBitrate(int bitrate);
+    void SetDtx(bool enable);
+    void SetComplexity(int complexity);
+    // One of the Opus packet durations, 2.5 ms to 120 ms, applied once the buffered PCM has been encoded
+    void SetFrameDuration(int frame_duration_ms);
+    // Returns true and fills opus when a packet was completed, false while more PCM is needed or on error
+    bool Encode(const std::vector<int16_t>& pcm, std::vector<uint8_t>& opus);
+    // Drops the buffered PCM and the encoder history
+    void ResetState();
+
+    bool IsBufferEmpty() const { return buffer_.empty(); }
+    int frame_duration() const { return frame_duration_ms_; }
+
+private:
+    OpusEncoder* encoder_ = nullptr;
+    int sample_rate_;
+    int channels_;
+    int frame_duration_ms_;
+    int next_frame_duration_ms_;
+    std::vector<int16_t> buffer_;
+    std::vector<uint8_t> packet_buffer_;
+};
+
+#endif // ADAPTIVE_OPUS_ENCODER_H
@@ -0,0 +1,230 @@
+#include "audio_benchmark.h"
+#include "adaptive_opus_encoder.h"
+#include "audio_mixer.h"
+#include "dsp/polyphase_resampler.h"
+#include "dsp/time_stretcher.h"
+#include "audio_packet_cipher.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <opus_decoder.h>
+#include <cmath>
+#include <algorithm>
+
+#define TAG "AudioBenchmark"
+
+#define AUDIO_BENCHMARK_FRAME_DURATION_MS 60
+#define AUDIO_BENCHMARK_MAX_FRAMES 500
+// The Opus encoder needs the stack of the opus encode task
+#define AUDIO_BENCHMARK_TASK_STACK_SIZE (2048 * 12)
+#define AUDIO_BENCHMARK_TASK_PRIORITY 2
+// The time stretcher catches up at 115% for the whole run, its most expensive case
+#define AUDIO_BENCHMARK_STRETCH_SPEED 115
+
+static const char* const kStageNames[kBenchmarkStageCount] = {
+    "input_resample",
+    "encode",
+    "encrypt",
+    "decode",
+    "output_resample",
+    "time_stretch",
+    "mix",
+};
+
+
+std::atomic<bool> AudioBenchmark::running_{false};
+
+AudioBenchmark::AudioBenchmark(int input_sample_rate, int output_sample_rate, int frames)
+    : input_sample_rate_(input_sample_rate), output_sample_rate_(output_sample_rate),
+      frames_(std::clamp(frames, 2, AUDIO_BENCHMARK_MAX_FRAMES)) {
+}
+
+bool AudioBenchmark::Start(int input_sample_rate, int output_sample_rate, int frames, std::function<void(cJSON* result)> callback) {
+    if (running_.exchange(true)) {
+        ESP_LOGW(TAG, "A benchmark is already running");
+        return false;
+    }
+    auto benchmark = new AudioBenchmark(input_sample_rate, output_sample_rate, frames);
+    benchmark->callback_ = std::move(callback);
+    BaseType_t created = xTaskCreate([](void* arg) {
+        auto benchmark = (AudioBenchmark*)arg;
+        benchmark->RunFrames();
+        benchmark->callback_(benchmark->GetResultJson());
+        delete benchmark;
+        running_ = false;
+        vTaskDelete(NULL);
+    }, "audio_benchmark", AUDIO_BENCHMARK_TASK_STACK_SIZE, benchmark, AUDIO_BENCHMARK_TASK_PRIORITY, nullptr);
+    if (created != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the benchmark task");
+        delete benchmark;
+        running_ = false;
+        return false;
+    }
+    return true;
+}
+
+cJSON* AudioBenchmark::GetResultJson() const {
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "frames", frames_);
+    cJSON_AddNumberToObject(root, "frame_duration", AUDIO_BENCHMARK_FRAME_DURATION_MS);
+    cJSON_AddNumberToObject(root, "frames_per_second", elapsed_us_ > 0 ? frames_ * 1000000.0 / elapsed_us_ : 0);
+    // Audio seconds processed per second, the pipeline keeps up while this stays above 1
+    cJSON_AddNumberToObject(root, "realtime_factor", elapsed_us_ > 0 ?
+        frames_ * AUDIO_BENCHMARK_FRAME_DURATION_MS * 1000.0 / elapsed_us_ : 0);
+    cJSON_AddNumberToObject(root, "heap_delta", heap_delta_);
+    cJSON_AddNumberToObject(root, "uplink_bitrate", encoded_bytes_ * 8000.0 / (frames_ * AUDIO_BENCHMARK_FRAME_DURATION_MS));
+    cJSON* stages = cJSON_CreateObject();
+    for (int i = 0; i < kBenchmarkStageCount; i++) {
+        auto& usage = stages_[i];
+        if (usage.frames == 0) {
+            continue;
+        }
+        cJSON* stage = cJSON_CreateObject();
+        cJSON_AddNumberToObject(stage, "avg_us", usage.busy_us / usage.frames);
+        cJSON_AddNumberToObject(stage, "max_us", usage.max_us);
+        cJSON_AddItemToObject(stages, kStageNames[i], stage);
+    }
+    cJSON_AddItemToObject(root, "stages", stages);
+    return root;
+}
+
+void AudioBenchmark::Synthesize(int16_t* pcm, size_t samples, int sample_rate) {
+    /* Eight harmonics of a pitch gliding around 120 Hz, four syllables per second */
+    for (size_t i = 0; i < samples; i++) {
+        float t = (float)(synthesized_samples_ + i) / sample_rate;
+        float pitch = 120.0f + 40.0f * sinf(2 * M_PI * 0.7f * t);
+        phase_ += 2 * M_PI * pitch / sample_rate;
+        if (phase_ > 2 * M_PI) {
+            phase_ -= 2 * M_PI;
+        }
+        float voice = 0;
+        for (int k = 1; k <= 8; k++) {
+            voice += sinf(k * phase_) / k;
+        }
+        float envelope = std::max(0.0f, sinf(2 * M_PI * 4.0f * t));
+        noise_ = noise_ * 1664525 + 1013904223;
+        float noise = (int32_t)(noise_ >> 16) - 32768;
+        pcm[i] = std::clamp<int32_t>(voice * envelope * 6000 + noise / 100, INT16_MIN, INT16_MAX);
+    }
+    synthesized_samples_ += samples;
+}
+
+void AudioBenchmark::RunFrames() {
+    size_t input_samples = input_sample_rate_ * AUDIO_BENCHMARK_FRAME_DURATION_MS / 1000;
+    size_t output_samples = output_sample_rate_ * AUDIO_BENCHMARK_FRAME_DURATION_MS / 1000;
+    size_t capacity = std::max({input_samples, output_samples, (size_t)16000 * AUDIO_BENCHMARK_FRAME_DURATION_MS / 1000});
+
+    /* Everything is set up and sized before the first frame, as in AudioService::Initialize() */
+    PolyphaseResampler input_resampler;
+    bool input_resample = input_sample_rate_ != 16000;
+    if (input_resample) {
+        input_resampler.Configure(input_sample_rate_, 16000);
+    }
+    PolyphaseResampler output_resampler;
+    bool output_resample = output_sample_rate_ != 16000;
+    if (output_resample) {
+        output_resampler.Configure(16000, output_sample_rate_);
+    }
+    AdaptiveOpusEncoder encoder(16000, 1, AUDIO_BENCHMARK_FRAME_DURATION_MS);
+    encoder.SetComplexity(0);
+    OpusDecoderWrapper decoder(16000, 1, AUDIO_BENCHMARK_FRAME_DURATION_MS);
+    TimeStretcher time_stretcher;
+    time_stretcher.Configure(output_sample_rate_);
+    AudioMixer mixer;
+    mixer.Initialize(output_samples * 2);
+    AudioPacketCipher cipher;
+    cipher.SetKey(std::string(16, '\x5a'), std::string(16, '\x01'));
+    std::string datagram;
+    datagram.reserve(AUDIO_PACKET_NONCE_SIZE + 1500);
+
+    std::vector<int16_t> input(input_samples);
+    std::vector<int16_t> uplink;
+    std::vector<int16_t> downlink;
+    std::vector<int16_t> output;
+    std::vector<int16_t> sound(output_samples);
+    std::vector<uint8_t> opus;
+    // The decoder takes its input by rvalue, a copy in a reused buffer keeps the allocator out of the timing
+    std::vector<uint8_t> decode_input;
+    uplink.reserve(capacity);
+    downlink.reserve(capacity);
+    output.reserve(capacity + capacity / 4);
+    opus.reserve(1500);
+    decode_input.reserve(1500);
+    for (size_t i = 0; i < sound.size(); i++) {
+        sound[i] = 4000 * sinf(2 * M_PI * 880.0f * i / output_sample_rate_);
+    }
+
+    auto measure = [this](AudioBenchmarkStage stage, int64_t start_us) {
+        uint32_t elapsed_us = esp_timer_get_time() - start_us;
+        auto& usage = stages_[stage];
+        usage.busy_us += elapsed_us;
+        usage.max_us = std::max(usage.max_us, elapsed_us);
+        usage.frames++;
+    };
+
+    size_t stretch_credit = 0;
+    size_t heap_after_first = 0;
+    bool first_frame = true;
+    int64_t start_us = esp_timer_get_time();
+    for (int frame = 0; frame < frames_; frame++) {
+        Synthesize(input.data(), input.size(), input_sample_rate_);
+
+        int64_t stage_us = esp_timer_get_time();
+        if (input_resample) {
+            uplink.resize(input_resampler.GetOutputSamples(input.size()));
+            input_resampler.Process(input.data(), input.size(), uplink.data());
+            measure(kBenchmarkInputResample, stage_us);
+        } else {
+            uplink.assign(input.begin(), input.end());
+        }
+
+        stage_us = esp_timer_get_time();
+        if (!encoder.Encode(uplink, opus)) {
+            continue;
+        }
+        measure(kBenchmarkEncode, stage_us);
+        encoded_bytes_ += opus.size();
+
+        stage_us = esp_timer_get_time();
+        cipher.Seal(0x01, opus.data(), opus.size(), frame * AUDIO_BENCHMARK_FRAME_DURATION_MS, frame + 1, datagram);
+        measure(kBenchmarkEncrypt, stage_us);
+
+        decode_input.assign(opus.begin(), opus.end());
+        stage_us = esp_timer_get_time();
+        decoder.Decode(std::move(decode_input), downlink);
+        measure(kBenchmarkDecode, stage_us);
+
+        stage_us = esp_timer_get_time();
+        if (output_resample) {
+            output.resize(output_resampler.GetOutputSamples(downlink.size()));
+            output_resampler.Process(downlink.data(), downlink.size(), output.data());
+            measure(kBenchmarkOutputResample, stage_us);
+        } else {
+            output.assign(downlink.begin(), downlink.end());
+        }
+
+        stage_us = esp_timer_get_time();
+        stretch_credit += output.size() * (AUDIO_BENCHMARK_STRETCH_SPEED - 100) / AUDIO_BENCHMARK_STRETCH_SPEED;
+        stretch_credit = std::min(stretch_credit, output.size() / 2);
+        stretch_credit -= time_stretcher.Compress(output, stretch_credit);
+        measure(kBenchmarkTimeStretch, stage_us);
+
+        stage_us = esp_timer_get_time();
+        mixer.Write(kMixerChannelNotification, sound.data(), std::min(sound.size(), mixer.GetWritableSamples(kMixerChannelNotification)));
+        mixer.Mix(output.data(), output.size());
+        measure(kBenchmarkMix, stage_us);
+
+        /* The buffers have their final capacity after the first frame, the heap must not move after that */
+        if (first_frame) {
+            first_frame = false;
+            heap_after_first = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+        }
+    }
+    elapsed_us_ = esp_timer_get_time() - start_us;
+    heap_delta_ = (int64_t)heap_after_first - (int64_t)heap_caps_get_free_size(MALLOC_CAP_8BIT);
+
+    ESP_LOGI(TAG, "%d frames of %d ms in %lld ms", frames_, AUDIO_BENCHMARK_FRAME_DURATION_MS, elapsed_us_ / 1000);
+}
@@ -0,0 +1,69 @@
+#ifndef AUDIO_BENCHMARK_H
+#define AUDIO_BENCHMARK_H
+
+#include <cJSON.h>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include <cstdint>
+
+enum AudioBenchmarkStage {
+    kBenchmarkInputResample,
+    kBenchmarkEncode,
+    kBenchmarkEncrypt,
+    kBenchmarkDecode,
+    kBenchmarkOutputResample,
+    kBenchmarkTimeStretch,
+    kBenchmarkMix,
+    kBenchmarkStageCount,
+};
+
+/*
+ * Measures the throughput of the audio pipeline stages on the device.
+ *
+ * Synthetic speech (harmonics of a gliding pitch with syllable envelopes and a noise floor) is
+ * run through the same components as the AudioService tasks, as fast as they go: the input
+ * resampler, the uplink Opus encoder, the AES-CTR sealing of the MQTT UDP datagrams, the Opus decoder, the output resampler, the time stretcher
+ * catching up and the mixer with a sound overlay. The frames run on a task of their own with the
+ * stack of the opus encode task, next to the real pipeline, so the result includes the load the
+ * device is under.
+ *
+ * Start() returns at once, the caller is not held up for the seconds the frames take. The result
+ * reports frames per second, the average and longest time per frame of each stage, and the heap
+ * used after the first frame, which should stay at zero (allocations of other tasks in the
+ * meantime are included). tests/host has the same stages as a host benchmark for CI.
+ */
+class AudioBenchmark {
+public:
+    // Runs frames frames on a low priority task and passes the result to callback from that task,
+    // which owns the JSON. Returns false if a benchmark is already running or the task did not start.
+    static bool Start(int input_sample_rate, int output_sample_rate, int frames, std::function<void(cJSON* result)> callback);
+
+private:
+    AudioBenchmark(int input_sample_rate, int output_sample_rate, int frames);
+
+    struct StageUsage {
+        uint64_t busy_us = 0;
+        uint32_t max_us = 0;
+        uint32_t frames = 0;
+    };
+
+    int input_sample_rate_;
+    int output_sample_rate_;
+    int frames_ = 0;
+    StageUsage stages_[kBenchmarkStageCount];
+    int64_t elapsed_us_ = 0;
+    int64_t heap_delta_ = 0;
+    uint32_t encoded_bytes_ = 0;
+    uint32_t synthesized_samples_ = 0;
+    float phase_ = 0;
+    uint32_t noise_ = 1;
+    std::function<void(cJSON* result)> callback_;
+    static std::atomic<bool> running_;
+
+    void RunFrames();
+    cJSON* GetResultJson() const;
+    void Synthesize(int16_t* pcm, size_t samples, int sample_rate);
+};
+
+#endif // AUDIO_BENCHMARK_H
@@ -26,6 +26,10 @@ bool AudioCodec::InputData(std::vector<int16_t>& data) {
     return false;
 }
 
+bool AudioCodec::InputData(int16_t* data, int samples) {
+    return Read(data, samples) > 0;
+}
+
 void AudioCodec::Start() {
     Settings settings("audio", false);
     output_volume_ = settings.GetInt("output_volume", output_volume_);
@@ -26,6 +26,8 @@ public:
 
     virtual void OutputData(std::vector<int16_t>& data);
     virtual bool InputData(std::vector<int16_t>& data);
+    // For buffers that are not a std::vector, such as the aligned DSP scratch buffers
+    bool InputData(int16_t* data, int samples);
     virtual void Start();
 
     inline bool duplex() const { return duplex_; }
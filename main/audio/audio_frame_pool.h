@@ -0,0 +1,106 @@
+#ifndef AUDIO_FRAME_POOL_H
+#define AUDIO_FRAME_POOL_H
+
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Fixed-size pool of audio frames recycled by the audio pipeline.
+ *
+ * Initialize() allocates every frame up front, Acquire() / Release() only move pointers in
+ * and out of a pre-reserved free list, so a frame and the capacity of its buffers survive
+ * across uses. If the pool runs dry, Acquire() falls back to the heap and the fallback is
+ * counted in misses(), which stays at zero as long as the pool is sized correctly. A miss is
+ * one frame, not one allocation: the new frame has none of the reserved buffers, they grow
+ * on the heap when first written, and a frame released to a full pool is freed.
+ *
+ * Frames are handed out as std::unique_ptr<T, Deleter>. The deleter returns the frame to its
+ * pool, and it also converts from std::default_delete so plain std::make_unique<T>() frames
+ * can travel through the same queues and are freed as usual.
+ */
+template <typename T>
+class AudioFramePool {
+public:
+    struct Deleter {
+        AudioFramePool* pool = nullptr;
+
+        Deleter() = default;
+        Deleter(AudioFramePool* pool) : pool(pool) {}
+        Deleter(const std::default_delete<T>&) {}
+
+        void operator()(T* frame) const {
+            if (pool != nullptr) {
+                pool->Release(frame);
+            } else {
+                delete frame;
+            }
+        }
+    };
+    using Ptr = std::unique_ptr<T, Deleter>;
+
+    AudioFramePool() = default;
+    AudioFramePool(const AudioFramePool&) = delete;
+    AudioFramePool& operator=(const AudioFramePool&) = delete;
+
+    ~AudioFramePool() {
+        for (auto frame : free_frames_) {
+            delete frame;
+        }
+    }
+
+    // prepare is called once per frame to reserve its buffers, reset every time it is released
+    void Initialize(size_t count, std::function<void(T&)> prepare, std::function<void(T&)> reset) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        reset_ = std::move(reset);
+        free_frames_.reserve(count);
+        for (size_t i = free_frames_.size(); i < count; i++) {
+            auto frame = new T();
+            prepare(*frame);
+            free_frames_.push_back(frame);
+        }
+    }
+
+    Ptr Acquire() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!free_frames_.empty()) {
+                auto frame = free_frames_.back();
+                free_frames_.pop_back();
+                return Ptr(frame, Deleter(this));
+            }
+        }
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return Ptr(new T(), Deleter(this));
+    }
+
+    size_t available() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return free_frames_.size();
+    }
+    uint32_t misses() const { return misses_.load(std::memory_order_relaxed); }
+
+private:
+    std::mutex mutex_;
+    std::vector<T*> free_frames_;
+    std::function<void(T&)> reset_;
+    std::atomic<uint32_t> misses_{0};
+
+    void Release(T* frame) {
+        if (reset_) {
+            reset_(*frame);
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_frames_.size() < free_frames_.capacity()) {
+            free_frames_.push_back(frame);
+            return;
+        }
+        delete frame;
+    }
+};
+
+#endif // AUDIO_FRAME_POOL_H
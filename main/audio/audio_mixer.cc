@@ -0,0 +1,124 @@
+#include "audio_mixer.h"
+
+#include <algorithm>
+
+#define AUDIO_MIXER_UNITY_GAIN 32768
+
+
+void AudioMixer::Initialize(size_t ring_samples) {
+    for (int i = 0; i < kMixerChannelCount; i++) {
+        if (i != kMixerChannelTts) {
+            rings_[i].samples.assign(ring_samples, 0);
+        }
+    }
+}
+
+size_t AudioMixer::GetWritableSamples(AudioMixerChannel channel) const {
+    auto& ring = rings_[channel];
+    return ring.samples.size() - ring.Available();
+}
+
+size_t AudioMixer::Write(AudioMixerChannel channel, const int16_t* pcm, size_t samples) {
+    auto& ring = rings_[channel];
+    size_t capacity = ring.samples.size();
+    samples = std::min(samples, capacity - ring.Available());
+    size_t index = ring.write_index.load(std::memory_order_relaxed) % capacity;
+    size_t first = std::min(samples, capacity - index);
+    std::copy(pcm, pcm + first, ring.samples.begin() + index);
+    std::copy(pcm + first, pcm + samples, ring.samples.begin());
+    ring.write_index.fetch_add(samples, std::memory_order_release);
+    return samples;
+}
+
+size_t AudioMixer::GetOverlaySamples() const {
+    size_t samples = 0;
+    for (int i = 0; i < kMixerChannelCount; i++) {
+        if (i != kMixerChannelTts && !rings_[i].clear) {
+            samples = std::max(samples, rings_[i].Available());
+        }
+    }
+    return samples;
+}
+
+void AudioMixer::Clear(AudioMixerChannel channel) {
+    rings_[channel].clear = true;
+}
+
+void AudioMixer::SetGain(AudioMixerChannel channel, int percent) {
+    gains_[channel] = std::clamp(percent, 0, 100) * AUDIO_MIXER_UNITY_GAIN / 100;
+}
+
+void AudioMixer::SetDuckLevel(int percent) {
+    duck_gain_ = std::clamp(percent, 0, 100) * AUDIO_MIXER_UNITY_GAIN / 100;
+}
+
+void AudioMixer::Mix(int16_t* output, size_t samples) {
+    if (samples == 0) {
+        return;
+    }
+
+    size_t available[kMixerChannelCount];
+    available[kMixerChannelTts] = samples;
+    for (int i = 0; i < kMixerChannelCount; i++) {
+        if (i == kMixerChannelTts) {
+            continue;
+        }
+        auto& ring = rings_[i];
+        if (ring.clear.exchange(false)) {
+            ring.read_index.store(ring.write_index.load(std::memory_order_acquire), std::memory_order_relaxed);
+        }
+        available[i] = std::min(ring.Available(), samples);
+    }
+
+    /* A channel is ducked while a channel above it has audio */
+    int32_t targets[kMixerChannelCount];
+    bool ducked = false;
+    bool unity = true;
+    for (int i = kMixerChannelCount - 1; i >= 0; i--) {
+        int32_t gain = gains_[i];
+        targets[i] = ducked ? gain * duck_gain_ / AUDIO_MIXER_UNITY_GAIN : gain;
+        ducked = ducked || (i != kMixerChannelTts && available[i] > 0);
+        unity = unity && (i == kMixerChannelTts ? targets[i] == AUDIO_MIXER_UNITY_GAIN && current_gains_[i] == targets[i] : available[i] == 0);
+    }
+    /* The main stream alone at unity gain, the common case costs nothing */
+    if (unity) {
+        return;
+    }
+
+    /* Ramp every gain linearly from its current value over this frame */
+    int32_t gains[kMixerChannelCount];
+    int32_t steps[kMixerChannelCount];
+    const int16_t* bases[kMixerChannelCount];
+    size_t indexes[kMixerChannelCount];
+    for (int i = 0; i < kMixerChannelCount; i++) {
+        gains[i] = current_gains_[i];
+        steps[i] = (targets[i] - current_gains_[i]) / (int32_t)samples;
+        if (i != kMixerChannelTts) {
+            bases[i] = rings_[i].samples.data();
+            indexes[i] = rings_[i].read_index.load(std::memory_order_relaxed) % rings_[i].samples.size();
+        }
+    }
+
+    for (size_t n = 0; n < samples; n++) {
+        int32_t acc = (output[n] * gains[kMixerChannelTts]) >> 15;
+        gains[kMixerChannelTts] += steps[kMixerChannelTts];
+        for (int i = 0; i < kMixerChannelCount; i++) {
+            if (i == kMixerChannelTts || n >= available[i]) {
+                continue;
+            }
+            acc += (bases[i][indexes[i]] * gains[i]) >> 15;
+            gains[i] += steps[i];
+            if (++indexes[i] == rings_[i].samples.size()) {
+                indexes[i] = 0;
+            }
+        }
+        output[n] = std::clamp<int32_t>(acc, INT16_MIN, INT16_MAX);
+    }
+
+    for (int i = 0; i < kMixerChannelCount; i++) {
+        current_gains_[i] = targets[i];
+        if (i != kMixerChannelTts) {
+            rings_[i].read_index.fetch_add(available[i], std::memory_order_release);
+        }
+    }
+}
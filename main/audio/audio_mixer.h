@@ -0,0 +1,61 @@
+#ifndef AUDIO_MIXER_H
+#define AUDIO_MIXER_H
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+enum AudioMixerChannel {
+    kMixerChannelTts,           // Server audio, the main stream of the playback queue
+    kMixerChannelNotification,  // Short UI sounds
+    kMixerChannelAlarm,         // Alerts, ducks everything else
+    kMixerChannelCount,
+};
+
+/*
+ * Mixes the sounds over the main stream right before the codec.
+ *
+ * The TTS frames keep flowing through the playback queue, Mix() adds the overlay channels
+ * into them in place. Each overlay channel is a PCM ring at the codec output rate, written
+ * by the opus decode task and read by the output task. AudioService feeds both overlay channels
+ * from one sound decoder, one sound at a time, so in practice an overlay only mixes with the TTS.
+ *
+ * Every channel has a Q15 gain. While a channel has audio, the channels below it are ducked
+ * to the duck level, the gain ramps over one frame so there are no clicks. The mix is summed
+ * in 32 bits and saturated once, a few multiply-adds per sample even on ESP32-C3.
+ */
+class AudioMixer {
+public:
+    // Each overlay ring holds ring_samples, at least two output frames
+    void Initialize(size_t ring_samples);
+
+    size_t GetWritableSamples(AudioMixerChannel channel) const;
+    // Writes at most GetWritableSamples() samples, returns the number written
+    size_t Write(AudioMixerChannel channel, const int16_t* pcm, size_t samples);
+    // Samples waiting in the fullest overlay channel
+    size_t GetOverlaySamples() const;
+    // Mixes up to samples of the overlay channels into output, which holds main stream audio or zeros
+    void Mix(int16_t* output, size_t samples);
+    void Clear(AudioMixerChannel channel);
+
+    void SetGain(AudioMixerChannel channel, int percent);
+    void SetDuckLevel(int percent);
+
+private:
+    struct Ring {
+        std::vector<int16_t> samples;
+        std::atomic<size_t> write_index{0};    // Total samples written, advanced by the writer
+        std::atomic<size_t> read_index{0};     // Total samples read, advanced by the reader
+        std::atomic<bool> clear{false};        // Set by Clear(), applied by the reader
+
+        size_t Available() const { return write_index.load(std::memory_order_acquire) - read_index.load(std::memory_order_relaxed); }
+    };
+
+    Ring rings_[kMixerChannelCount];
+    std::atomic<int32_t> gains_[kMixerChannelCount] = {32768, 32768, 32768};
+    std::atomic<int32_t> duck_gain_{32768 * 3 / 10};
+    int32_t current_gains_[kMixerChannelCount] = {32768, 32768, 32768};    // Owned by the reader
+};
+
+#endif // AUDIO_MIXER_H
@@ -1,6 +1,8 @@
 #include "audio_service.h"
+#include "ogg_demuxer.h"
 #include <esp_log.h>
 #include <cstring>
+#include <algorithm>
 
 #if CONFIG_USE_AUDIO_PROCESSOR
 #include "processors/afe_audio_processor.h"
@@ -17,8 +19,13 @@
 
 #define TAG "AudioService"
 
+// A negative core number in the task configuration means no affinity
+#define AUDIO_TASK_CORE(core) ((core) < 0 ? tskNO_AFFINITY : (core))
 
-AudioService::AudioService() {
+
+AudioService::AudioService()
+    : jitter_buffer_(MAX_DECODE_PACKETS_IN_QUEUE, JITTER_BUFFER_MIN_DEPTH, JITTER_BUFFER_MAX_DEPTH,
+        JITTER_BUFFER_MAX_CONCEAL_FRAMES) {
     event_group_ = xEventGroupCreate();
 }
 
@@ -34,9 +41,12 @@ void AudioService::Initialize(AudioCodec* codec) {
     codec_->Start();
 
     /* Setup the audio codec */
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(codec->output_sample_rate(), 1, OPUS_FRAME_DURATION_MS);
-    opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
+    decoder_cache_.Initialize(AUDIO_DECODER_CACHE_SIZE, codec->output_sample_rate());
+    stream_decoder_ = decoder_cache_.Acquire(nullptr, codec->output_sample_rate(), OPUS_FRAME_DURATION_MS, 1);
+    time_stretcher_.Configure(codec->output_sample_rate());
+    opus_encoder_ = std::make_unique<AdaptiveOpusEncoder>(16000, 1, OPUS_FRAME_DURATION_MS);
     opus_encoder_->SetComplexity(0);
+    ApplyUplinkParams();
 
     if (codec->input_sample_rate() != 16000) {
         input_resampler_.Configure(codec->input_sample_rate(), 16000);
@@ -47,43 +57,76 @@ void AudioService::Initialize(AudioCodec* codec) {
     audio_processor_ = std::make_unique<AfeAudioProcessor>();
 #else
     audio_processor_ = std::make_unique<NoAudioProcessor>();
+#if CONFIG_USE_AUDIO_SILENCE_SUPPRESSION
+    silence_suppression_ = true;
+#endif
 #endif
 
+    /* Size the frame pools and scratch buffers for the largest PCM frame in the pipeline */
+    size_t frame_samples = std::max({codec->input_sample_rate() * codec->input_channels(),
+        codec->output_sample_rate(), 16000}) * OPUS_FRAME_DURATION_MS / 1000;
+    // A quarter more for the downlink frames lengthened by the time stretcher
+    task_pool_.Initialize(AUDIO_TASK_POOL_SIZE, [frame_samples](AudioTask& task) {
+        task.pcm.reserve(frame_samples + frame_samples / 4);
+    }, [](AudioTask& task) {
+        task.pcm.clear();
+        task.timestamp = 0;
+        task.trace_time_us = 0;
+    });
+    packet_pool_.Initialize(AUDIO_PACKET_POOL_SIZE, [](AudioStreamPacket& packet) {
+        packet.payload.reserve(AUDIO_PACKET_RESERVE_BYTES);
+    }, [](AudioStreamPacket& packet) {
+        packet.Reset();
+    });
+    incoming_packet_pool_.Initialize(INCOMING_AUDIO_PACKET_POOL_SIZE, [](AudioStreamPacket& packet) {
+        packet.payload.reserve(INCOMING_AUDIO_PACKET_RESERVE_BYTES);
+    }, [](AudioStreamPacket& packet) {
+        packet.Reset();
+    });
+    input_frame_buffer_.reserve(frame_samples);
+    input_mic_buffer_.reserve(frame_samples);
+    input_reference_buffer_.reserve(frame_samples);
+    resampled_mic_buffer_.reserve(frame_samples);
+    resampled_reference_buffer_.reserve(frame_samples);
+    output_resample_buffer_.reserve(frame_samples + frame_samples / 4);
+    decode_view_buffer_.reserve(AUDIO_PACKET_RESERVE_BYTES);
+    sound_pcm_.reserve(frame_samples);
+    mixer_.Initialize(codec->output_sample_rate() * AUDIO_MIXER_RING_DURATION_MS / 1000);
+    mixer_.SetDuckLevel(CONFIG_AUDIO_MIXER_DUCK_LEVEL);
+
     audio_processor_->OnOutput([this](std::vector<int16_t>&& data) {
-        PushTaskToEncodeQueue(kAudioTaskTypeEncodeToSendQueue, std::move(data));
+        PushTaskToEncodeQueue(kAudioTaskTypeEncodeToSendQueue, data, GetProcessorOutputCaptureTime(data.size()));
     });
 
     audio_processor_->OnVadStateChange([this](bool speaking) {
         voice_detected_ = speaking;
+        if (silence_suppression_) {
+            uplink_silent_ = !speaking;
+            uplink_params_changed_ = true;
+        }
+        if (!speaking && audio_playback_queue_.Empty()) {
+            latency_tracer_.MarkSpeechEnd();
+        }
         if (callbacks_.on_vad_change) {
             callbacks_.on_vad_change(speaking);
         }
     });
 
-    esp_timer_create_args_t audio_power_timer_args = {
-        .callback = [](void* arg) {
-            AudioService* audio_service = (AudioService*)arg;
-            audio_service->CheckAndUpdateAudioPowerState();
-        },
-        .arg = this,
-        .dispatch_method = ESP_TIMER_TASK,
-        .name = "audio_power_timer",
-        .skip_unhandled_events = true,
-    };
-    esp_timer_create(&audio_power_timer_args, &audio_power_timer_);
+    power_manager_.Initialize(codec_);
 }
 
 void AudioService::Start() {
     service_stopped_ = false;
     xEventGroupClearBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING | AS_EVENT_WAKE_WORD_RUNNING | AS_EVENT_AUDIO_PROCESSOR_RUNNING);
 
-    esp_timer_start_periodic(audio_power_timer_, 1000000);
+    power_manager_.Start();
 
 #if CONFIG_USE_AUDIO_PROCESSOR
     /* Start the audio input task */
     xTaskCreatePinnedToCore([](void* arg) {
         AudioService* audio_service = (AudioService*)arg;
         audio_service->AudioInputTask();
+        audio_service->audio_input_task_handle_ = nullptr;
         vTaskDelete(NULL);
     }, "audio_input", 2048 * 3, this, 8, &audio_input_task_handle_, 0);
 
@@ -91,6 +134,7 @@ void AudioService::Start() {
     xTaskCreate([](void* arg) {
         AudioService* audio_service = (AudioService*)arg;
         audio_service->AudioOutputTask();
+        audio_service->audio_output_task_handle_ = nullptr;
         vTaskDelete(NULL);
     }, "audio_output", 2048 * 2, this, 4, &audio_output_task_handle_);
 #else
@@ -98,6 +142,7 @@ void AudioService::Start() {
     xTaskCreate([](void* arg) {
         AudioService* audio_service = (AudioService*)arg;
         audio_service->AudioInputTask();
+        audio_service->audio_input_task_handle_ = nullptr;
         vTaskDelete(NULL);
     }, "audio_input", 2048 * 2, this, 8, &audio_input_task_handle_);
 
@@ -105,75 +150,78 @@ void AudioService::Start() {
     xTaskCreate([](void* arg) {
         AudioService* audio_service = (AudioService*)arg;
         audio_service->AudioOutputTask();
+        audio_service->audio_output_task_handle_ = nullptr;
         vTaskDelete(NULL);
     }, "audio_output", 2048, this, 4, &audio_output_task_handle_);
 #endif
 
-    /* Start the opus codec task */
-    xTaskCreate([](void* arg) {
+    /* Start the opus encode and decode tasks */
+    xTaskCreatePinnedToCore([](void* arg) {
+        AudioService* audio_service = (AudioService*)arg;
+        audio_service->OpusEncodeTask();
+        audio_service->opus_encode_task_handle_ = nullptr;
+        vTaskDelete(NULL);
+    }, "opus_encode", 2048 * 12, this, CONFIG_AUDIO_OPUS_ENCODE_TASK_PRIORITY, &opus_encode_task_handle_,
+        AUDIO_TASK_CORE(CONFIG_AUDIO_OPUS_ENCODE_TASK_CORE));
+
+    xTaskCreatePinnedToCore([](void* arg) {
         AudioService* audio_service = (AudioService*)arg;
-        audio_service->OpusCodecTask();
+        audio_service->OpusDecodeTask();
+        audio_service->opus_decode_task_handle_ = nullptr;
         vTaskDelete(NULL);
-    }, "opus_codec", 2048 * 13, this, 2, &opus_codec_task_handle_);
+    }, "opus_decode", 2048 * 6, this, CONFIG_AUDIO_OPUS_DECODE_TASK_PRIORITY, &opus_decode_task_handle_,
+        AUDIO_TASK_CORE(CONFIG_AUDIO_OPUS_DECODE_TASK_CORE));
 }
 
 void AudioService::Stop() {
-    esp_timer_stop(audio_power_timer_);
+    power_manager_.Stop();
     service_stopped_ = true;
     xEventGroupSetBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING |
         AS_EVENT_WAKE_WORD_RUNNING |
         AS_EVENT_AUDIO_PROCESSOR_RUNNING);
 
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    audio_encode_queue_.clear();
-    audio_decode_queue_.clear();
-    audio_playback_queue_.clear();
-    audio_testing_queue_.clear();
-    audio_queue_cv_.notify_all();
+    audio_encode_queue_.Flush();
+    audio_decode_queue_.Flush();
+    jitter_buffer_reset_ = true;
+    audio_playback_queue_.Flush();
+    {
+        std::lock_guard<std::mutex> lock(audio_sound_push_mutex_);
+        audio_sound_queue_.Flush();
+    }
+    mixer_.Clear(kMixerChannelNotification);
+    mixer_.Clear(kMixerChannelAlarm);
+    {
+        std::lock_guard<std::mutex> lock(audio_testing_mutex_);
+        audio_testing_queue_.clear();
+        audio_testing_replay_ = false;
+    }
+
+    /* Wake up the consumers and any producer blocked on a full queue, they will see service_stopped_ */
+    xEventGroupSetBits(event_group_, AS_EVENT_ENCODE_QUEUE_AVAILABLE | AS_EVENT_DECODE_QUEUE_AVAILABLE |
+        AS_EVENT_SOUND_QUEUE_AVAILABLE);
+    NotifyTask(audio_output_task_handle_);
+    NotifyTask(opus_encode_task_handle_);
+    NotifyTask(opus_decode_task_handle_);
 }
 
-bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples) {
-    if (!codec_->input_enabled()) {
-        esp_timer_stop(audio_power_timer_);
-        esp_timer_start_periodic(audio_power_timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
-        codec_->EnableInput(true);
+void AudioService::NotifyTask(TaskHandle_t task) {
+    if (task != nullptr) {
+        xTaskNotifyGive(task);
     }
+}
 
-    if (codec_->input_sample_rate() != sample_rate) {
-        data.resize(samples * codec_->input_sample_rate() / sample_rate * codec_->input_channels());
-        if (!codec_->InputData(data)) {
-            return false;
-        }
-        if (codec_->input_channels() == 2) {
-            auto mic_channel = std::vector<int16_t>(data.size() / 2);
-            auto reference_channel = std::vector<int16_t>(data.size() / 2);
-            for (size_t i = 0, j = 0; i < mic_channel.size(); ++i, j += 2) {
-                mic_channel[i] = data[j];
-                reference_channel[i] = data[j + 1];
-            }
-            auto resampled_mic = std::vector<int16_t>(input_resampler_.GetOutputSamples(mic_channel.size()));
-            auto resampled_reference = std::vector<int16_t>(reference_resampler_.GetOutputSamples(reference_channel.size()));
-            input_resampler_.Process(mic_channel.data(), mic_channel.size(), resampled_mic.data());
-            reference_resampler_.Process(reference_channel.data(), reference_channel.size(), resampled_reference.data());
-            data.resize(resampled_mic.size() + resampled_reference.size());
-            for (size_t i = 0, j = 0; i < resampled_mic.size(); ++i, j += 2) {
-                data[j] = resampled_mic[i];
-                data[j + 1] = resampled_reference[i];
-            }
-        } else {
-            auto resampled = std::vector<int16_t>(input_resampler_.GetOutputSamples(data.size()));
-            input_resampler_.Process(data.data(), data.size(), resampled.data());
-            data = std::move(resampled);
-        }
-    } else {
-        data.resize(samples * codec_->input_channels());
-        if (!codec_->InputData(data)) {
+bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples) {
+    power_manager_.EnableInput();
+
+    /* Frames read while the input is settling after a power up are dropped */
+    int64_t frame_us = samples * 1000000LL / sample_rate;
+    do {
+        if (!ReadCodecData(data, sample_rate, samples)) {
             return false;
         }
-    }
+    } while (!power_manager_.OnInputFrame(data.data(), data.size(), frame_us));
 
-    /* Update the last input time */
-    last_input_time_ = std::chrono::steady_clock::now();
+    last_capture_time_us_ = esp_timer_get_time();
     debug_statistics_.input_count++;
 
 #if CONFIG_USE_AUDIO_DEBUGGER
@@ -187,7 +235,48 @@ bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, in
     return true;
 }
 
+bool AudioService::ReadCodecData(std::vector<int16_t>& data, int sample_rate, int samples) {
+    if (codec_->input_sample_rate() != sample_rate) {
+        if (codec_->input_channels() == 2) {
+            /* Read into the aligned scratch buffers, so the DSP kernels can use the vector unit */
+            int frames = samples * codec_->input_sample_rate() / sample_rate;
+            input_frame_buffer_.resize(frames * 2);
+            if (!codec_->InputData(input_frame_buffer_.data(), input_frame_buffer_.size())) {
+                return false;
+            }
+            input_mic_buffer_.resize(frames);
+            input_reference_buffer_.resize(frames);
+            audio_dsp::Deinterleave(input_frame_buffer_.data(), input_mic_buffer_.data(), input_reference_buffer_.data(), frames);
+            resampled_mic_buffer_.resize(input_resampler_.GetOutputSamples(frames));
+            resampled_reference_buffer_.resize(reference_resampler_.GetOutputSamples(frames));
+            input_resampler_.Process(input_mic_buffer_.data(), frames, resampled_mic_buffer_.data());
+            reference_resampler_.Process(input_reference_buffer_.data(), frames, resampled_reference_buffer_.data());
+            size_t output_frames = std::min(resampled_mic_buffer_.size(), resampled_reference_buffer_.size());
+            input_frame_buffer_.resize(output_frames * 2);
+            audio_dsp::Interleave(resampled_mic_buffer_.data(), resampled_reference_buffer_.data(), input_frame_buffer_.data(), output_frames);
+            data.assign(input_frame_buffer_.begin(), input_frame_buffer_.end());
+        } else {
+            data.resize(samples * codec_->input_sample_rate() / sample_rate);
+            if (!codec_->InputData(data)) {
+                return false;
+            }
+            resampled_mic_buffer_.resize(input_resampler_.GetOutputSamples(data.size()));
+            input_resampler_.Process(data.data(), data.size(), resampled_mic_buffer_.data());
+            data.assign(resampled_mic_buffer_.begin(), resampled_mic_buffer_.end());
+        }
+    } else {
+        data.resize(samples * codec_->input_channels());
+        if (!codec_->InputData(data)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 void AudioService::AudioInputTask() {
+    /* Reused across iterations, so reading the microphone does not allocate */
+    std::vector<int16_t> data;
     while (true) {
         EventBits_t bits = xEventGroupWaitBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING |
             AS_EVENT_WAKE_WORD_RUNNING | AS_EVENT_AUDIO_PROCESSOR_RUNNING,
@@ -196,41 +285,39 @@ void AudioService::AudioInputTask() {
         if (service_stopped_) {
             break;
         }
-        if (audio_input_need_warmup_) {
-            audio_input_need_warmup_ = false;
-            vTaskDelay(pdMS_TO_TICKS(120));
-            continue;
-        }
 
         /* Used for audio testing in NetworkConfiguring mode by clicking the BOOT button */
         if (bits & AS_EVENT_AUDIO_TESTING_RUNNING) {
-            if (audio_testing_queue_.size() >= AUDIO_TESTING_MAX_DURATION_MS / OPUS_FRAME_DURATION_MS) {
+            size_t testing_packets;
+            {
+                std::lock_guard<std::mutex> lock(audio_testing_mutex_);
+                testing_packets = audio_testing_queue_.size();
+            }
+            if (testing_packets >= AUDIO_TESTING_MAX_DURATION_MS / OPUS_FRAME_DURATION_MS) {
                 ESP_LOGW(TAG, "Audio testing queue is full, stopping audio testing");
                 EnableAudioTesting(false);
                 continue;
             }
-            std::vector<int16_t> data;
             int samples = OPUS_FRAME_DURATION_MS * 16000 / 1000;
             if (ReadAudioData(data, 16000, samples)) {
                 // If input channels is 2, we need to fetch the left channel data
                 if (codec_->input_channels() == 2) {
-                    auto mono_data = std::vector<int16_t>(data.size() / 2);
-                    for (size_t i = 0, j = 0; i < mono_data.size(); ++i, j += 2) {
-                        mono_data[i] = data[j];
+                    for (size_t i = 0, j = 0; j < data.size(); ++i, j += 2) {
+                        data[i] = data[j];
                     }
-                    data = std::move(mono_data);
+                    data.resize(data.size() / 2);
                 }
-                PushTaskToEncodeQueue(kAudioTaskTypeEncodeToTestingQueue, std::move(data));
+                PushTaskToEncodeQueue(kAudioTaskTypeEncodeToTestingQueue, data, last_capture_time_us_);
                 continue;
             }
         }
 
         /* Feed the wake word */
         if (bits & AS_EVENT_WAKE_WORD_RUNNING) {
-            std::vector<int16_t> data;
             int samples = wake_word_->GetFeedSize();
             if (samples > 0) {
                 if (ReadAudioData(data, 16000, samples)) {
+                    DetectWakeWordSpeech(data);
                     wake_word_->Feed(data);
                     continue;
                 }
@@ -239,10 +326,12 @@ void AudioService::AudioInputTask() {
 
         /* Feed the audio processor */
         if (bits & AS_EVENT_AUDIO_PROCESSOR_RUNNING) {
-            std::vector<int16_t> data;
             int samples = audio_processor_->GetFeedSize();
             if (samples > 0) {
                 if (ReadAudioData(data, 16000, samples)) {
+                    uint64_t end_sample = processor_input_samples_ + data.size() / codec_->input_channels();
+                    processor_input_samples_ = end_sample;
+                    capture_stamps_.Push({end_sample, last_capture_time_us_});
                     audio_processor_->Feed(std::move(data));
                     continue;
                 }
@@ -256,35 +345,70 @@ void AudioService::AudioInputTask() {
     ESP_LOGW(TAG, "Audio input task stopped");
 }
 
+void AudioService::DetectWakeWordSpeech(const std::vector<int16_t>& data) {
+    if (!callbacks_.on_speech_energy) {
+        return;
+    }
+    int channels = codec_->input_channels();
+    size_t samples = data.size() / channels;
+    int64_t now_us = esp_timer_get_time();
+    /* The floor and the hangover start over when the wake word was not running for a while */
+    if (samples != wake_word_vad_samples_) {
+        wake_word_vad_samples_ = samples;
+        wake_word_vad_.Configure(std::max<int>(1, samples * 1000 / 16000), WAKE_WORD_VAD_HANGOVER_MS);
+    } else if (now_us - wake_word_vad_time_us_ > WAKE_WORD_VAD_HANGOVER_MS * 1000) {
+        wake_word_vad_.Reset();
+    }
+    wake_word_vad_time_us_ = now_us;
+
+    bool was_speaking = wake_word_vad_.speaking();
+    if (wake_word_vad_.Process(data.data(), samples, channels) && !was_speaking) {
+        callbacks_.on_speech_energy();
+    }
+}
+
 void AudioService::AudioOutputTask() {
+    size_t frame_samples = codec_->output_sample_rate() * OPUS_FRAME_DURATION_MS / 1000;
     while (true) {
-        std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-        audio_queue_cv_.wait(lock, [this]() { return !audio_playback_queue_.empty() || service_stopped_; });
         if (service_stopped_) {
             break;
         }
 
-        auto task = std::move(audio_playback_queue_.front());
-        audio_playback_queue_.pop_front();
-        audio_queue_cv_.notify_all();
-        lock.unlock();
-
-        if (!codec_->output_enabled()) {
-            esp_timer_stop(audio_power_timer_);
-            esp_timer_start_periodic(audio_power_timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
-            codec_->EnableOutput(true);
+        /* Items discarded by ResetDecoder() free up playback slots as well */
+        bool dropped = audio_playback_queue_.DropFlushed() > 0;
+        AudioTaskPtr task;
+        if (!audio_playback_queue_.Pop(task)) {
+            /* Without server audio the sounds are mixed into silence */
+            size_t overlay_samples = mixer_.GetOverlaySamples();
+            if (overlay_samples == 0) {
+                if (dropped) {
+                    NotifyTask(opus_decode_task_handle_);
+                }
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+                continue;
+            }
+            task = task_pool_.Acquire();
+            task->pcm.assign(std::min(overlay_samples, frame_samples), 0);
         }
+        NotifyTask(opus_decode_task_handle_);
+
+        mixer_.Mix(task->pcm.data(), task->pcm.size());
+        power_manager_.EnableOutput();
         codec_->OutputData(task->pcm);
+        if (task->trace_time_us > 0) {
+            latency_tracer_.Record(kLatencyReceiveToOutput, task->trace_time_us);
+            latency_tracer_.OnOutput();
+        }
 
-        /* Update the last output time */
-        last_output_time_ = std::chrono::steady_clock::now();
+        power_manager_.OnOutputFrame();
         debug_statistics_.playback_count++;
 
 #if CONFIG_USE_SERVER_AEC
         /* Record the timestamp for server AEC */
         if (task->timestamp > 0) {
-            lock.lock();
-            timestamp_queue_.push_back(task->timestamp);
+            if (!timestamp_queue_.Push(std::move(task->timestamp))) {
+                ESP_LOGW(TAG, "Timestamp queue is full, dropping timestamp");
+            }
         }
 #endif
     }
@@ -292,145 +416,485 @@ void AudioService::AudioOutputTask() {
     ESP_LOGW(TAG, "Audio output task stopped");
 }
 
-void AudioService::OpusCodecTask() {
+bool AudioService::PopDecodePacket(AudioStreamPacketPtr& packet) {
+    if (audio_decode_queue_.DropFlushed() > 0) {
+        xEventGroupSetBits(event_group_, AS_EVENT_DECODE_QUEUE_AVAILABLE);
+    }
+    if (audio_decode_queue_.Pop(packet)) {
+        xEventGroupSetBits(event_group_, AS_EVENT_DECODE_QUEUE_AVAILABLE);
+        return true;
+    }
+
+    /* The audio testing queue is replayed after the decode queue is drained */
+    std::lock_guard<std::mutex> lock(audio_testing_mutex_);
+    if (!audio_testing_replay_) {
+        return false;
+    }
+    if (audio_testing_queue_.empty()) {
+        audio_testing_replay_ = false;
+        return false;
+    }
+    packet = std::move(audio_testing_queue_.front());
+    audio_testing_queue_.pop_front();
+    // The capture time of the replayed audio is not a receive time, it stays out of the latency stages
+    packet->trace_time_us = 0;
+    return true;
+}
+
+static void AccountCodecFrame(AudioCodecTaskUsage& usage, int64_t start_us) {
+    uint32_t elapsed_us = esp_timer_get_time() - start_us;
+    usage.busy_us += elapsed_us;
+    usage.frames++;
+    if (elapsed_us > usage.max_frame_us) {
+        usage.max_frame_us = elapsed_us;
+    }
+}
+
+void AudioService::OpusDecodeTask() {
+    /* A packet popped from the decode queue that does not fit into the jitter buffer yet */
+    AudioStreamPacketPtr pending_packet;
     while (true) {
-        std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-        audio_queue_cv_.wait(lock, [this]() {
-            return service_stopped_ ||
-                (!audio_encode_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) ||
-                (!audio_decode_queue_.empty() && audio_playback_queue_.size() < MAX_PLAYBACK_TASKS_IN_QUEUE);
-        });
         if (service_stopped_) {
             break;
         }
+        int64_t now_us = esp_timer_get_time();
+
+        if (jitter_buffer_reset_.exchange(false)) {
+            jitter_buffer_.Reset();
+            pending_packet.reset();
+            stream_decoder_->decoder->ResetState();
+            if (stream_decoder_->resample) {
+                stream_decoder_->resampler.Reset();
+            }
+            time_stretch_catching_up_ = false;
+            time_stretch_recovery_frames_ = 0;
+            time_stretch_credit_ = 0;
+        }
 
-        /* Decode the audio from decode queue */
-        if (!audio_decode_queue_.empty() && audio_playback_queue_.size() < MAX_PLAYBACK_TASKS_IN_QUEUE) {
-            auto packet = std::move(audio_decode_queue_.front());
-            audio_decode_queue_.pop_front();
-            audio_queue_cv_.notify_all();
-            lock.unlock();
+        /* Move the incoming packets into the jitter buffer */
+        while (pending_packet || PopDecodePacket(pending_packet)) {
+            if (!jitter_buffer_.Put(pending_packet, now_us)) {
+                break;
+            }
+        }
 
-            auto task = std::make_unique<AudioTask>();
-            task->type = kAudioTaskTypeDecodeToPlaybackQueue;
-            task->timestamp = packet->timestamp;
+        /* Sounds go straight to their mixer channel, next to the server audio */
+        DecodeSounds();
 
-            SetDecodeSampleRate(packet->sample_rate, packet->frame_duration);
-            if (opus_decoder_->Decode(std::move(packet->payload), task->pcm)) {
-                // Resample if the sample rate is different
-                if (opus_decoder_->sample_rate() != codec_->output_sample_rate()) {
-                    int target_size = output_resampler_.GetOutputSamples(task->pcm.size());
-                    std::vector<int16_t> resampled(target_size);
-                    output_resampler_.Process(task->pcm.data(), task->pcm.size(), resampled.data());
-                    task->pcm = std::move(resampled);
-                }
+        /* Decode the audio from the jitter buffer, or conceal the frame that is missing */
+        int64_t decode_start_us = esp_timer_get_time();   // DecodeSounds() accounted its own time
+        AudioStreamPacketPtr packet;
+        JitterBufferResult result = kJitterBufferEmpty;
+        if (!audio_playback_queue_.Full()) {
+            result = jitter_buffer_.Get(packet, now_us);
+        }
+        if (result == kJitterBufferEmpty) {
+#if CONFIG_USE_SOUND_PCM_CACHE
+            /* Fill the sound cache while there is nothing to play */
+            if (sound_cache_.HasPending() && audio_playback_queue_.Empty() && jitter_buffer_.GetPlayoutDeadline() < 0 &&
+                !sound_pending_) {
+                sound_cache_.DecodePending(codec_->output_sample_rate(), CONFIG_SOUND_PCM_CACHE_MAX_DURATION_MS);
+                continue;
+            }
+#endif
+            /* Wake up in time to start playout of a stream that is still buffering */
+            TickType_t wait_ticks = portMAX_DELAY;
+            int64_t deadline_us = jitter_buffer_.GetPlayoutDeadline();
+            if (deadline_us >= 0 && !audio_playback_queue_.Full()) {
+                wait_ticks = pdMS_TO_TICKS((deadline_us - now_us + 999) / 1000) + 1;
+            }
+            ulTaskNotifyTake(pdTRUE, wait_ticks);
+            continue;
+        }
+
+        auto task = task_pool_.Acquire();
+        task->type = kAudioTaskTypeDecodeToPlaybackQueue;
 
-                lock.lock();
-                audio_playback_queue_.push_back(std::move(task));
-                audio_queue_cv_.notify_all();
+        bool decoded;
+        if (result == kJitterBufferPacket) {
+            task->timestamp = packet->timestamp;
+            task->trace_time_us = packet->trace_time_us;
+            SetDecodeSampleRate(packet->sample_rate, packet->frame_duration);
+            if (packet->payload_view != nullptr) {
+                // The decoder only takes a vector, so the view is staged in a reused buffer
+                decode_view_buffer_.assign(packet->payload_view, packet->payload_view + packet->payload_view_size);
+                decoded = stream_decoder_->decoder->Decode(std::move(decode_view_buffer_), task->pcm);
             } else {
-                ESP_LOGE(TAG, "Failed to decode audio");
-                lock.lock();
+                decoded = stream_decoder_->decoder->Decode(std::move(packet->payload), task->pcm);
             }
-            debug_statistics_.decode_count++;
+            if (decoded && (packet->trim_start > 0 || packet->trim_end > 0)) {
+                size_t trim_start = std::min<size_t>(packet->trim_start, task->pcm.size());
+                size_t trim_end = std::min<size_t>(packet->trim_end, task->pcm.size() - trim_start);
+                task->pcm.resize(task->pcm.size() - trim_end);
+                task->pcm.erase(task->pcm.begin(), task->pcm.begin() + trim_start);
+            }
+#if CONFIG_USE_AUDIO_TIME_STRETCH
+            if (decoded) {
+                StretchDecodedFrame(task->pcm);
+            }
+#endif
+        } else {
+            // An empty payload makes the decoder run packet loss concealment
+            decoded = stream_decoder_->decoder->Decode(std::vector<uint8_t>(), task->pcm);
+            time_stretch_recovery_frames_ = TIME_STRETCH_RECOVERY_FRAMES;
         }
-        
-        /* Encode the audio to send queue */
-        if (!audio_encode_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) {
-            auto task = std::move(audio_encode_queue_.front());
-            audio_encode_queue_.pop_front();
-            audio_queue_cv_.notify_all();
-            lock.unlock();
+        if (decoded) {
+            // Resample if the sample rate is different
+            if (stream_decoder_->resample) {
+                auto& resampler = stream_decoder_->resampler;
+                output_resample_buffer_.resize(resampler.GetOutputSamples(task->pcm.size()));
+                resampler.Process(task->pcm.data(), task->pcm.size(), output_resample_buffer_.data());
+                task->pcm.swap(output_resample_buffer_);
+            }
 
-            auto packet = std::make_unique<AudioStreamPacket>();
-            packet->frame_duration = OPUS_FRAME_DURATION_MS;
-            packet->sample_rate = 16000;
-            packet->timestamp = task->timestamp;
-            if (!opus_encoder_->Encode(std::move(task->pcm), packet->payload)) {
-                ESP_LOGE(TAG, "Failed to encode audio");
-                continue;
+            latency_tracer_.Record(kLatencyReceiveToDecoded, task->trace_time_us);
+            audio_playback_queue_.Push(std::move(task));
+            NotifyTask(audio_output_task_handle_);
+        } else {
+            ESP_LOGE(TAG, "Failed to decode audio");
+        }
+        debug_statistics_.decode_count++;
+        AccountCodecFrame(decode_task_usage_, decode_start_us);
+    }
+
+    sound_pcm_.clear();
+    sound_pcm_offset_ = 0;
+    decoder_cache_.Release(sound_decoder_);
+    sound_decoder_ = nullptr;
+    ESP_LOGW(TAG, "Opus decode task stopped");
+}
+
+void AudioService::DecodeSounds() {
+    while (true) {
+        /* Write what is left of the last sound packet, as far as its channel has room */
+        if (sound_pcm_offset_ < sound_pcm_.size()) {
+            size_t written = mixer_.Write(sound_channel_, sound_pcm_.data() + sound_pcm_offset_,
+                sound_pcm_.size() - sound_pcm_offset_);
+            sound_pcm_offset_ += written;
+            if (written > 0) {
+                NotifyTask(audio_output_task_handle_);
+            }
+            if (sound_pcm_offset_ < sound_pcm_.size()) {
+                return;
             }
+        }
 
-            if (task->type == kAudioTaskTypeEncodeToSendQueue) {
-                {
-                    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-                    audio_send_queue_.push_back(std::move(packet));
-                }
-                if (callbacks_.on_send_queue_available) {
-                    callbacks_.on_send_queue_available();
-                }
-            } else if (task->type == kAudioTaskTypeEncodeToTestingQueue) {
-                std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-                audio_testing_queue_.push_back(std::move(packet));
+        // Set before the pop, so IsIdle() never sees a sound between the queue and the mixer
+        sound_pending_ = true;
+        if (audio_sound_queue_.DropFlushed() > 0) {
+            xEventGroupSetBits(event_group_, AS_EVENT_SOUND_QUEUE_AVAILABLE);
+        }
+        AudioStreamPacketPtr packet;
+        if (!audio_sound_queue_.Pop(packet)) {
+            /* The next sound is a new stream, its decoder comes back from the cache reset */
+            decoder_cache_.Release(sound_decoder_);
+            sound_decoder_ = nullptr;
+            sound_pending_ = false;
+            return;
+        }
+        xEventGroupSetBits(event_group_, AS_EVENT_SOUND_QUEUE_AVAILABLE);
+
+        int64_t start_us = esp_timer_get_time();
+        sound_channel_ = (AudioMixerChannel)packet->mixer_channel;
+        sound_pcm_offset_ = 0;
+        if (!DecodeSoundPacket(*packet)) {
+            ESP_LOGE(TAG, "Failed to decode sound");
+            sound_pcm_.clear();
+        }
+        debug_statistics_.decode_count++;
+        AccountCodecFrame(decode_task_usage_, start_us);
+    }
+}
+
+bool AudioService::DecodeSoundPacket(AudioStreamPacket& packet) {
+    if (packet.pcm) {
+        /* A slice of a cached sound, already PCM at the output sample rate */
+        auto pcm = reinterpret_cast<const int16_t*>(packet.payload_view);
+        sound_pcm_.assign(pcm, pcm + packet.payload_view_size / sizeof(int16_t));
+        return true;
+    }
+
+    /* Sounds have their own decoder, so they do not disturb the state of the server stream */
+    sound_decoder_ = decoder_cache_.Acquire(sound_decoder_, packet.sample_rate, packet.frame_duration, 1);
+
+    // The decoder only takes a vector, so the view is staged in a reused buffer
+    decode_view_buffer_.assign(packet.payload_view, packet.payload_view + packet.payload_view_size);
+    if (!sound_decoder_->decoder->Decode(std::move(decode_view_buffer_), sound_pcm_)) {
+        return false;
+    }
+    if (packet.trim_start > 0 || packet.trim_end > 0) {
+        size_t trim_start = std::min<size_t>(packet.trim_start, sound_pcm_.size());
+        size_t trim_end = std::min<size_t>(packet.trim_end, sound_pcm_.size() - trim_start);
+        sound_pcm_.resize(sound_pcm_.size() - trim_end);
+        sound_pcm_.erase(sound_pcm_.begin(), sound_pcm_.begin() + trim_start);
+    }
+    if (sound_decoder_->resample) {
+        auto& resampler = sound_decoder_->resampler;
+        output_resample_buffer_.resize(resampler.GetOutputSamples(sound_pcm_.size()));
+        resampler.Process(sound_pcm_.data(), sound_pcm_.size(), output_resample_buffer_.data());
+        sound_pcm_.swap(output_resample_buffer_);
+    }
+    return true;
+}
+
+void AudioService::OpusEncodeTask() {
+    std::vector<uint8_t> encode_buffer;
+    uint32_t packet_timestamp = 0;
+    int64_t packet_trace_time_us = 0;
+
+    while (true) {
+        if (service_stopped_) {
+            break;
+        }
+
+        AudioTaskPtr task;
+        if (audio_send_queue_.Full() || !audio_encode_queue_.Pop(task)) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        xEventGroupSetBits(event_group_, AS_EVENT_ENCODE_QUEUE_AVAILABLE);
+        int64_t start_us = esp_timer_get_time();
+
+        if (encoder_reset_.exchange(false)) {
+            opus_encoder_->ResetState();
+        }
+        if (uplink_params_changed_.exchange(false)) {
+            ApplyUplinkParams();
+        }
+
+        /* A packet may span several tasks, it takes the time and trace of the first one */
+        if (opus_encoder_->IsBufferEmpty()) {
+            packet_timestamp = task->timestamp;
+            packet_trace_time_us = task->trace_time_us;
+        }
+        if (!opus_encoder_->Encode(task->pcm, encode_buffer)) {
+            continue;
+        }
+
+        /* Testing packets are kept for seconds, so they do not take frames from the pool */
+        AudioStreamPacketPtr packet = task->type == kAudioTaskTypeEncodeToSendQueue ?
+            packet_pool_.Acquire() : std::make_unique<AudioStreamPacket>();
+        packet->frame_duration = opus_encoder_->frame_duration();
+        packet->sample_rate = 16000;
+        packet->timestamp = packet_timestamp;
+        packet->trace_time_us = packet_trace_time_us;
+
+        if (task->type == kAudioTaskTypeEncodeToSendQueue) {
+            /* The protocol writes its header into the headroom and sends the packet without copying it */
+            packet->payload.resize(AUDIO_PACKET_HEADROOM);
+            packet->payload.insert(packet->payload.end(), encode_buffer.begin(), encode_buffer.end());
+            packet->headroom = AUDIO_PACKET_HEADROOM;
+            /* DTX frames carry no audio, the decoder fills the gap from the last comfort noise update */
+            if (uplink_silent_ && packet->size() <= OPUS_DTX_MAX_PACKET_BYTES) {
+                suppressed_uplink_packets_.fetch_add(1, std::memory_order_relaxed);
+                AccountCodecFrame(encode_task_usage_, start_us);
+                continue;
+            }
+            latency_tracer_.Record(kLatencyMicToEncoded, packet->trace_time_us);
+            audio_send_queue_.Push(std::move(packet));
+            if (callbacks_.on_send_queue_available) {
+                callbacks_.on_send_queue_available();
             }
-            debug_statistics_.encode_count++;
-            lock.lock();
+#if CONFIG_USE_AUDIO_UPLINK_RATE_CONTROL
+            if (uplink_rate_controller_.Update(audio_send_queue_.Size(), MAX_SEND_PACKETS_IN_QUEUE, esp_timer_get_time())) {
+                ApplyUplinkParams();
+            }
+#endif
+        } else if (task->type == kAudioTaskTypeEncodeToTestingQueue) {
+            packet->payload.assign(encode_buffer.begin(), encode_buffer.end());
+            std::lock_guard<std::mutex> lock(audio_testing_mutex_);
+            audio_testing_queue_.push_back(std::move(packet));
         }
+        debug_statistics_.encode_count++;
+        AccountCodecFrame(encode_task_usage_, start_us);
     }
 
-    ESP_LOGW(TAG, "Opus codec task stopped");
+    ESP_LOGW(TAG, "Opus encode task stopped");
+}
+
+void AudioService::ApplyUplinkParams() {
+    auto params = uplink_rate_controller_.GetParams();
+    opus_encoder_->SetBitrate(params.bitrate);
+    opus_encoder_->SetDtx(params.dtx || uplink_silent_);
+    opus_encoder_->SetFrameDuration(params.frame_duration);
+}
+
+void AudioService::SetUplinkMaxFrameDuration(int frame_duration) {
+    if (frame_duration <= 0) {
+        frame_duration = OPUS_FRAME_DURATION_MS;
+    }
+    uplink_rate_controller_.SetMaxFrameDuration(std::min(frame_duration, UPLINK_MAX_FRAME_DURATION_MS));
+    uplink_params_changed_ = true;
+}
+
+void AudioService::ResetUplinkRate() {
+    uplink_rate_controller_.Reset();
+    uplink_params_changed_ = true;
+}
+
+void AudioService::PrintCodecTaskUsage() {
+    int64_t now_us = esp_timer_get_time();
+    int64_t elapsed_us = now_us - last_task_usage_time_us_;
+    last_task_usage_time_us_ = now_us;
+
+    auto print = [elapsed_us](const char* name, const AudioCodecTaskUsage& usage, AudioCodecTaskUsage& last) {
+        uint32_t frames = usage.frames - last.frames;
+        uint64_t busy_us = usage.busy_us - last.busy_us;
+        last = usage;
+        if (frames == 0 || elapsed_us <= 0) {
+            return;
+        }
+        ESP_LOGI(TAG, "%s: %lu frames, busy %llu ms (%.1f%%), max %lu us/frame", name, frames,
+            busy_us / 1000, busy_us * 100.0f / elapsed_us, usage.max_frame_us);
+    };
+    print("opus_encode", encode_task_usage_, last_encode_task_usage_);
+    print("opus_decode", decode_task_usage_, last_decode_task_usage_);
+    ESP_LOGI(TAG, "opus_encode: %lu silent packets suppressed", (unsigned long)suppressed_uplink_packets_.load());
+    auto cache = decoder_cache_.statistics();
+    ESP_LOGI(TAG, "opus_decode: decoder cache %lu hits, %lu misses", (unsigned long)cache.hits, (unsigned long)cache.misses);
 }
 
 void AudioService::SetDecodeSampleRate(int sample_rate, int frame_duration) {
-    if (opus_decoder_->sample_rate() == sample_rate && opus_decoder_->duration_ms() == frame_duration) {
+    auto decoder = decoder_cache_.Acquire(stream_decoder_, sample_rate, frame_duration, 1);
+    if (decoder != stream_decoder_) {
+        stream_decoder_ = decoder;
+        time_stretcher_.Configure(sample_rate);
+    }
+}
+
+#if CONFIG_USE_AUDIO_TIME_STRETCH
+void AudioService::StretchDecodedFrame(std::vector<int16_t>& pcm) {
+    /* Speed up while frames are buffered beyond the jitter target, slow down after it ran dry */
+    int depth = jitter_buffer_.depth() + audio_decode_queue_.Size();
+    int target = jitter_buffer_.target_depth();
+    if (depth > target + TIME_STRETCH_CATCHUP_FRAMES) {
+        time_stretch_catching_up_ = true;
+    } else if (depth <= target) {
+        time_stretch_catching_up_ = false;
+    }
+    /* Recovery is bounded, a target raised by jitter must not keep the speech slow for the whole session */
+    if (depth > JITTER_BUFFER_MIN_DEPTH) {
+        time_stretch_recovery_frames_ = 0;
+    }
+    bool recovering = time_stretch_recovery_frames_ > 0 && !time_stretch_catching_up_;
+    if (time_stretch_recovery_frames_ > 0) {
+        time_stretch_recovery_frames_--;
+    }
+    if (!time_stretch_catching_up_ && !recovering) {
+        time_stretch_credit_ = 0;
         return;
     }
 
-    opus_decoder_.reset();
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(sample_rate, 1, frame_duration);
+    /* Splices are a whole pitch period, the credit spreads them so the speed stays within the limit */
+    time_stretch_credit_ += pcm.size() * (CONFIG_AUDIO_TIME_STRETCH_MAX_SPEED - 100) / CONFIG_AUDIO_TIME_STRETCH_MAX_SPEED;
+    time_stretch_credit_ = std::min(time_stretch_credit_, pcm.size() / 2);
+    size_t samples;
+    if (time_stretch_catching_up_) {
+        samples = time_stretcher_.Compress(pcm, time_stretch_credit_);
+    } else {
+        samples = time_stretcher_.Expand(pcm, time_stretch_credit_);
+    }
+    time_stretch_credit_ -= samples;
+}
+#endif
 
-    auto codec = Board::GetInstance().GetAudioCodec();
-    if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
-        ESP_LOGI(TAG, "Resampling audio from %d to %d", opus_decoder_->sample_rate(), codec->output_sample_rate());
-        output_resampler_.Configure(opus_decoder_->sample_rate(), codec->output_sample_rate());
+int64_t AudioService::GetProcessorOutputCaptureTime(size_t samples) {
+    /* The processor outputs its input in order, the frame starts in the first read that ends after it */
+    uint64_t start_sample = processor_output_samples_;
+    processor_output_samples_ = start_sample + samples;
+    CaptureStamp stamp;
+    while (processor_output_stamp_.end_sample <= start_sample && capture_stamps_.Pop(stamp)) {
+        processor_output_stamp_ = stamp;
+    }
+    if (processor_output_stamp_.end_sample <= start_sample) {
+        return last_capture_time_us_;
     }
+    return processor_output_stamp_.time_us;
 }
 
-void AudioService::PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm) {
-    auto task = std::make_unique<AudioTask>();
+void AudioService::PushTaskToEncodeQueue(AudioTaskType type, const std::vector<int16_t>& pcm, int64_t trace_time_us) {
+    /* Copy into the pooled frame, the caller keeps its buffer for the next read */
+    auto task = task_pool_.Acquire();
     task->type = type;
-    task->pcm = std::move(pcm);
-    
-    /* Push the task to the encode queue */
-    std::unique_lock<std::mutex> lock(audio_queue_mutex_);
+    task->pcm.assign(pcm.begin(), pcm.end());
+    task->trace_time_us = trace_time_us;
+    if (type == kAudioTaskTypeEncodeToSendQueue) {
+        latency_tracer_.Record(kLatencyMicToProcessed, task->trace_time_us);
+    }
 
     /* If the task is to send queue, we need to set the timestamp */
-    if (type == kAudioTaskTypeEncodeToSendQueue && !timestamp_queue_.empty()) {
-        if (timestamp_queue_.size() <= MAX_TIMESTAMPS_IN_QUEUE) {
-            task->timestamp = timestamp_queue_.front();
-        } else {
-            ESP_LOGW(TAG, "Timestamp queue (%u) is full, dropping timestamp", timestamp_queue_.size());
+    uint32_t timestamp;
+    if (type == kAudioTaskTypeEncodeToSendQueue && timestamp_queue_.Pop(timestamp)) {
+        task->timestamp = timestamp;
+    }
+
+    /* Push the task to the encode queue, wait for the opus encode task if it is full */
+    while (!audio_encode_queue_.Push(std::move(task))) {
+        xEventGroupClearBits(event_group_, AS_EVENT_ENCODE_QUEUE_AVAILABLE);
+        if (!audio_encode_queue_.Full()) {
+            continue;
+        }
+        xEventGroupWaitBits(event_group_, AS_EVENT_ENCODE_QUEUE_AVAILABLE, pdTRUE, pdFALSE, portMAX_DELAY);
+        if (service_stopped_) {
+            return;
         }
-        timestamp_queue_.pop_front();
     }
+    NotifyTask(opus_encode_task_handle_);
+}
 
-    audio_queue_cv_.wait(lock, [this]() { return audio_encode_queue_.size() < MAX_ENCODE_TASKS_IN_QUEUE; });
-    audio_encode_queue_.push_back(std::move(task));
-    audio_queue_cv_.notify_all();
+bool AudioService::PushPacketToDecodeQueue(AudioStreamPacketPtr packet, bool wait) {
+    /* Stamp the arrival, unless the packet was stamped before it was queued */
+    if (packet->trace_time_us == 0) {
+        packet->trace_time_us = esp_timer_get_time();
+        latency_tracer_.OnPacketReceived();
+    }
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(audio_decode_push_mutex_);
+            if (audio_decode_queue_.Push(std::move(packet))) {
+                break;
+            }
+            xEventGroupClearBits(event_group_, AS_EVENT_DECODE_QUEUE_AVAILABLE);
+            if (!audio_decode_queue_.Full()) {
+                continue;
+            }
+        }
+        if (!wait || service_stopped_) {
+            return false;
+        }
+        xEventGroupWaitBits(event_group_, AS_EVENT_DECODE_QUEUE_AVAILABLE, pdTRUE, pdFALSE, portMAX_DELAY);
+    }
+    NotifyTask(opus_decode_task_handle_);
+    return true;
 }
 
-bool AudioService::PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait) {
-    std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-    if (audio_decode_queue_.size() >= MAX_DECODE_PACKETS_IN_QUEUE) {
-        if (wait) {
-            audio_queue_cv_.wait(lock, [this]() { return audio_decode_queue_.size() < MAX_DECODE_PACKETS_IN_QUEUE; });
-        } else {
+bool AudioService::PushPacketToSoundQueue(AudioStreamPacketPtr packet) {
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(audio_sound_push_mutex_);
+            if (audio_sound_queue_.Push(std::move(packet))) {
+                break;
+            }
+            xEventGroupClearBits(event_group_, AS_EVENT_SOUND_QUEUE_AVAILABLE);
+            if (!audio_sound_queue_.Full()) {
+                continue;
+            }
+        }
+        if (service_stopped_) {
             return false;
         }
+        xEventGroupWaitBits(event_group_, AS_EVENT_SOUND_QUEUE_AVAILABLE, pdTRUE, pdFALSE, portMAX_DELAY);
     }
-    audio_decode_queue_.push_back(std::move(packet));
-    audio_queue_cv_.notify_all();
+    NotifyTask(opus_decode_task_handle_);
     return true;
 }
 
-std::unique_ptr<AudioStreamPacket> AudioService::PopPacketFromSendQueue() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    if (audio_send_queue_.empty()) {
+AudioStreamPacketPtr AudioService::PopPacketFromSendQueue() {
+    AudioStreamPacketPtr packet;
+    if (!audio_send_queue_.Pop(packet)) {
         return nullptr;
     }
-    auto packet = std::move(audio_send_queue_.front());
-    audio_send_queue_.pop_front();
-    audio_queue_cv_.notify_all();
+    NotifyTask(opus_encode_task_handle_);
     return packet;
 }
 
@@ -444,7 +908,7 @@ const std::string& AudioService::GetLastWakeWord() const {
     return wake_word_->GetLastDetectedWakeWord();
 }
 
-std::unique_ptr<AudioStreamPacket> AudioService::PopWakeWordPacket() {
+AudioStreamPacketPtr AudioService::PopWakeWordPacket() {
     auto packet = std::make_unique<AudioStreamPacket>();
     if (wake_word_->GetWakeWordOpus(packet->payload)) {
         return packet;
@@ -484,7 +948,15 @@ void AudioService::EnableVoiceProcessing(bool enable) {
 
         /* We should make sure no audio is playing */
         ResetDecoder();
-        audio_input_need_warmup_ = true;
+        /* A new session starts without the PCM left over from the previous one */
+        encoder_reset_ = true;
+        /* Until the VAD hears speech, Opus only sends its comfort noise updates */
+        if (silence_suppression_) {
+            uplink_silent_ = true;
+            uplink_params_changed_ = true;
+        }
+        /* The processor starts empty, its output lines up with the next input read */
+        processor_output_samples_ = processor_input_samples_.load();
         audio_processor_->Start();
         xEventGroupSetBits(event_group_, AS_EVENT_AUDIO_PROCESSOR_RUNNING);
     } else {
@@ -499,10 +971,12 @@ void AudioService::EnableAudioTesting(bool enable) {
         xEventGroupSetBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING);
     } else {
         xEventGroupClearBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING);
-        /* Copy audio_testing_queue_ to audio_decode_queue_ */
-        std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-        audio_decode_queue_ = std::move(audio_testing_queue_);
-        audio_queue_cv_.notify_all();
+        /* Replay audio_testing_queue_ through the decoder */
+        {
+            std::lock_guard<std::mutex> lock(audio_testing_mutex_);
+            audio_testing_replay_ = true;
+        }
+        NotifyTask(opus_decode_task_handle_);
     }
 }
 
@@ -520,133 +994,96 @@ void AudioService::SetCallbacks(AudioServiceCallbacks& callbacks) {
     callbacks_ = callbacks;
 }
 
-void AudioService::PlaySound(const std::string_view& ogg) {
-    if (!codec_->output_enabled()) {
-        esp_timer_stop(audio_power_timer_);
-        esp_timer_start_periodic(audio_power_timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
-        codec_->EnableOutput(true);
+void AudioService::PlaySound(const std::string_view& ogg, AudioMixerChannel channel) {
+    power_manager_.EnableOutput();
+
+#if CONFIG_USE_SOUND_PCM_CACHE
+    /* A cached sound is queued as PCM slices of one frame, they bypass the Opus decoder */
+    const int16_t* pcm;
+    size_t samples;
+    if (sound_cache_.Lookup(ogg, pcm, samples)) {
+        int sample_rate = codec_->output_sample_rate();
+        size_t frame_samples = sample_rate * OPUS_FRAME_DURATION_MS / 1000;
+        for (size_t offset = 0; offset < samples; offset += frame_samples) {
+            auto packet = std::make_unique<AudioStreamPacket>();
+            packet->sample_rate = sample_rate;
+            packet->frame_duration = OPUS_FRAME_DURATION_MS;
+            packet->payload_view = reinterpret_cast<const uint8_t*>(pcm + offset);
+            packet->payload_view_size = std::min(frame_samples, samples - offset) * sizeof(int16_t);
+            packet->pcm = true;
+            packet->mixer_channel = channel;
+            if (!PushPacketToSoundQueue(std::move(packet))) {
+                return;
+            }
+        }
+        return;
     }
+#endif
 
-    const uint8_t* buf = reinterpret_cast<const uint8_t*>(ogg.data());
-    size_t size = ogg.size();
-    size_t offset = 0;
-
-    auto find_page = [&](size_t start)->size_t {
-        for (size_t i = start; i + 4 <= size; ++i) {
-            if (buf[i] == 'O' && buf[i+1] == 'g' && buf[i+2] == 'g' && buf[i+3] == 'S') return i;
+    /* The sound data lives in flash, the packets only point into it */
+    OggDemuxer demuxer;
+    if (!demuxer.Open(ogg)) {
+        return;
+    }
+    int sample_rate = demuxer.sample_rate();
+    OggOpusPacket ogg_packet;
+    while (demuxer.Next(ogg_packet)) {
+        if (ogg_packet.samples == 0) {
+            ESP_LOGW(TAG, "Skipping malformed Opus packet of %u bytes", ogg_packet.size);
+            continue;
         }
-        return static_cast<size_t>(-1);
-    };
-
-    bool seen_head = false;
-    bool seen_tags = false;
-    int sample_rate = 16000; // 默认值
-
-    while (true) {
-        size_t pos = find_page(offset);
-        if (pos == static_cast<size_t>(-1)) break;
-        offset = pos;
-        if (offset + 27 > size) break;
-
-        const uint8_t* page = buf + offset;
-        uint8_t page_segments = page[26];
-        size_t seg_table_off = offset + 27;
-        if (seg_table_off + page_segments > size) break;
-
-        size_t body_size = 0;
-        for (size_t i = 0; i < page_segments; ++i) body_size += page[27 + i];
-
-        size_t body_off = seg_table_off + page_segments;
-        if (body_off + body_size > size) break;
-
-        // Parse packets using lacing
-        size_t cur = body_off;
-        size_t seg_idx = 0;
-        while (seg_idx < page_segments) {
-            size_t pkt_len = 0;
-            size_t pkt_start = cur;
-            bool continued = false;
-            do {
-                uint8_t l = page[27 + seg_idx++];
-                pkt_len += l;
-                cur += l;
-                continued = (l == 255);
-            } while (continued && seg_idx < page_segments);
-
-            if (pkt_len == 0) continue;
-            const uint8_t* pkt_ptr = buf + pkt_start;
-
-            if (!seen_head) {
-                // 解析OpusHead包
-                if (pkt_len >= 19 && std::memcmp(pkt_ptr, "OpusHead", 8) == 0) {
-                    seen_head = true;
-                    
-                    // OpusHead结构：[0-7] "OpusHead", [8] version, [9] channel_count, [10-11] pre_skip
-                    // [12-15] input_sample_rate, [16-17] output_gain, [18] mapping_family
-                    if (pkt_len >= 12) {
-                        uint8_t version = pkt_ptr[8];
-                        uint8_t channel_count = pkt_ptr[9];
-                        
-                        if (pkt_len >= 16) {
-                            // 读取输入采样率 (little-endian)
-                            sample_rate = pkt_ptr[12] | (pkt_ptr[13] << 8) | 
-                                        (pkt_ptr[14] << 16) | (pkt_ptr[15] << 24);
-                            ESP_LOGI(TAG, "OpusHead: version=%d, channels=%d, sample_rate=%d", 
-                                   version, channel_count, sample_rate);
-                        }
-                    }
-                }
-                continue;
-            }
-            if (!seen_tags) {
-                // Expect OpusTags in second packet
-                if (pkt_len >= 8 && std::memcmp(pkt_ptr, "OpusTags", 8) == 0) {
-                    seen_tags = true;
-                }
-                continue;
-            }
-
-            // Audio packet (Opus)
-            auto packet = std::make_unique<AudioStreamPacket>();
-            packet->sample_rate = sample_rate;
-            packet->frame_duration = 60;
-            packet->payload.resize(pkt_len);
-            std::memcpy(packet->payload.data(), pkt_ptr, pkt_len);
-            PushPacketToDecodeQueue(std::move(packet), true);
+        auto packet = std::make_unique<AudioStreamPacket>();
+        packet->sample_rate = sample_rate;
+        packet->frame_duration = ogg_packet.samples / 48;
+        packet->payload_view = ogg_packet.data;
+        packet->payload_view_size = ogg_packet.size;
+        packet->trim_start = ogg_packet.trim_start * sample_rate / 48000;
+        packet->trim_end = ogg_packet.trim_end * sample_rate / 48000;
+        packet->mixer_channel = channel;
+        if (!PushPacketToSoundQueue(std::move(packet))) {
+            return;
         }
+    }
+}
 
-        offset = body_off + body_size;
+void AudioService::CacheSound(const std::string_view& sound, bool preload) {
+#if CONFIG_USE_SOUND_PCM_CACHE
+    sound_cache_.Add(sound, preload);
+    if (preload) {
+        NotifyTask(opus_decode_task_handle_);
     }
+#endif
 }
 
 bool AudioService::IsIdle() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    return audio_encode_queue_.empty() && audio_decode_queue_.empty() && audio_playback_queue_.empty() && audio_testing_queue_.empty();
+    std::lock_guard<std::mutex> lock(audio_testing_mutex_);
+    return audio_encode_queue_.Empty() && audio_decode_queue_.Empty() && jitter_buffer_.depth() == 0 &&
+        audio_playback_queue_.Empty() && audio_testing_queue_.empty() && audio_sound_queue_.Empty() &&
+        !sound_pending_ && mixer_.GetOverlaySamples() == 0;
 }
 
 void AudioService::ResetDecoder() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    opus_decoder_->ResetState();
-    timestamp_queue_.clear();
-    audio_decode_queue_.clear();
-    audio_playback_queue_.clear();
-    audio_testing_queue_.clear();
-    audio_queue_cv_.notify_all();
-}
-
-void AudioService::CheckAndUpdateAudioPowerState() {
-    auto now = std::chrono::steady_clock::now();
-    auto input_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_input_time_).count();
-    auto output_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_output_time_).count();
-    if (input_elapsed > AUDIO_POWER_TIMEOUT_MS && codec_->input_enabled()) {
-        codec_->EnableInput(false);
-    }
-    if (output_elapsed > AUDIO_POWER_TIMEOUT_MS && codec_->output_enabled()) {
-        codec_->EnableOutput(false);
+    timestamp_queue_.Flush();
+    {
+        std::lock_guard<std::mutex> lock(audio_decode_push_mutex_);
+        audio_decode_queue_.Flush();
     }
-    if (!codec_->input_enabled() && !codec_->output_enabled()) {
-        esp_timer_stop(audio_power_timer_);
+    // The decode task also clears the decoder state, it owns the decoder
+    jitter_buffer_reset_ = true;
+    audio_playback_queue_.Flush();
+    {
+        std::lock_guard<std::mutex> lock(audio_testing_mutex_);
+        audio_testing_queue_.clear();
+        audio_testing_replay_ = false;
     }
+
+    /* The consumers drop the flushed items and wake up the blocked producers */
+    NotifyTask(audio_output_task_handle_);
+    NotifyTask(opus_decode_task_handle_);
+}
+
+void AudioService::PrepareAudio(bool input, bool output) {
+    power_manager_.Prepare(input, output);
 }
 
 void AudioService::SetModelsList(srmodel_list_t* models_list) {
@@ -3,9 +3,9 @@
 
 #include <memory>
 #include <deque>
-#include <condition_variable>
 #include <chrono>
 #include <mutex>
+#include <atomic>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
@@ -22,17 +22,74 @@
 #include "processors/audio_debugger.h"
 #include "wake_word.h"
 #include "protocol.h"
+#include "spsc_queue.h"
+#include "audio_frame_pool.h"
+#include "jitter_buffer.h"
+#include "sound_cache.h"
+#include "dsp/audio_dsp.h"
+#include "dsp/polyphase_resampler.h"
+#include "dsp/time_stretcher.h"
+#include "latency_tracer.h"
+#include "adaptive_opus_encoder.h"
+#include "uplink_rate_controller.h"
+#include "codec_power_manager.h"
+#include "audio_mixer.h"
+#include "opus_decoder_cache.h"
+#include "processors/energy_vad.h"
 
 
 /*
  * There are two types of audio data flow:
  * 1. (MIC) -> [Processors] -> {Encode Queue} -> [Opus Encoder] -> {Send Queue} -> (Server)
- * 2. (Server) -> {Decode Queue} -> [Opus Decoder] -> {Playback Queue} -> (Speaker)
+ * 2. (Server) -> {Decode Queue} -> [Jitter Buffer] -> [Opus Decoder] -> {Playback Queue} -> (Speaker)
  *
- * We use one task for MIC / Speaker / Processors, and one task for Opus Encoder / Opus Decoder.
+ * We use one task for MIC / Speaker / Processors, one task for the Opus Encoder and one for the Opus Decoder,
+ * so a slow decode never delays the uplink and the other way around. Their cores and priorities are set
+ * in the "Audio Task Configuration" menu.
  * 
  * Decode Queue and Send Queue are the main queues, because Opus packets are quite smaller than PCM packets.
- * 
+ *
+ * Every queue is a bounded lock-free SPSC queue. Consumer tasks sleep on their task notification
+ * and are woken by the producer, producers that must block on a full queue wait on an event bit.
+ * The decode and sound queues can have more than one producer, so pushes are serialized by
+ * audio_decode_push_mutex_ and audio_sound_push_mutex_ while the consumer side stays lock-free.
+ *
+ * PCM tasks and encoded packets come from fixed-size frame pools that are filled in Initialize(),
+ * so the steady-state pipeline does not touch the heap. Pool misses are counted, see
+ * GetFramePoolMisses(). The heap allocations themselves are counted on the host, in
+ * tests/host/test_audio_service.cc.
+ *
+ * The jitter buffer is owned by the opus decode task. It reorders packets by sequence number,
+ * holds back playout according to the measured arrival jitter and asks the decoder to conceal
+ * frames that did not arrive in time.
+ *
+ * With CONFIG_USE_SOUND_PCM_CACHE, short system sounds registered by CacheSound() are decoded once
+ * by the opus decode task while it is idle and kept as PCM in PSRAM. PlaySound() then queues slices
+ * of that PCM, which the decode task copies straight into the mixer.
+ *
+ * Frames and packets carry the time they were captured or received, latency_tracer_ collects
+ * the delay at each stage of the pipeline into histograms.
+ *
+ * The uplink encoder follows uplink_rate_controller_, which lowers the Opus bitrate, turns on DTX
+ * and, up to the duration negotiated with the server, merges encode frames into longer packets
+ * while the send queue backs up or SendAudio() fails. The current parameters are advertised in
+ * the hello message, see GetUplinkAudioParams(). On boards without the AFE, NoAudioProcessor runs
+ * an energy VAD, and with CONFIG_USE_AUDIO_SILENCE_SUPPRESSION the encoder switches to DTX while
+ * it hears no speech, the DTX frames are dropped and only the comfort noise updates are sent.
+ *
+ * With CONFIG_USE_AUDIO_TIME_STRETCH, the decode task shortens server frames by a pitch period while
+ * more frames are buffered than the jitter buffer target, and lengthens a few of them after the
+ * buffer ran dry, so a burst of TTS does not keep the latency high for the rest of the utterance.
+ *
+ * PlaySound() does not go through the decode queue. Sounds have their own queue, the decode task
+ * decodes them with a second decoder into the notification or alarm channel of mixer_, and the
+ * output task mixes them into the server audio, ducking it while they play. So a sound overlaps
+ * the speech instead of waiting behind it, and ResetDecoder() leaves it playing. The two sound
+ * channels share the sound queue and decoder, so sounds play one after the other in the order
+ * they were queued: an alarm ducks the speech, but it does not overlap a notification.
+ *
+ * Both decoders come from decoder_cache_, which keeps the decoder and resampler of the last
+ * AUDIO_DECODER_CACHE_SIZE formats, so a format switch reuses one after resetting its state.
  */
 
 #define OPUS_FRAME_DURATION_MS 60
@@ -40,23 +97,59 @@
 #define MAX_PLAYBACK_TASKS_IN_QUEUE 2
 #define MAX_DECODE_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
 #define MAX_SEND_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
+#define MAX_SOUND_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
 #define AUDIO_TESTING_MAX_DURATION_MS 10000
 #define MAX_TIMESTAMPS_IN_QUEUE 3
+// Capture times of the reads the audio processor has not output yet, about a second of feeds
+#define MAX_CAPTURE_STAMPS_IN_QUEUE 32
+// Every queue slot, plus one frame held by the producer and one by the consumer
+#define AUDIO_TASK_POOL_SIZE (MAX_ENCODE_TASKS_IN_QUEUE + MAX_PLAYBACK_TASKS_IN_QUEUE + 4)
+#define AUDIO_PACKET_POOL_SIZE (MAX_SEND_PACKETS_IN_QUEUE + 2)
+// Initial payload capacity of pooled packets, 32kbps is well above the voice bitrate
+#define AUDIO_PACKET_RESERVE_BYTES (AUDIO_PACKET_HEADROOM + OPUS_FRAME_DURATION_MS * 32000 / 8000)
+
+// Longest uplink packet the device offers, a whole number of encode frames
+#if CONFIG_USE_AUDIO_UPLINK_RATE_CONTROL
+#define UPLINK_MAX_FRAME_DURATION_MS (CONFIG_AUDIO_UPLINK_MAX_FRAME_DURATION_MS / OPUS_FRAME_DURATION_MS * OPUS_FRAME_DURATION_MS)
+#else
+#define UPLINK_MAX_FRAME_DURATION_MS OPUS_FRAME_DURATION_MS
+#endif
+// libopus returns packets of at most 2 bytes for the frames it drops in DTX, they need not be sent
+#define OPUS_DTX_MAX_PACKET_BYTES 2
+
+#define JITTER_BUFFER_MIN_DEPTH 1
+#define JITTER_BUFFER_MAX_DEPTH (MAX_DECODE_PACKETS_IN_QUEUE / 2)
+#define JITTER_BUFFER_MAX_CONCEAL_FRAMES 3
+
+// Frames above the jitter buffer target before playback speeds up, it slows down again at the target
+#define TIME_STRETCH_CATCHUP_FRAMES 2
+// Frames slowed down after a concealed frame, unless the buffer is above its minimum depth sooner
+#define TIME_STRETCH_RECOVERY_FRAMES 8
+// Speech heard while waiting for the wake word, the wake word itself is about a second long
+#define WAKE_WORD_VAD_HANGOVER_MS 1000
+
+// The server stream and the sounds hold a decoder each, one more keeps the last other format ready
+#define AUDIO_DECODER_CACHE_SIZE 3
 
-#define AUDIO_POWER_TIMEOUT_MS 15000
-#define AUDIO_POWER_CHECK_INTERVAL_MS 1000
+// Each sound channel of the mixer holds two output frames
+#define AUDIO_MIXER_RING_DURATION_MS (OPUS_FRAME_DURATION_MS * 2)
 
 
 #define AS_EVENT_AUDIO_TESTING_RUNNING      (1 << 0)
 #define AS_EVENT_WAKE_WORD_RUNNING          (1 << 1)
 #define AS_EVENT_AUDIO_PROCESSOR_RUNNING    (1 << 2)
 #define AS_EVENT_PLAYBACK_NOT_EMPTY         (1 << 3)
+#define AS_EVENT_ENCODE_QUEUE_AVAILABLE     (1 << 4)
+#define AS_EVENT_DECODE_QUEUE_AVAILABLE     (1 << 5)
+#define AS_EVENT_SOUND_QUEUE_AVAILABLE      (1 << 6)
 
 struct AudioServiceCallbacks {
     std::function<void(void)> on_send_queue_available;
     std::function<void(const std::string&)> on_wake_word_detected;
     std::function<void(bool)> on_vad_change;
     std::function<void(void)> on_audio_testing_queue_full;
+    // Speech starts while waiting for the wake word, called from the audio input task
+    std::function<void(void)> on_speech_energy;
 };
 
 
@@ -67,9 +160,19 @@ enum AudioTaskType {
 };
 
 struct AudioTask {
-    AudioTaskType type;
+    AudioTaskType type = kAudioTaskTypeEncodeToSendQueue;
     std::vector<int16_t> pcm;
-    uint32_t timestamp;
+    uint32_t timestamp = 0;
+    int64_t trace_time_us = 0;  // Same as AudioStreamPacket::trace_time_us
+};
+
+using AudioTaskPtr = AudioFramePool<AudioTask>::Ptr;
+
+// Time spent encoding or decoding, updated by the codec task itself
+struct AudioCodecTaskUsage {
+    uint64_t busy_us = 0;
+    uint32_t frames = 0;
+    uint32_t max_frame_us = 0;
 };
 
 struct DebugStatistics {
@@ -88,7 +191,7 @@ public:
     void Start();
     void Stop();
     void EncodeWakeWord();
-    std::unique_ptr<AudioStreamPacket> PopWakeWordPacket();
+    AudioStreamPacketPtr PopWakeWordPacket();
     const std::string& GetLastWakeWord() const;
     bool IsVoiceDetected() const { return voice_detected_; }
     bool IsIdle();
@@ -103,12 +206,46 @@ public:
 
     void SetCallbacks(AudioServiceCallbacks& callbacks);
 
-    bool PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait = false);
-    std::unique_ptr<AudioStreamPacket> PopPacketFromSendQueue();
-    void PlaySound(const std::string_view& sound);
+    bool PushPacketToDecodeQueue(AudioStreamPacketPtr packet, bool wait = false);
+    AudioStreamPacketPtr PopPacketFromSendQueue();
+    // The Ogg data is not copied, it must stay valid until played (true for the flash-mapped sounds)
+    // The sound is mixed over the server audio on the given channel
+    void PlaySound(const std::string_view& sound, AudioMixerChannel channel = kMixerChannelNotification);
+    // Keeps the decoded PCM of a short sound once it has been decoded, at boot if preload is set
+    void CacheSound(const std::string_view& sound, bool preload);
     bool ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples);
     void ResetDecoder();
     void SetModelsList(srmodel_list_t* models_list);
+    // Frames the pools had to take from the heap after Initialize(), zero while the pools are large
+    // enough. Each miss costs at least one allocation, and more as the new frame's buffers grow.
+    uint32_t GetFramePoolMisses() const {
+        return task_pool_.misses() + packet_pool_.misses() + incoming_packet_pool_.misses();
+    }
+    // Packet for the audio a protocol received, the pool lives here because the packets end up in
+    // the decode queue and the jitter buffer, which may hold them after the protocol is gone
+    AudioStreamPacketPtr AcquireIncomingPacket() { return incoming_packet_pool_.Acquire(); }
+    JitterBufferStatistics GetJitterBufferStatistics() const { return jitter_buffer_.statistics(); }
+    OpusDecoderCacheStatistics GetDecoderCacheStatistics() const { return decoder_cache_.statistics(); }
+    AudioCodecTaskUsage GetEncodeTaskUsage() const { return encode_task_usage_; }
+    AudioCodecTaskUsage GetDecodeTaskUsage() const { return decode_task_usage_; }
+    // Logs the codec task load since the previous call
+    void PrintCodecTaskUsage();
+    LatencyTracer& GetLatencyTracer() { return latency_tracer_; }
+    // Opus parameters the encoder currently uses for the uplink
+    UplinkAudioParams GetUplinkAudioParams() const { return uplink_rate_controller_.GetParams(); }
+    // Longest uplink packet accepted by the server, 0 if it did not negotiate one
+    void SetUplinkMaxFrameDuration(int frame_duration);
+    // Starts the next session at the highest uplink level, the congestion of the last one is forgotten
+    void ResetUplinkRate();
+    void ReportSendResult(bool success) { uplink_rate_controller_.ReportSendResult(success); }
+    // Silent uplink packets that were not sent, see CONFIG_USE_AUDIO_SILENCE_SUPPRESSION
+    uint32_t GetSuppressedUplinkPackets() const { return suppressed_uplink_packets_; }
+    // Powers up the codec channels ahead of an expected use, so the first frame does not wait for them
+    void PrepareAudio(bool input, bool output);
+    CodecPowerStatistics GetCodecPowerStatistics() const { return power_manager_.statistics(); }
+    // Writes a changed input settle time to the settings, call it where a flash write does not disturb the audio
+    void StoreCodecSettleTime() { power_manager_.StoreSettleTime(); }
+    AudioMixer& GetMixer() { return mixer_; }
 
 private:
     AudioCodec* codec_ = nullptr;
@@ -116,11 +253,9 @@ private:
     std::unique_ptr<AudioProcessor> audio_processor_;
     std::unique_ptr<WakeWord> wake_word_;
     std::unique_ptr<AudioDebugger> audio_debugger_;
-    std::unique_ptr<OpusEncoderWrapper> opus_encoder_;
-    std::unique_ptr<OpusDecoderWrapper> opus_decoder_;
-    OpusResampler input_resampler_;
-    OpusResampler reference_resampler_;
-    OpusResampler output_resampler_;
+    std::unique_ptr<AdaptiveOpusEncoder> opus_encoder_;
+    PolyphaseResampler input_resampler_;
+    PolyphaseResampler reference_resampler_;
     DebugStatistics debug_statistics_;
     srmodel_list_t* models_list_ = nullptr;
 
@@ -129,33 +264,107 @@ private:
     // Audio encode / decode
     TaskHandle_t audio_input_task_handle_ = nullptr;
     TaskHandle_t audio_output_task_handle_ = nullptr;
-    TaskHandle_t opus_codec_task_handle_ = nullptr;
-    std::mutex audio_queue_mutex_;
-    std::condition_variable audio_queue_cv_;
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_decode_queue_;
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_send_queue_;
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_testing_queue_;
-    std::deque<std::unique_ptr<AudioTask>> audio_encode_queue_;
-    std::deque<std::unique_ptr<AudioTask>> audio_playback_queue_;
+    TaskHandle_t opus_encode_task_handle_ = nullptr;
+    TaskHandle_t opus_decode_task_handle_ = nullptr;
+    AudioCodecTaskUsage encode_task_usage_;
+    AudioCodecTaskUsage decode_task_usage_;
+    AudioCodecTaskUsage last_encode_task_usage_;
+    AudioCodecTaskUsage last_decode_task_usage_;
+    int64_t last_task_usage_time_us_ = 0;
+    LatencyTracer latency_tracer_;
+    std::atomic<int64_t> last_capture_time_us_{0};
+    // Capture time of each read fed to the audio processor, keyed by the input sample that ends it
+    struct CaptureStamp {
+        uint64_t end_sample = 0;
+        int64_t time_us = 0;
+    };
+    SpscQueue<CaptureStamp, MAX_CAPTURE_STAMPS_IN_QUEUE> capture_stamps_;
+    std::atomic<uint64_t> processor_input_samples_{0};     // Advanced by the input task
+    std::atomic<uint64_t> processor_output_samples_{0};    // Advanced by the processor output callback
+    CaptureStamp processor_output_stamp_;                  // Owned by the processor output callback
+    UplinkRateController uplink_rate_controller_{OPUS_FRAME_DURATION_MS};
+    // Set by other tasks, applied by the encode task which owns opus_encoder_
+    std::atomic<bool> uplink_params_changed_{false};
+    std::atomic<bool> encoder_reset_{false};
+    // NoAudioProcessor boards turn on DTX and drop the DTX frames while their VAD hears no speech
+    bool silence_suppression_ = false;
+    std::atomic<bool> uplink_silent_{false};
+    std::atomic<uint32_t> suppressed_uplink_packets_{0};
+    // Declared before the queues, so they are destroyed after every frame has been released
+    AudioFramePool<AudioTask> task_pool_;
+    AudioFramePool<AudioStreamPacket> packet_pool_;
+    AudioFramePool<AudioStreamPacket> incoming_packet_pool_;
+    std::mutex audio_decode_push_mutex_;
+    SpscQueue<AudioStreamPacketPtr, MAX_DECODE_PACKETS_IN_QUEUE> audio_decode_queue_;
+    SpscQueue<AudioStreamPacketPtr, MAX_SEND_PACKETS_IN_QUEUE> audio_send_queue_;
+    SpscQueue<AudioTaskPtr, MAX_ENCODE_TASKS_IN_QUEUE> audio_encode_queue_;
+    SpscQueue<AudioTaskPtr, MAX_PLAYBACK_TASKS_IN_QUEUE> audio_playback_queue_;
+    std::mutex audio_sound_push_mutex_;
+    SpscQueue<AudioStreamPacketPtr, MAX_SOUND_PACKETS_IN_QUEUE> audio_sound_queue_;
+    AudioMixer mixer_;
+    // Decoders of the server stream and of the sound being played, owned by the decode task
+    OpusDecoderCache decoder_cache_;
+    OpusDecoderCache::Entry* stream_decoder_ = nullptr;
+    OpusDecoderCache::Entry* sound_decoder_ = nullptr;
+    // Decoded sound not yet written into the mixer, owned by the decode task
+    std::vector<int16_t> sound_pcm_;
+    size_t sound_pcm_offset_ = 0;
+    AudioMixerChannel sound_channel_ = kMixerChannelNotification;
+    std::atomic<bool> sound_pending_{false};
+    JitterBuffer jitter_buffer_;
+    std::atomic<bool> jitter_buffer_reset_{false};
+    // Owned by the decode task
+    TimeStretcher time_stretcher_;
+    bool time_stretch_catching_up_ = false;
+    int time_stretch_recovery_frames_ = 0;     // Frames left to slow down after the jitter buffer ran dry
+    size_t time_stretch_credit_ = 0;           // Samples the speed limit allows to remove or add
+#if CONFIG_USE_SOUND_PCM_CACHE
+    SoundCache sound_cache_;
+#endif
     // For server AEC
-    std::deque<uint32_t> timestamp_queue_;
+    SpscQueue<uint32_t, MAX_TIMESTAMPS_IN_QUEUE> timestamp_queue_;
+    // Audio testing is not on the realtime path, it is replayed through the decoder when stopped
+    std::mutex audio_testing_mutex_;
+    std::deque<AudioStreamPacketPtr> audio_testing_queue_;
+    bool audio_testing_replay_ = false;
+    // Scratch buffers reused by ReadAudioData() and the decoder, reserved in Initialize()
+    audio_dsp::AlignedVector<int16_t> input_frame_buffer_;
+    audio_dsp::AlignedVector<int16_t> input_mic_buffer_;
+    audio_dsp::AlignedVector<int16_t> input_reference_buffer_;
+    audio_dsp::AlignedVector<int16_t> resampled_mic_buffer_;
+    audio_dsp::AlignedVector<int16_t> resampled_reference_buffer_;
+    std::vector<int16_t> output_resample_buffer_;
+    std::vector<uint8_t> decode_view_buffer_;
+
+    // Owned by the audio input task
+    EnergyVad wake_word_vad_;
+    size_t wake_word_vad_samples_ = 0;
+    int64_t wake_word_vad_time_us_ = 0;
 
     bool wake_word_initialized_ = false;
     bool audio_processor_initialized_ = false;
     bool voice_detected_ = false;
     bool service_stopped_ = true;
-    bool audio_input_need_warmup_ = false;
 
-    esp_timer_handle_t audio_power_timer_ = nullptr;
-    std::chrono::steady_clock::time_point last_input_time_;
-    std::chrono::steady_clock::time_point last_output_time_;
+    CodecPowerManager power_manager_;
 
     void AudioInputTask();
     void AudioOutputTask();
-    void OpusCodecTask();
-    void PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm);
+    void OpusEncodeTask();
+    void OpusDecodeTask();
+    void PushTaskToEncodeQueue(AudioTaskType type, const std::vector<int16_t>& pcm, int64_t trace_time_us);
+    // Capture time of the oldest input sample in the next samples the audio processor outputs
+    int64_t GetProcessorOutputCaptureTime(size_t samples);
+    void DetectWakeWordSpeech(const std::vector<int16_t>& data);
     void SetDecodeSampleRate(int sample_rate, int frame_duration);
-    void CheckAndUpdateAudioPowerState();
+    void StretchDecodedFrame(std::vector<int16_t>& pcm);
+    void ApplyUplinkParams();
+    bool ReadCodecData(std::vector<int16_t>& data, int sample_rate, int samples);
+    bool PopDecodePacket(AudioStreamPacketPtr& packet);
+    bool PushPacketToSoundQueue(AudioStreamPacketPtr packet);
+    void DecodeSounds();
+    bool DecodeSoundPacket(AudioStreamPacket& packet);
+    void NotifyTask(TaskHandle_t task);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,216 @@
+#include "codec_power_manager.h"
+#include "settings.h"
+
+#include <esp_log.h>
+#include <algorithm>
+#include <cstdlib>
+
+#define TAG "CodecPowerManager"
+
+// Frames whose mean differs by less than this from the previous one have settled, about -42 dBFS
+#define CODEC_SETTLE_DC_TOLERANCE 256
+// Margin over the stored settle time before the detector gives up and accepts the input
+#define CODEC_SETTLE_MARGIN_MS 20
+// Only rewrite the stored settle time when it moved by more than this
+#define CODEC_SETTLE_STORE_DELTA_MS 10
+
+
+CodecPowerManager::~CodecPowerManager() {
+    if (timer_ != nullptr) {
+        esp_timer_stop(timer_);
+        esp_timer_delete(timer_);
+    }
+}
+
+void CodecPowerManager::Initialize(AudioCodec* codec) {
+    codec_ = codec;
+
+    Settings settings("audio", false);
+    stored_settle_ms_ = settings.GetInt("input_settle", 0);
+    if (stored_settle_ms_ > 0) {
+        statistics_.input_settle_ms = stored_settle_ms_;
+        settle_limit_ms_ = std::min<uint32_t>(stored_settle_ms_ + CODEC_SETTLE_MARGIN_MS, CODEC_INPUT_SETTLE_MAX_MS);
+    }
+
+    int64_t now_us = esp_timer_get_time();
+    last_input_us_ = now_us;
+    last_output_us_ = now_us;
+    input_enabled_us_ = now_us;
+
+    esp_timer_create_args_t timer_args = {
+        .callback = [](void* arg) {
+            auto manager = (CodecPowerManager*)arg;
+            manager->CheckTimeout();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "audio_power_timer",
+        .skip_unhandled_events = true,
+    };
+    esp_timer_create(&timer_args, &timer_);
+}
+
+void CodecPowerManager::Start() {
+    esp_timer_start_periodic(timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
+}
+
+void CodecPowerManager::Stop() {
+    esp_timer_stop(timer_);
+}
+
+void CodecPowerManager::RestartTimer() {
+    esp_timer_stop(timer_);
+    esp_timer_start_periodic(timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
+}
+
+void CodecPowerManager::EnableInput() {
+    if (codec_->input_enabled()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    EnableInputLocked(false);
+}
+
+void CodecPowerManager::EnableOutput() {
+    if (codec_->output_enabled()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    EnableOutputLocked(false);
+}
+
+void CodecPowerManager::Prepare(bool input, bool output) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t now_us = esp_timer_get_time();
+    /* The timeout counts from the prediction, so a channel is not powered down before its first use */
+    if (input) {
+        last_input_us_ = now_us;
+        EnableInputLocked(true);
+    }
+    if (output) {
+        last_output_us_ = now_us;
+        EnableOutputLocked(true);
+    }
+}
+
+void CodecPowerManager::EnableInputLocked(bool predicted) {
+    if (codec_->input_enabled()) {
+        return;
+    }
+    RestartTimer();
+    codec_->EnableInput(true);
+    input_enabled_us_ = esp_timer_get_time();
+    if (predicted) {
+        statistics_.predicted_enables++;
+    } else {
+        statistics_.late_enables++;
+    }
+}
+
+void CodecPowerManager::EnableOutputLocked(bool predicted) {
+    if (codec_->output_enabled()) {
+        return;
+    }
+    RestartTimer();
+    int64_t start_us = esp_timer_get_time();
+    codec_->EnableOutput(true);
+    uint32_t enable_ms = (esp_timer_get_time() - start_us) / 1000;
+    statistics_.output_enable_ms = std::max(statistics_.output_enable_ms, enable_ms);
+    if (predicted) {
+        statistics_.predicted_enables++;
+    } else {
+        statistics_.late_enables++;
+        ESP_LOGD(TAG, "Output enabled on first use, took %lu ms", (unsigned long)enable_ms);
+    }
+}
+
+bool CodecPowerManager::OnInputFrame(const int16_t* data, size_t samples, int64_t frame_us) {
+    int64_t now_us = esp_timer_get_time();
+    last_input_us_ = now_us;
+
+    /* A new enable restarts the measurement */
+    int64_t enabled_us = input_enabled_us_;
+    if (enabled_us != settling_enabled_us_ && enabled_us > last_settled_enable_us_) {
+        settling_enabled_us_ = enabled_us;
+        has_previous_dc_ = false;
+    }
+    if (settling_enabled_us_ < 0) {
+        return true;
+    }
+
+    int64_t frame_start_us = now_us - frame_us;
+    if (frame_start_us - settling_enabled_us_ >= settle_limit_ms_ * 1000) {
+        ESP_LOGW(TAG, "Input did not settle within %lu ms", (unsigned long)settle_limit_ms_);
+        FinishSettle(frame_start_us);
+        return true;
+    }
+
+    /* Unsettled frames are silent (no data yet) or still follow the DC step of the power up */
+    int64_t sum = 0;
+    bool silent = true;
+    for (size_t i = 0; i < samples; i++) {
+        sum += data[i];
+        silent = silent && data[i] == 0;
+    }
+    int32_t dc = samples > 0 ? sum / (int64_t)samples : 0;
+    bool stable = !silent && has_previous_dc_ && abs(dc - previous_dc_) <= CODEC_SETTLE_DC_TOLERANCE;
+    previous_dc_ = dc;
+    has_previous_dc_ = !silent;
+    if (!stable) {
+        return false;
+    }
+    FinishSettle(frame_start_us);
+    return true;
+}
+
+void CodecPowerManager::FinishSettle(int64_t settled_us) {
+    uint32_t settle_ms = std::max<int64_t>(settled_us - settling_enabled_us_, 0) / 1000;
+    last_settled_enable_us_ = settling_enabled_us_;
+    settling_enabled_us_ = -1;
+
+    uint32_t smoothed;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        smoothed = statistics_.input_settle_ms == 0 ? settle_ms : (statistics_.input_settle_ms * 3 + settle_ms) / 4;
+        statistics_.input_settle_ms = smoothed;
+    }
+    ESP_LOGI(TAG, "Input settled in %lu ms (average %lu ms)", (unsigned long)settle_ms, (unsigned long)smoothed);
+
+    /* Keep the measurement for the next boot, without rewriting flash on every small change */
+    if (std::abs((int32_t)smoothed - (int32_t)stored_settle_ms_) > CODEC_SETTLE_STORE_DELTA_MS) {
+        stored_settle_ms_ = smoothed;
+        settle_ms_to_store_ = smoothed;
+    }
+}
+
+void CodecPowerManager::StoreSettleTime() {
+    uint32_t settle_ms = settle_ms_to_store_.exchange(0);
+    if (settle_ms == 0) {
+        return;
+    }
+    Settings settings("audio", true);
+    settings.SetInt("input_settle", settle_ms);
+}
+
+void CodecPowerManager::OnOutputFrame() {
+    last_output_us_ = esp_timer_get_time();
+}
+
+CodecPowerStatistics CodecPowerManager::statistics() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return statistics_;
+}
+
+void CodecPowerManager::CheckTimeout() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t now_us = esp_timer_get_time();
+    if (now_us - last_input_us_ > AUDIO_POWER_TIMEOUT_MS * 1000LL && codec_->input_enabled()) {
+        codec_->EnableInput(false);
+    }
+    if (now_us - last_output_us_ > AUDIO_POWER_TIMEOUT_MS * 1000LL && codec_->output_enabled()) {
+        codec_->EnableOutput(false);
+    }
+    if (!codec_->input_enabled() && !codec_->output_enabled()) {
+        esp_timer_stop(timer_);
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef CODEC_POWER_MANAGER_H
+#define CODEC_POWER_MANAGER_H
+
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+#include <esp_timer.h>
+
+#include "audio_codec.h"
+
+#define AUDIO_POWER_TIMEOUT_MS 15000
+#define AUDIO_POWER_CHECK_INTERVAL_MS 1000
+// Upper bound of the input settle time, the fixed warmup used before it was measured
+#define CODEC_INPUT_SETTLE_MAX_MS 120
+
+struct CodecPowerStatistics {
+    uint32_t input_settle_ms = 0;       // Smoothed time from EnableInput() to the first stable frame
+    uint32_t output_enable_ms = 0;      // Longest EnableOutput(true) call
+    uint32_t predicted_enables = 0;     // Channels powered up by Prepare() before they were used
+    uint32_t late_enables = 0;          // Channels powered up by the first frame that needed them
+};
+
+/*
+ * Powers the codec input and output down after AUDIO_POWER_TIMEOUT_MS without use.
+ *
+ * The application calls Prepare() on the state changes that are followed by audio, so the
+ * channels are usually up before the first frame. After the input is enabled, OnInputFrame()
+ * drops frames until their DC level is stable, instead of waiting a fixed time. The measured
+ * settle time is kept in the "audio" settings and bounds the wait on the next boot. The input
+ * task only keeps it in memory, StoreSettleTime() writes it from the main loop.
+ *
+ * EnableInput() and OnInputFrame() are called by the audio input task, EnableOutput() by the
+ * output task and PlaySound(), Prepare() by the application.
+ */
+class CodecPowerManager {
+public:
+    ~CodecPowerManager();
+
+    void Initialize(AudioCodec* codec);
+    void Start();
+    void Stop();
+
+    void EnableInput();
+    void EnableOutput();
+    // Powers up the channels expected to be used soon
+    void Prepare(bool input, bool output);
+    // Returns false while the input is still settling, the frame should then be dropped
+    bool OnInputFrame(const int16_t* data, size_t samples, int64_t frame_us);
+    void OnOutputFrame();
+    // Writes the settle time to the settings if it changed, the flash write may block for milliseconds
+    void StoreSettleTime();
+
+    CodecPowerStatistics statistics() const;
+
+private:
+    AudioCodec* codec_ = nullptr;
+    esp_timer_handle_t timer_ = nullptr;
+    mutable std::mutex mutex_;
+    std::atomic<int64_t> last_input_us_{0};
+    std::atomic<int64_t> last_output_us_{0};
+    std::atomic<int64_t> input_enabled_us_{0};
+    CodecPowerStatistics statistics_;
+
+    /* Settle detection, owned by the input task */
+    int64_t settling_enabled_us_ = -1;  // input_enabled_us_ of the enable being measured, -1 when settled
+    int64_t last_settled_enable_us_ = -1;
+    int32_t previous_dc_ = 0;
+    bool has_previous_dc_ = false;
+    uint32_t stored_settle_ms_ = 0;
+    std::atomic<uint32_t> settle_ms_to_store_{0};   // Set by the input task, 0 when nothing changed
+    uint32_t settle_limit_ms_ = CODEC_INPUT_SETTLE_MAX_MS;
+
+    void EnableInputLocked(bool predicted);
+    void EnableOutputLocked(bool predicted);
+    void RestartTimer();
+    void CheckTimeout();
+    void FinishSettle(int64_t settled_us);
+};
+
+#endif // CODEC_POWER_MANAGER_H
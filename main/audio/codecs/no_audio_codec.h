@@ -2,6 +2,7 @@
 #define _NO_AUDIO_CODEC_H
 
 #include "audio_codec.h"
+#include "dsp/audio_dsp.h"
 
 #include <driver/gpio.h>
 #include <driver/i2s_pdm.h>
@@ -10,12 +11,20 @@
 class NoAudioCodec : public AudioCodec {
 protected:
     std::mutex data_if_mutex_;
+    // Q16 factor of output_volume_, only recomputed when the volume changes
+    int32_t output_gain_q16_ = 0;
+    // 32-bit I2S slot buffers, they keep their capacity across reads and writes
+    audio_dsp::AlignedVector<int32_t> write_buffer_;
+    audio_dsp::AlignedVector<int32_t> read_buffer_;
 
     virtual int Write(const int16_t* data, int samples) override;
     virtual int Read(int16_t* dest, int samples) override;
+    void UpdateOutputGain();
 
 public:
     virtual ~NoAudioCodec();
+    virtual void SetOutputVolume(int volume) override;
+    virtual void Start() override;
 };
 
 class NoAudioCodecDuplex : public NoAudioCodec {
@@ -0,0 +1,90 @@
+#include "audio_dsp.h"
+#include <sdkconfig.h>
+#include <algorithm>
+
+#if CONFIG_IDF_TARGET_ESP32S3
+#define AUDIO_DSP_USE_PIE 1
+// Implemented in audio_dsp_aes3.S
+extern "C" {
+void audio_dsp_deinterleave_s16_aes3(const int16_t* input, int16_t* left, int16_t* right, size_t blocks);
+void audio_dsp_interleave_s16_aes3(const int16_t* left, const int16_t* right, int16_t* output, size_t blocks);
+void audio_dsp_gain_s16_aes3(const int16_t* input, int16_t* output, size_t blocks, const int16_t* gain, int shift);
+void audio_dsp_int32_to_int16_aes3(const int32_t* input, int16_t* output, size_t blocks, int shift, const int32_t* limits);
+}
+#endif
+
+// The vector unit works on 128-bit aligned blocks of 8 samples
+#define AUDIO_DSP_BLOCK_SAMPLES 8
+#define AUDIO_DSP_ALIGNED(p) ((reinterpret_cast<uintptr_t>(p) & 15) == 0)
+
+
+namespace audio_dsp {
+
+void Deinterleave(const int16_t* input, int16_t* left, int16_t* right, size_t frames) {
+    size_t i = 0;
+#if AUDIO_DSP_USE_PIE
+    if (AUDIO_DSP_ALIGNED(input) && AUDIO_DSP_ALIGNED(left) && AUDIO_DSP_ALIGNED(right)) {
+        size_t blocks = frames / AUDIO_DSP_BLOCK_SAMPLES;
+        audio_dsp_deinterleave_s16_aes3(input, left, right, blocks);
+        i = blocks * AUDIO_DSP_BLOCK_SAMPLES;
+    }
+#endif
+    for (; i < frames; i++) {
+        left[i] = input[2 * i];
+        right[i] = input[2 * i + 1];
+    }
+}
+
+void Interleave(const int16_t* left, const int16_t* right, int16_t* output, size_t frames) {
+    size_t i = 0;
+#if AUDIO_DSP_USE_PIE
+    if (AUDIO_DSP_ALIGNED(left) && AUDIO_DSP_ALIGNED(right) && AUDIO_DSP_ALIGNED(output)) {
+        size_t blocks = frames / AUDIO_DSP_BLOCK_SAMPLES;
+        audio_dsp_interleave_s16_aes3(left, right, output, blocks);
+        i = blocks * AUDIO_DSP_BLOCK_SAMPLES;
+    }
+#endif
+    for (; i < frames; i++) {
+        output[2 * i] = left[i];
+        output[2 * i + 1] = right[i];
+    }
+}
+
+void ApplyGain(const int16_t* input, int16_t* output, size_t samples, int16_t gain, int shift) {
+    size_t i = 0;
+#if AUDIO_DSP_USE_PIE
+    /* The vector multiply does not saturate, it is exact as long as the gain is at most 1.0 */
+    if (gain >= 0 && gain <= (1 << shift) && AUDIO_DSP_ALIGNED(input) && AUDIO_DSP_ALIGNED(output)) {
+        size_t blocks = samples / AUDIO_DSP_BLOCK_SAMPLES;
+        audio_dsp_gain_s16_aes3(input, output, blocks, &gain, shift);
+        i = blocks * AUDIO_DSP_BLOCK_SAMPLES;
+    }
+#endif
+    for (; i < samples; i++) {
+        int32_t value = (static_cast<int32_t>(input[i]) * gain) >> shift;
+        output[i] = static_cast<int16_t>(std::clamp<int32_t>(value, INT16_MIN, INT16_MAX));
+    }
+}
+
+void Int16ToInt32(const int16_t* input, int32_t* output, size_t samples, int32_t gain_q16) {
+    for (size_t i = 0; i < samples; i++) {
+        output[i] = static_cast<int32_t>(input[i]) * gain_q16;
+    }
+}
+
+void Int32ToInt16(const int32_t* input, int16_t* output, size_t samples, int shift) {
+    size_t i = 0;
+#if AUDIO_DSP_USE_PIE
+    if (AUDIO_DSP_ALIGNED(input) && AUDIO_DSP_ALIGNED(output)) {
+        static const int32_t limits[] = {INT16_MAX, -INT16_MAX};
+        size_t blocks = samples / AUDIO_DSP_BLOCK_SAMPLES;
+        audio_dsp_int32_to_int16_aes3(input, output, blocks, shift, limits);
+        i = blocks * AUDIO_DSP_BLOCK_SAMPLES;
+    }
+#endif
+    for (; i < samples; i++) {
+        output[i] = static_cast<int16_t>(std::clamp<int32_t>(input[i] >> shift, -INT16_MAX, INT16_MAX));
+    }
+}
+
+} // namespace audio_dsp
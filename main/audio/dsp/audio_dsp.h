@@ -0,0 +1,61 @@
+#ifndef AUDIO_DSP_H
+#define AUDIO_DSP_H
+
+#include <vector>
+#include <new>
+#include <cstdint>
+#include <cstddef>
+
+#include <esp_heap_caps.h>
+
+/*
+ * Small PCM kernels used on the audio hot paths.
+ *
+ * On ESP32-S3 the kernels run on the PIE 128-bit vector unit when the buffers are 16-byte
+ * aligned, the remaining samples and every other target use the portable loops. Both give
+ * bit-identical results. Int16ToInt32() has no PIE version, the vector unit cannot widen a
+ * 16x16 product to 32 bits. The buffers may not overlap, except in == out for ApplyGain().
+ */
+namespace audio_dsp {
+
+// Buffers for the kernels, aligned for the vector unit and kept in internal RAM
+template <typename T>
+struct AlignedAllocator {
+    using value_type = T;
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        void* p = heap_caps_aligned_alloc(16, n * sizeof(T), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        if (p == nullptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(p);
+    }
+    void deallocate(T* p, size_t) { heap_caps_free(p); }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U>&) const { return false; }
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+// Splits interleaved stereo into two mono buffers
+void Deinterleave(const int16_t* input, int16_t* left, int16_t* right, size_t frames);
+// Merges two mono buffers into interleaved stereo
+void Interleave(const int16_t* left, const int16_t* right, int16_t* output, size_t frames);
+// output = saturate((input * gain) >> shift), gain is a Q(shift) fixed point factor
+void ApplyGain(const int16_t* input, int16_t* output, size_t samples, int16_t gain, int shift);
+// output = input * gain_q16 for 32-bit I2S slots, gain_q16 is at most 65536 so the product always fits
+void Int16ToInt32(const int16_t* input, int32_t* output, size_t samples, int32_t gain_q16);
+// output = clamp(input >> shift, -INT16_MAX, INT16_MAX), for 32-bit I2S slots read from a microphone
+void Int32ToInt16(const int32_t* input, int16_t* output, size_t samples, int shift);
+
+} // namespace audio_dsp
+
+#endif // AUDIO_DSP_H
@@ -0,0 +1,123 @@
+#include "polyphase_resampler.h"
+
+#include <esp_log.h>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <algorithm>
+
+#define TAG "PolyphaseResampler"
+
+// 48k <-> 16k is the largest ratio between the codec rates
+#define POLYPHASE_RESAMPLER_MAX_PHASES 6
+// Prototype length per unit of max(L, M), 48 taps keep the transition band within 10% of Nyquist
+#define POLYPHASE_RESAMPLER_TAPS_PER_FACTOR 48
+// Passband edge relative to the lower Nyquist frequency
+#define POLYPHASE_RESAMPLER_CUTOFF 0.9
+// The absolute sum of a phase reaches 2.2, Q14 keeps full-scale input within the 32-bit accumulator
+#define POLYPHASE_RESAMPLER_COEFFICIENT_BITS 14
+
+
+void PolyphaseResampler::Configure(int input_sample_rate, int output_sample_rate) {
+    input_sample_rate_ = input_sample_rate;
+    output_sample_rate_ = output_sample_rate;
+    position_ = 0;
+    coefficients_.clear();
+    window_.clear();
+    fallback_.reset();
+
+    int divisor = std::gcd(input_sample_rate, output_sample_rate);
+    up_ = output_sample_rate / divisor;
+    down_ = input_sample_rate / divisor;
+    if (up_ > POLYPHASE_RESAMPLER_MAX_PHASES || down_ > POLYPHASE_RESAMPLER_MAX_PHASES) {
+        ESP_LOGI(TAG, "No polyphase filter for %d -> %d, using OpusResampler", input_sample_rate, output_sample_rate);
+        fallback_ = std::make_unique<OpusResampler>();
+        fallback_->Configure(input_sample_rate, output_sample_rate);
+        return;
+    }
+    if (up_ == down_) {
+        taps_ = 1;
+        return;
+    }
+
+    /* Blackman windowed sinc at the upsampled rate, cut off below the lower of the two Nyquist frequencies */
+    int factor = std::max(up_, down_);
+    taps_ = POLYPHASE_RESAMPLER_TAPS_PER_FACTOR * factor / up_;
+    int length = taps_ * up_;
+    double cutoff = POLYPHASE_RESAMPLER_CUTOFF / (2.0 * factor);
+    double center = (length - 1) / 2.0;
+    std::vector<float> prototype(length);
+    double sum = 0;
+    for (int n = 0; n < length; n++) {
+        double x = n - center;
+        double sinc = x == 0 ? 2 * cutoff : sin(2 * M_PI * cutoff * x) / (M_PI * x);
+        double window = 0.42 - 0.5 * cos(2 * M_PI * n / (length - 1)) + 0.08 * cos(4 * M_PI * n / (length - 1));
+        prototype[n] = sinc * window;
+        sum += prototype[n];
+    }
+
+    /* Every phase keeps unity gain after the zero stuffing, so the prototype is scaled by L */
+    coefficients_.resize(length);
+    for (int phase = 0; phase < up_; phase++) {
+        for (int j = 0; j < taps_; j++) {
+            double value = prototype[(taps_ - 1 - j) * up_ + phase] * up_ / sum;
+            coefficients_[phase * taps_ + j] = std::clamp<long>(lround(value * (1 << POLYPHASE_RESAMPLER_COEFFICIENT_BITS)), INT16_MIN, INT16_MAX);
+        }
+    }
+    window_.assign(taps_ - 1, 0);
+}
+
+void PolyphaseResampler::Reset() {
+    if (fallback_) {
+        fallback_->Configure(input_sample_rate_, output_sample_rate_);
+        return;
+    }
+    position_ = 0;
+    window_.assign(taps_ - 1, 0);
+}
+
+size_t PolyphaseResampler::GetOutputSamples(size_t input_samples) const {
+    if (fallback_) {
+        return fallback_->GetOutputSamples(input_samples);
+    }
+    uint32_t end = input_samples * up_;
+    if (position_ >= end) {
+        return 0;
+    }
+    return (end - position_ + down_ - 1) / down_;
+}
+
+size_t PolyphaseResampler::Process(const int16_t* input, size_t input_samples, int16_t* output) {
+    if (fallback_) {
+        size_t output_samples = fallback_->GetOutputSamples(input_samples);
+        fallback_->Process(input, input_samples, output);
+        return output_samples;
+    }
+    if (up_ == down_) {
+        memcpy(output, input, input_samples * sizeof(int16_t));
+        return input_samples;
+    }
+
+    size_t history = taps_ - 1;
+    window_.resize(history + input_samples);
+    std::copy(input, input + input_samples, window_.begin() + history);
+
+    /* Output at upsampled position t uses phase t % L, over the taps ending at input sample t / L */
+    size_t produced = 0;
+    uint32_t end = input_samples * up_;
+    while (position_ < end) {
+        const int16_t* x = window_.data() + position_ / up_;
+        const int16_t* c = coefficients_.data() + (position_ % up_) * taps_;
+        int32_t acc = 1 << (POLYPHASE_RESAMPLER_COEFFICIENT_BITS - 1);
+        for (int j = 0; j < taps_; j++) {
+            acc += x[j] * c[j];
+        }
+        output[produced++] = std::clamp<int32_t>(acc >> POLYPHASE_RESAMPLER_COEFFICIENT_BITS, INT16_MIN, INT16_MAX);
+        position_ += down_;
+    }
+    position_ -= end;
+
+    std::copy(window_.end() - history, window_.end(), window_.begin());
+    window_.resize(history);
+    return produced;
+}
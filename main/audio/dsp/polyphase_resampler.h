@@ -0,0 +1,45 @@
+#ifndef POLYPHASE_RESAMPLER_H
+#define POLYPHASE_RESAMPLER_H
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+#include <opus_resampler.h>
+
+/*
+ * Streaming polyphase FIR resampler for the small integer ratios between the codec rates
+ * (48k, 24k, 16k and 8k), a drop-in replacement for OpusResampler on the audio paths.
+ *
+ * The windowed-sinc prototype is built in Configure() and stored as Q14 phases, so Process()
+ * is one fixed-point dot product per output sample. Ratios that need more than
+ * POLYPHASE_RESAMPLER_MAX_PHASES phases (e.g. 44.1k) fall back to OpusResampler.
+ *
+ * Output samples are produced as soon as their input is available, GetOutputSamples() returns
+ * the exact count for the next Process() call, which may differ by one from the nominal ratio.
+ */
+class PolyphaseResampler {
+public:
+    void Configure(int input_sample_rate, int output_sample_rate);
+    size_t GetOutputSamples(size_t input_samples) const;
+    // Returns the number of samples written to output
+    size_t Process(const int16_t* input, size_t input_samples, int16_t* output);
+    void Reset();
+
+    int input_sample_rate() const { return input_sample_rate_; }
+    int output_sample_rate() const { return output_sample_rate_; }
+
+private:
+    int input_sample_rate_ = 0;
+    int output_sample_rate_ = 0;
+    int up_ = 1;                    // Interpolation factor L
+    int down_ = 1;                  // Decimation factor M
+    int taps_ = 0;                  // Taps per phase
+    std::vector<int16_t> coefficients_; // up_ phases of taps_ coefficients, reversed for a forward dot product
+    std::vector<int16_t> window_;   // taps_ - 1 samples of history followed by the current input
+    uint32_t position_ = 0;         // Upsampled position of the next output, relative to the current input
+    std::unique_ptr<OpusResampler> fallback_;
+};
+
+#endif // POLYPHASE_RESAMPLER_H
@@ -0,0 +1,103 @@
+#include "time_stretcher.h"
+
+#include <cmath>
+#include <algorithm>
+
+// Pitch range searched for a period, 400 Hz down to 66 Hz
+#define TIME_STRETCHER_MIN_LAG_MS 2.5f
+#define TIME_STRETCHER_MAX_LAG_MS 15
+// Normalized correlation a period needs before it is removed or repeated
+#define TIME_STRETCHER_MIN_CORRELATION 0.75f
+// Mean square below which the frame counts as silence, about -40 dBFS
+#define TIME_STRETCHER_SILENCE_ENERGY (328 * 328)
+
+
+void TimeStretcher::Configure(int sample_rate) {
+    min_lag_ = sample_rate * TIME_STRETCHER_MIN_LAG_MS / 1000;
+    max_lag_ = sample_rate * TIME_STRETCHER_MAX_LAG_MS / 1000;
+}
+
+size_t TimeStretcher::FindLag(const int16_t* pcm, size_t max_lag) const {
+    max_lag = std::min(max_lag, max_lag_);
+    if (max_lag < min_lag_ || min_lag_ == 0) {
+        return 0;
+    }
+
+    /* Silence can be cut or repeated anywhere */
+    int64_t energy = 0;
+    for (size_t i = 0; i < max_lag * 2; i++) {
+        energy += pcm[i] * pcm[i];
+    }
+    if (energy < static_cast<int64_t>(TIME_STRETCHER_SILENCE_ENERGY * max_lag * 2)) {
+        return max_lag;
+    }
+
+    auto correlate = [pcm](size_t lag, size_t step) {
+        int64_t cross = 0, energy1 = 0, energy2 = 0;
+        for (size_t i = 0; i < lag; i += step) {
+            cross += pcm[i] * pcm[lag + i];
+            energy1 += pcm[i] * pcm[i];
+            energy2 += pcm[lag + i] * pcm[lag + i];
+        }
+        if (cross <= 0 || energy1 == 0 || energy2 == 0) {
+            return 0.0f;
+        }
+        return static_cast<float>(cross) / sqrtf(static_cast<float>(energy1) * static_cast<float>(energy2));
+    };
+
+    /* Coarse search on every other lag and sample, then refine around the best one */
+    size_t best_lag = 0;
+    float best_score = 0;
+    for (size_t lag = min_lag_; lag <= max_lag; lag += 2) {
+        float score = correlate(lag, 2);
+        if (score > best_score) {
+            best_score = score;
+            best_lag = lag;
+        }
+    }
+    if (best_lag == 0) {
+        return 0;
+    }
+    size_t center = best_lag;
+    best_score = 0;
+    for (size_t lag = std::max(center - 1, min_lag_); lag <= std::min(center + 1, max_lag); lag++) {
+        float score = correlate(lag, 1);
+        if (score > best_score) {
+            best_score = score;
+            best_lag = lag;
+        }
+    }
+    return best_score >= TIME_STRETCHER_MIN_CORRELATION ? best_lag : 0;
+}
+
+size_t TimeStretcher::Compress(std::vector<int16_t>& pcm, size_t max_samples) {
+    size_t lag = FindLag(pcm.data(), std::min(max_samples, pcm.size() / 2));
+    if (lag == 0) {
+        return 0;
+    }
+
+    /* Fade from the first period into the second, then drop the second */
+    int16_t* x = pcm.data();
+    for (size_t i = 0; i < lag; i++) {
+        int32_t weight = (i << 15) / lag;
+        x[i] = (x[i] * (32768 - weight) + x[lag + i] * weight) >> 15;
+    }
+    pcm.erase(pcm.begin() + lag, pcm.begin() + lag * 2);
+    return lag;
+}
+
+size_t TimeStretcher::Expand(std::vector<int16_t>& pcm, size_t max_samples) {
+    size_t lag = FindLag(pcm.data(), std::min(max_samples, pcm.size() / 2));
+    if (lag == 0) {
+        return 0;
+    }
+
+    /* After the first period, fade from the second back into the first, so the first plays twice */
+    pcm.insert(pcm.begin() + lag, lag, 0);
+    int16_t* x = pcm.data();
+    for (size_t i = 0; i < lag; i++) {
+        int32_t weight = (i << 15) / lag;
+        x[lag + i] = (x[lag * 2 + i] * (32768 - weight) + x[i] * weight) >> 15;
+    }
+    return lag;
+}
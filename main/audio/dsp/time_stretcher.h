@@ -0,0 +1,37 @@
+#ifndef TIME_STRETCHER_H
+#define TIME_STRETCHER_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Changes the duration of a decoded frame by one pitch period, without changing the pitch.
+ *
+ * This is WSOLA reduced to a single splice per frame, so it needs no lookahead and adds no
+ * latency. The lag between the start of the frame and its most similar continuation is found
+ * by normalized cross-correlation, between TIME_STRETCHER_MIN_LAG_MS and TIME_STRETCHER_MAX_LAG_MS.
+ * Compress() crossfades the first period into the second and drops one, Expand() crossfades
+ * back into the first period and plays it twice. The edges of the frame are untouched, so the
+ * output stays continuous with the neighbouring frames. Frames without a clear period are left
+ * alone, silence is cut or repeated by the largest lag allowed.
+ *
+ * The caller spreads the splices over the frames to bound the speed change, see max_samples.
+ */
+class TimeStretcher {
+public:
+    void Configure(int sample_rate);
+
+    // Removes up to max_samples from the frame, returns the number removed, 0 if no period fits
+    size_t Compress(std::vector<int16_t>& pcm, size_t max_samples);
+    // Adds up to max_samples to the frame, returns the number added, 0 if no period fits
+    size_t Expand(std::vector<int16_t>& pcm, size_t max_samples);
+
+private:
+    size_t min_lag_ = 0;
+    size_t max_lag_ = 0;
+
+    size_t FindLag(const int16_t* pcm, size_t max_lag) const;
+};
+
+#endif // TIME_STRETCHER_H
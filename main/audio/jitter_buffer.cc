@@ -0,0 +1,175 @@
+#include "jitter_buffer.h"
+#include <esp_log.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#define TAG "JitterBuffer"
+
+// Smoothing factor of the jitter estimate, the same 1/16 gain as RTP interarrival jitter
+#define JITTER_SMOOTHING 16.0f
+
+
+JitterBuffer::JitterBuffer(size_t capacity, int min_depth, int max_depth, int max_conceal_frames)
+    : min_depth_(min_depth), max_depth_(max_depth), max_conceal_frames_(max_conceal_frames), target_depth_(min_depth) {
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    slots_.resize(size);
+    mask_ = size - 1;
+}
+
+void JitterBuffer::Rebase(uint32_t sequence) {
+    started_ = true;
+    next_sequence_ = sequence;
+    end_sequence_ = sequence;
+    base_sequence_ = sequence;
+    transit_valid_ = false;
+    consecutive_concealed_ = 0;
+}
+
+void JitterBuffer::UpdateJitter(uint32_t sequence, int64_t now_us) {
+    /* RFC 3550 interarrival jitter: the smoothed difference between the transit times of consecutive packets */
+    int64_t transit = now_us / 1000 - static_cast<int64_t>(static_cast<int32_t>(sequence - base_sequence_)) * frame_duration_ms_;
+    if (!transit_valid_) {
+        /* First packet after a rebase or an underrun, a pause in the stream is not network jitter */
+        last_transit_ms_ = transit;
+        transit_valid_ = true;
+        return;
+    }
+    float difference = static_cast<float>(std::llabs(transit - last_transit_ms_));
+    last_transit_ms_ = transit;
+    jitter_ms_ += (difference - jitter_ms_) / JITTER_SMOOTHING;
+
+    int target = min_depth_ + static_cast<int>(std::ceil(jitter_ms_ * 2 / frame_duration_ms_));
+    target_depth_ = std::clamp(target, min_depth_, max_depth_);
+}
+
+void JitterBuffer::UpdateDepth() {
+    depth_.store(count_, std::memory_order_relaxed);
+}
+
+bool JitterBuffer::Put(AudioStreamPacketPtr& packet, int64_t now_us) {
+    if (packet->frame_duration > 0) {
+        frame_duration_ms_ = packet->frame_duration;
+    }
+
+    /* Packets without a sequence number are appended in arrival order */
+    uint32_t sequence = packet->sequence;
+    if (sequence == 0) {
+        sequence = started_ ? end_sequence_ : 1;
+    }
+    if (!started_) {
+        Rebase(sequence);
+    }
+
+    int32_t offset = static_cast<int32_t>(sequence - next_sequence_);
+    int32_t capacity = static_cast<int32_t>(slots_.size());
+    if (offset < 0) {
+        if (count_ > 0 || -offset <= capacity) {
+            statistics_.late++;
+            ESP_LOGD(TAG, "Late packet %lu, playing %lu", sequence, next_sequence_);
+            packet.reset();
+            return true;
+        }
+        /* Far behind an empty buffer, the sender restarted its sequence numbers */
+        Rebase(sequence);
+    } else if (offset >= capacity) {
+        if (count_ > 0) {
+            return false;
+        }
+        Rebase(sequence);
+    }
+
+    auto& slot = slots_[sequence & mask_];
+    if (slot) {
+        statistics_.late++;
+        packet.reset();
+        return true;
+    }
+
+    if (!playing_ && count_ == 0) {
+        buffering_since_us_ = now_us;
+    }
+    slot = std::move(packet);
+    count_++;
+    if (static_cast<int32_t>(sequence - end_sequence_) >= 0) {
+        end_sequence_ = sequence + 1;
+    }
+    statistics_.received++;
+    UpdateJitter(sequence, now_us);
+    UpdateDepth();
+    return true;
+}
+
+JitterBufferResult JitterBuffer::Get(AudioStreamPacketPtr& packet, int64_t now_us) {
+    if (count_ == 0) {
+        if (playing_) {
+            /* Underrun, the next packet starts a new transit reference */
+            playing_ = false;
+            transit_valid_ = false;
+        }
+        return kJitterBufferEmpty;
+    }
+
+    /* Buffer up to the target depth before starting playout, but never longer than that much time */
+    if (!playing_) {
+        int buffered = static_cast<int>(end_sequence_ - next_sequence_);
+        int64_t waited_us = now_us - buffering_since_us_;
+        if (buffered < target_depth_ && waited_us < static_cast<int64_t>(target_depth_) * frame_duration_ms_ * 1000) {
+            return kJitterBufferEmpty;
+        }
+        playing_ = true;
+    }
+
+    if (!slots_[next_sequence_ & mask_]) {
+        if (consecutive_concealed_ < max_conceal_frames_) {
+            consecutive_concealed_++;
+            next_sequence_++;
+            statistics_.lost++;
+            statistics_.concealed++;
+            return kJitterBufferConceal;
+        }
+        /* A long hole sounds better skipped than filled with concealment */
+        while (!slots_[next_sequence_ & mask_]) {
+            next_sequence_++;
+            statistics_.lost++;
+        }
+    }
+
+    packet = std::move(slots_[next_sequence_ & mask_]);
+    next_sequence_++;
+    count_--;
+    consecutive_concealed_ = 0;
+    UpdateDepth();
+    return kJitterBufferPacket;
+}
+
+int64_t JitterBuffer::GetPlayoutDeadline() const {
+    if (playing_ || count_ == 0) {
+        return -1;
+    }
+    return buffering_since_us_ + static_cast<int64_t>(target_depth_) * frame_duration_ms_ * 1000;
+}
+
+void JitterBuffer::Reset() {
+    for (auto& slot : slots_) {
+        slot.reset();
+    }
+    count_ = 0;
+    started_ = false;
+    playing_ = false;
+    transit_valid_ = false;
+    jitter_ms_ = 0;
+    target_depth_ = min_depth_;
+    UpdateDepth();
+}
+
+JitterBufferStatistics JitterBuffer::statistics() const {
+    JitterBufferStatistics statistics = statistics_;
+    statistics.depth = depth();
+    statistics.target_depth = target_depth_;
+    statistics.jitter_ms = static_cast<uint32_t>(jitter_ms_);
+    return statistics;
+}
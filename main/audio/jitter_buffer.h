@@ -0,0 +1,84 @@
+#ifndef JITTER_BUFFER_H
+#define JITTER_BUFFER_H
+
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+#include "protocol.h"
+
+struct JitterBufferStatistics {
+    uint32_t received = 0;      // Packets accepted into the buffer
+    uint32_t late = 0;          // Packets that arrived after their playout time, or duplicates
+    uint32_t lost = 0;          // Frames that never arrived in time
+    uint32_t concealed = 0;     // Frames synthesized by Opus packet loss concealment
+    uint32_t depth = 0;         // Frames currently buffered
+    uint32_t target_depth = 0;  // Frames buffered before playout starts
+    uint32_t jitter_ms = 0;     // Smoothed arrival jitter
+};
+
+enum JitterBufferResult {
+    kJitterBufferEmpty,
+    kJitterBufferPacket,
+    kJitterBufferConceal,
+};
+
+/*
+ * Reorders incoming Opus packets by sequence number and releases them at the pace of the
+ * playback queue.
+ *
+ * Packets without a sequence number (sequence == 0) are appended in arrival order. The
+ * arrival jitter is the RFC 3550 interarrival jitter of the current talk spurt, restarted
+ * after an underrun so pauses between sentences do not count as jitter, and playout (re)starts once target_depth frames are buffered or the first buffered packet has
+ * waited that long. A missing frame with later frames already buffered is reported as
+ * kJitterBufferConceal, so the caller can run Opus packet loss concealment for it.
+ *
+ * Only the decode task touches the buffer, statistics() and depth() may be read from any task,
+ * the statistics are then a best effort snapshot.
+ */
+class JitterBuffer {
+public:
+    JitterBuffer(size_t capacity, int min_depth, int max_depth, int max_conceal_frames);
+
+    // Returns false if the packet does not fit yet, it is kept by the caller
+    bool Put(AudioStreamPacketPtr& packet, int64_t now_us);
+    JitterBufferResult Get(AudioStreamPacketPtr& packet, int64_t now_us);
+    // Time at which a buffering stream should start playout, or -1 if nothing is waiting
+    int64_t GetPlayoutDeadline() const;
+    void Reset();
+
+    bool Full() const { return count_ >= slots_.size(); }
+    uint32_t depth() const { return depth_.load(std::memory_order_relaxed); }
+    int target_depth() const { return target_depth_; }
+    JitterBufferStatistics statistics() const;
+
+private:
+    std::vector<AudioStreamPacketPtr> slots_;
+    uint32_t mask_;
+    int min_depth_;
+    int max_depth_;
+    int max_conceal_frames_;
+
+    bool started_ = false;
+    bool playing_ = false;
+    uint32_t next_sequence_ = 0;   // Next frame to play
+    uint32_t end_sequence_ = 0;    // One past the newest buffered frame
+    size_t count_ = 0;
+    int frame_duration_ms_ = 60;
+    int target_depth_;
+    int consecutive_concealed_ = 0;
+    int64_t buffering_since_us_ = 0;
+    uint32_t base_sequence_ = 0;
+    bool transit_valid_ = false;
+    int64_t last_transit_ms_ = 0;
+    float jitter_ms_ = 0;
+
+    std::atomic<uint32_t> depth_{0};
+    JitterBufferStatistics statistics_;
+
+    void Rebase(uint32_t sequence);
+    void UpdateJitter(uint32_t sequence, int64_t now_us);
+    void UpdateDepth();
+};
+
+#endif // JITTER_BUFFER_H
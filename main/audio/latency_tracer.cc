@@ -0,0 +1,123 @@
+#include "latency_tracer.h"
+#include <esp_timer.h>
+#include <algorithm>
+
+// Upper bounds in ms, the last bucket is open ended
+static const uint32_t kBucketLimitsMs[LATENCY_BUCKET_COUNT] = {
+    5, 10, 20, 40, 60, 80, 100, 150, 200, 300, 500, 750, 1000, 2000, 5000, UINT32_MAX
+};
+
+static const char* const kStageNames[kLatencyStageCount] = {
+    "mic_to_processed",
+    "mic_to_encoded",
+    "mic_to_sent",
+    "receive_to_decoded",
+    "receive_to_output",
+    "speech_end_to_first_packet",
+    "speech_end_to_first_output",
+    "wake_word_to_first_uplink",
+};
+
+const char* LatencyTracer::GetStageName(LatencyStage stage) {
+    return kStageNames[stage];
+}
+
+void LatencyTracer::Record(LatencyStage stage, int64_t since_us) {
+    if (since_us <= 0) {
+        return;
+    }
+    int64_t elapsed_us = esp_timer_get_time() - since_us;
+    uint32_t elapsed_ms = elapsed_us > 0 ? elapsed_us / 1000 : 0;
+
+    auto& histogram = histograms_[stage];
+    int bucket = 0;
+    while (elapsed_ms > kBucketLimitsMs[bucket]) {
+        bucket++;
+    }
+    histogram.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    histogram.count.fetch_add(1, std::memory_order_relaxed);
+    uint32_t max_ms = histogram.max_ms.load(std::memory_order_relaxed);
+    while (elapsed_ms > max_ms && !histogram.max_ms.compare_exchange_weak(max_ms, elapsed_ms, std::memory_order_relaxed)) {
+    }
+}
+
+void LatencyTracer::MarkSpeechEnd() {
+    speech_end_us_ = esp_timer_get_time();
+    waiting_first_packet_ = true;
+    waiting_first_output_ = true;
+}
+
+void LatencyTracer::OnPacketReceived() {
+    if (waiting_first_packet_.load(std::memory_order_relaxed) && waiting_first_packet_.exchange(false)) {
+        Record(kLatencySpeechEndToFirstPacket, speech_end_us_);
+    }
+}
+
+void LatencyTracer::OnOutput() {
+    if (waiting_first_output_.load(std::memory_order_relaxed) && waiting_first_output_.exchange(false)) {
+        Record(kLatencySpeechEndToFirstOutput, speech_end_us_);
+    }
+}
+
+void LatencyTracer::Reset() {
+    for (auto& histogram : histograms_) {
+        for (auto& bucket : histogram.buckets) {
+            bucket = 0;
+        }
+        histogram.count = 0;
+        histogram.max_ms = 0;
+    }
+    waiting_first_packet_ = false;
+    waiting_first_output_ = false;
+}
+
+uint32_t LatencyTracer::GetPercentile(LatencyStage stage, int percent) const {
+    auto& histogram = histograms_[stage];
+    uint32_t count = histogram.count.load(std::memory_order_relaxed);
+    if (count == 0) {
+        return 0;
+    }
+    uint32_t rank = (static_cast<uint64_t>(count) * percent + 99) / 100;
+    uint32_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKET_COUNT; i++) {
+        seen += histogram.buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return std::min(kBucketLimitsMs[i], histogram.max_ms.load(std::memory_order_relaxed));
+        }
+    }
+    return histogram.max_ms.load(std::memory_order_relaxed);
+}
+
+cJSON* LatencyTracer::GetJson(bool with_buckets) const {
+    auto root = cJSON_CreateObject();
+    if (with_buckets) {
+        auto limits = cJSON_CreateArray();
+        for (int i = 0; i < LATENCY_BUCKET_COUNT - 1; i++) {
+            cJSON_AddItemToArray(limits, cJSON_CreateNumber(kBucketLimitsMs[i]));
+        }
+        cJSON_AddItemToObject(root, "bucket_limits_ms", limits);
+    }
+
+    for (int i = 0; i < kLatencyStageCount; i++) {
+        auto stage = static_cast<LatencyStage>(i);
+        auto& histogram = histograms_[i];
+        uint32_t count = histogram.count.load(std::memory_order_relaxed);
+        if (count == 0 && !with_buckets) {
+            continue;
+        }
+        auto item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "count", count);
+        cJSON_AddNumberToObject(item, "p50", GetPercentile(stage, 50));
+        cJSON_AddNumberToObject(item, "p99", GetPercentile(stage, 99));
+        cJSON_AddNumberToObject(item, "max", histogram.max_ms.load(std::memory_order_relaxed));
+        if (with_buckets) {
+            auto buckets = cJSON_CreateArray();
+            for (auto& bucket : histogram.buckets) {
+                cJSON_AddItemToArray(buckets, cJSON_CreateNumber(bucket.load(std::memory_order_relaxed)));
+            }
+            cJSON_AddItemToObject(item, "buckets", buckets);
+        }
+        cJSON_AddItemToObject(root, kStageNames[i], item);
+    }
+    return root;
+}
@@ -0,0 +1,60 @@
+#ifndef LATENCY_TRACER_H
+#define LATENCY_TRACER_H
+
+#include <atomic>
+#include <cstdint>
+#include <cJSON.h>
+
+enum LatencyStage {
+    kLatencyMicToProcessed,         // Mic read to audio processor output
+    kLatencyMicToEncoded,           // Mic read to encoded Opus packet
+    kLatencyMicToSent,              // Mic read to Protocol::SendAudio()
+    kLatencyReceiveToDecoded,       // Packet received to decoded PCM
+    kLatencyReceiveToOutput,        // Packet received to codec OutputData()
+    kLatencySpeechEndToFirstPacket, // End of user speech to the first incoming packet
+    kLatencySpeechEndToFirstOutput, // End of user speech to the first reply sample played
+    kLatencyWakeWordToFirstUplink,  // Wake word detected to the first audio packet sent
+    kLatencyStageCount,
+};
+
+#define LATENCY_BUCKET_COUNT 16
+
+/*
+ * Fixed-bucket latency histograms of the voice pipeline.
+ *
+ * Frames carry the time they were captured (uplink) or received (downlink), and each stage
+ * records the time elapsed since then with Record(). The end of user speech is marked by the
+ * VAD, and the first incoming packet and the first played sample after it are recorded once.
+ * Recording only increments atomic counters, so it is safe from any audio task.
+ */
+class LatencyTracer {
+public:
+    void Record(LatencyStage stage, int64_t since_us);
+    void MarkSpeechEnd();
+    void OnPacketReceived();
+    void OnOutput();
+    void Reset();
+
+    // Frames recorded at the stage
+    uint32_t GetCount(LatencyStage stage) const { return histograms_[stage].count.load(std::memory_order_relaxed); }
+    // Upper bound of the bucket holding the given percentile, in ms, 0 if nothing was recorded
+    uint32_t GetPercentile(LatencyStage stage, int percent) const;
+    // {"stage": {"count", "p50", "p99", "max"}}, with the bucket counts if with_buckets is set
+    cJSON* GetJson(bool with_buckets) const;
+
+    static const char* GetStageName(LatencyStage stage);
+
+private:
+    struct Histogram {
+        std::atomic<uint32_t> buckets[LATENCY_BUCKET_COUNT] = {};
+        std::atomic<uint32_t> count{0};
+        std::atomic<uint32_t> max_ms{0};
+    };
+
+    Histogram histograms_[kLatencyStageCount];
+    std::atomic<int64_t> speech_end_us_{0};
+    std::atomic<bool> waiting_first_packet_{false};
+    std::atomic<bool> waiting_first_output_{false};
+};
+
+#endif // LATENCY_TRACER_H
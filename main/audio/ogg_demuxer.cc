@@ -0,0 +1,325 @@
+#include "ogg_demuxer.h"
+#include <esp_log.h>
+#include <cstring>
+#include <algorithm>
+
+#define TAG "OggDemuxer"
+
+#define OGG_PAGE_HEADER_SIZE 27
+#define OGG_HEADER_TYPE_CONTINUED 0x01
+#define OGG_HEADER_TYPE_EOS 0x04
+// Opus granule positions always count 48 kHz samples
+#define OPUS_GRANULE_RATE_KHZ 48
+// The longest packet allowed by RFC 6716 is 120 ms
+#define OPUS_MAX_PACKET_SAMPLES 5760
+
+
+static uint64_t ReadLe64(const uint8_t* p) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; i--) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+uint32_t OggDemuxer::GetPacketSamples(const uint8_t* data, size_t size) {
+    if (size < 1) {
+        return 0;
+    }
+
+    /* TOC byte: config selects the frame size of the SILK, hybrid or CELT mode */
+    uint8_t toc = data[0];
+    int config = toc >> 3;
+    uint32_t frame_samples;
+    if (config < 12) {
+        static const uint32_t silk[] = {480, 960, 1920, 2880};
+        frame_samples = silk[config & 3];
+    } else if (config < 16) {
+        frame_samples = (config & 1) ? 960 : 480;
+    } else {
+        static const uint32_t celt[] = {120, 240, 480, 960};
+        frame_samples = celt[config & 3];
+    }
+
+    uint32_t frames;
+    switch (toc & 3) {
+    case 0:
+        frames = 1;
+        break;
+    case 1:
+    case 2:
+        frames = 2;
+        break;
+    default:
+        if (size < 2) {
+            return 0;
+        }
+        frames = data[1] & 0x3F;
+        break;
+    }
+
+    uint32_t samples = frame_samples * frames;
+    return samples > OPUS_MAX_PACKET_SAMPLES ? 0 : samples;
+}
+
+bool OggDemuxer::LoadPage(size_t offset) {
+    /* Resync on the capture pattern, like a decoder reading a damaged stream would */
+    for (; offset + OGG_PAGE_HEADER_SIZE <= size_; offset++) {
+        if (memcmp(data_ + offset, "OggS", 4) == 0) {
+            break;
+        }
+    }
+    if (offset + OGG_PAGE_HEADER_SIZE > size_) {
+        return false;
+    }
+
+    const uint8_t* page = data_ + offset;
+    int segments = page[26];
+    size_t body_offset = offset + OGG_PAGE_HEADER_SIZE + segments;
+    if (body_offset > size_) {
+        return false;
+    }
+    size_t body_size = 0;
+    for (int i = 0; i < segments; i++) {
+        body_size += page[OGG_PAGE_HEADER_SIZE + i];
+    }
+    if (body_offset + body_size > size_) {
+        ESP_LOGW(TAG, "Truncated page at %u", (unsigned)offset);
+        return false;
+    }
+
+    page_offset_ = offset;
+    body_offset_ = body_offset;
+    segments_ = segments;
+    segment_index_ = 0;
+    page_granule_ = static_cast<int64_t>(ReadLe64(page + 6));
+    page_eos_ = page[5] & OGG_HEADER_TYPE_EOS;
+    return true;
+}
+
+bool OggDemuxer::NextRawPacket(const uint8_t*& data, size_t& size, bool& last_on_page) {
+    while (true) {
+        if (segment_index_ >= segments_) {
+            if (!LoadPage(body_offset_)) {
+                return false;
+            }
+            continue;
+        }
+
+        const uint8_t* table = data_ + page_offset_ + OGG_PAGE_HEADER_SIZE;
+        size_t start = body_offset_;
+        size_t length = 0;
+        uint8_t lacing;
+        do {
+            lacing = table[segment_index_++];
+            length += lacing;
+        } while (lacing == 255 && segment_index_ < segments_);
+        body_offset_ += length;
+
+        if (lacing == 255) {
+            /* The packet continues on the next page, this is the only case that is copied */
+            joined_packet_.assign(data_ + start, data_ + start + length);
+            while (lacing == 255) {
+                if (!LoadPage(body_offset_)) {
+                    return false;
+                }
+                table = data_ + page_offset_ + OGG_PAGE_HEADER_SIZE;
+                start = body_offset_;
+                length = 0;
+                do {
+                    lacing = table[segment_index_++];
+                    length += lacing;
+                } while (lacing == 255 && segment_index_ < segments_);
+                body_offset_ += length;
+                joined_packet_.insert(joined_packet_.end(), data_ + start, data_ + start + length);
+            }
+            data = joined_packet_.data();
+            size = joined_packet_.size();
+        } else {
+            data = data_ + start;
+            size = length;
+        }
+
+        if (size == 0) {
+            continue;
+        }
+        last_on_page = segment_index_ >= segments_;
+        return true;
+    }
+}
+
+int64_t OggDemuxer::GetPageStartGranule() {
+    /* The page granule is the end of its last complete packet, so walk back over those packets */
+    if (page_granule_ < 0) {
+        return 0;
+    }
+    const uint8_t* page = data_ + page_offset_;
+    const uint8_t* table = page + OGG_PAGE_HEADER_SIZE;
+    size_t offset = page_offset_ + OGG_PAGE_HEADER_SIZE + segments_;
+    int index = 0;
+    bool continued = page[5] & OGG_HEADER_TYPE_CONTINUED;
+    int64_t samples = 0;
+    while (index < segments_) {
+        size_t start = offset;
+        size_t length = 0;
+        uint8_t lacing;
+        do {
+            lacing = table[index++];
+            length += lacing;
+        } while (lacing == 255 && index < segments_);
+        offset += length;
+        if (lacing < 255 && !continued) {
+            samples += GetPacketSamples(data_ + start, length);
+        }
+        continued = false;
+    }
+    return std::max<int64_t>(page_granule_ - samples, 0);
+}
+
+bool OggDemuxer::Open(std::string_view ogg) {
+    data_ = reinterpret_cast<const uint8_t*>(ogg.data());
+    size_ = ogg.size();
+    body_offset_ = 0;
+    segments_ = 0;
+    segment_index_ = 0;
+
+    const uint8_t* packet;
+    size_t size;
+    bool last_on_page;
+    if (!NextRawPacket(packet, size, last_on_page) || size < 19 || memcmp(packet, "OpusHead", 8) != 0) {
+        ESP_LOGE(TAG, "OpusHead not found");
+        return false;
+    }
+    // OpusHead: [8] version, [9] channel_count, [10-11] pre_skip, [12-15] input_sample_rate
+    channels_ = packet[9];
+    pre_skip_ = packet[10] | (packet[11] << 8);
+    sample_rate_ = packet[12] | (packet[13] << 8) | (packet[14] << 16) | (packet[15] << 24);
+
+    if (!NextRawPacket(packet, size, last_on_page) || size < 8 || memcmp(packet, "OpusTags", 8) != 0) {
+        ESP_LOGE(TAG, "OpusTags not found");
+        return false;
+    }
+    // Audio data starts on a fresh page after the comment header
+    first_audio_page_ = body_offset_;
+
+    /* The granule of the last page gives the total duration */
+    last_granule_ = -1;
+    for (size_t offset = size_ >= OGG_PAGE_HEADER_SIZE ? size_ - OGG_PAGE_HEADER_SIZE : 0; offset >= first_audio_page_ && offset < size_; offset--) {
+        if (memcmp(data_ + offset, "OggS", 4) == 0) {
+            last_granule_ = static_cast<int64_t>(ReadLe64(data_ + offset + 6));
+            break;
+        }
+    }
+
+    Rewind();
+    return true;
+}
+
+void OggDemuxer::Rewind() {
+    if (!LoadPage(first_audio_page_)) {
+        segments_ = 0;
+        segment_index_ = 0;
+        body_offset_ = size_;
+    }
+    granule_ = -1;
+    skip_until_ = pre_skip_;
+}
+
+bool OggDemuxer::Next(OggOpusPacket& packet) {
+    const uint8_t* data;
+    size_t size;
+    bool last_on_page;
+    if (!NextRawPacket(data, size, last_on_page)) {
+        return false;
+    }
+    if (granule_ < 0) {
+        granule_ = GetPageStartGranule();
+    }
+
+    uint32_t samples = GetPacketSamples(data, size);
+    int64_t end = granule_ + samples;
+    packet.data = data;
+    packet.size = size;
+    packet.granule = granule_;
+    packet.samples = samples;
+    packet.trim_start = static_cast<uint32_t>(std::clamp<int64_t>(skip_until_ - granule_, 0, samples));
+    packet.trim_end = 0;
+    if (page_eos_ && last_on_page && page_granule_ >= 0 && end > page_granule_) {
+        packet.trim_end = static_cast<uint32_t>(std::min<int64_t>(end - page_granule_, samples - packet.trim_start));
+    }
+    granule_ = end;
+    return true;
+}
+
+bool OggDemuxer::Seek(uint32_t position_ms) {
+    int64_t target = pre_skip_ + static_cast<int64_t>(position_ms) * OPUS_GRANULE_RATE_KHZ;
+
+    Rewind();
+    if (segments_ == 0) {
+        return false;
+    }
+    int64_t start = GetPageStartGranule();
+    size_t previous_page = 0;
+    bool has_previous_page = false;
+    while (page_granule_ < target) {
+        if (page_granule_ >= 0) {
+            start = page_granule_;
+        }
+        previous_page = page_offset_;
+        has_previous_page = true;
+        size_t body_end = page_offset_ + OGG_PAGE_HEADER_SIZE + segments_;
+        for (int i = 0; i < segments_; i++) {
+            body_end += data_[page_offset_ + OGG_PAGE_HEADER_SIZE + i];
+        }
+        if (!LoadPage(body_end)) {
+            Rewind();
+            return false;
+        }
+    }
+
+    if (data_[page_offset_ + 5] & OGG_HEADER_TYPE_CONTINUED) {
+        /* The packet finishing on this page starts at the end of the previous one, at the
+         * granule of that page, so reading goes back to where it starts */
+        size_t continued_page = page_offset_;
+        if (has_previous_page && LoadPage(previous_page)) {
+            const uint8_t* table = data_ + page_offset_ + OGG_PAGE_HEADER_SIZE;
+            size_t offset = body_offset_;
+            int first_segment = 0;
+            size_t first_offset = body_offset_;
+            for (int i = 0; i < segments_; i++) {
+                offset += table[i];
+                if (table[i] < 255) {
+                    first_segment = i + 1;
+                    first_offset = offset;
+                }
+            }
+            if (first_segment > 0 || !(data_[page_offset_ + 5] & OGG_HEADER_TYPE_CONTINUED)) {
+                segment_index_ = first_segment;
+                body_offset_ = first_offset;
+                granule_ = start;
+                skip_until_ = target;
+                return true;
+            }
+            LoadPage(continued_page);
+        }
+
+        /* The packet started even earlier, it is skipped and the positions that follow are
+         * early by its duration, which only shifts the trim slightly */
+        const uint8_t* table = data_ + page_offset_ + OGG_PAGE_HEADER_SIZE;
+        uint8_t lacing;
+        do {
+            lacing = table[segment_index_++];
+            body_offset_ += lacing;
+        } while (lacing == 255 && segment_index_ < segments_);
+    }
+    granule_ = start;
+    skip_until_ = target;
+    return true;
+}
+
+uint32_t OggDemuxer::duration_ms() const {
+    if (last_granule_ <= pre_skip_) {
+        return 0;
+    }
+    return (last_granule_ - pre_skip_) / OPUS_GRANULE_RATE_KHZ;
+}
@@ -0,0 +1,68 @@
+#ifndef OGG_DEMUXER_H
+#define OGG_DEMUXER_H
+
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// One Opus packet inside the Ogg stream, positions and durations are in 48 kHz samples
+struct OggOpusPacket {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    int64_t granule = 0;        // Position of the first sample, pre-skip included
+    uint32_t samples = 0;       // Duration from the TOC byte
+    uint32_t trim_start = 0;    // Samples to drop from the start (pre-skip or seek)
+    uint32_t trim_end = 0;      // Samples to drop from the end (end of stream)
+};
+
+/*
+ * Incremental Ogg/Opus demuxer over a buffer that outlives it, such as the flash-mapped sounds.
+ *
+ * Next() returns views into the buffer instead of copying the packets. Only a packet that is
+ * split across two pages has to be joined, that rare case is copied into an internal buffer
+ * which stays valid until the next call.
+ */
+class OggDemuxer {
+public:
+    bool Open(std::string_view ogg);
+    bool Next(OggOpusPacket& packet);
+    bool Seek(uint32_t position_ms);
+    void Rewind();
+
+    int sample_rate() const { return sample_rate_; }
+    int channels() const { return channels_; }
+    uint16_t pre_skip() const { return pre_skip_; }
+    // Total duration without pre-skip, 0 if the last page has no granule position
+    uint32_t duration_ms() const;
+
+    // Duration of an Opus packet in 48 kHz samples, 0 if the packet is malformed
+    static uint32_t GetPacketSamples(const uint8_t* data, size_t size);
+
+private:
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    int sample_rate_ = 16000;
+    int channels_ = 1;
+    uint16_t pre_skip_ = 0;
+    int64_t last_granule_ = -1;
+
+    // Current page
+    size_t page_offset_ = 0;
+    size_t body_offset_ = 0;
+    int segments_ = 0;
+    int segment_index_ = 0;
+    int64_t page_granule_ = -1;
+    bool page_eos_ = false;
+    size_t first_audio_page_ = 0;
+
+    int64_t granule_ = -1;      // Position of the next packet, -1 until the first audio page is loaded
+    int64_t skip_until_ = 0;    // Samples before this position are trimmed
+    std::vector<uint8_t> joined_packet_;
+
+    bool LoadPage(size_t offset);
+    bool NextRawPacket(const uint8_t*& data, size_t& size, bool& last_on_page);
+    int64_t GetPageStartGranule();
+};
+
+#endif // OGG_DEMUXER_H
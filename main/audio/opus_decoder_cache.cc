@@ -0,0 +1,75 @@
+#include "opus_decoder_cache.h"
+
+#include <esp_log.h>
+
+#define TAG "OpusDecoderCache"
+
+
+void OpusDecoderCache::Initialize(size_t capacity, int output_sample_rate) {
+    entries_.clear();
+    entries_.resize(capacity);
+    output_sample_rate_ = output_sample_rate;
+}
+
+OpusDecoderCache::Entry* OpusDecoderCache::Acquire(Entry* current, int sample_rate, int frame_duration, int channels) {
+    if (current != nullptr && current->sample_rate == sample_rate && current->frame_duration == frame_duration &&
+        current->channels == channels) {
+        return current;
+    }
+    Release(current);
+
+    /* An idle decoder of the same format only needs its state cleared */
+    Entry* victim = nullptr;
+    for (auto& entry : entries_) {
+        if (entry.in_use) {
+            continue;
+        }
+        if (entry.decoder && entry.sample_rate == sample_rate && entry.frame_duration == frame_duration &&
+            entry.channels == channels) {
+            entry.decoder->ResetState();
+            if (entry.resample) {
+                entry.resampler.Reset();
+            }
+            entry.in_use = true;
+            entry.last_used = ++use_counter_;
+            hits_.fetch_add(1, std::memory_order_relaxed);
+            return &entry;
+        }
+        if (victim == nullptr || !entry.decoder || (victim->decoder && entry.last_used < victim->last_used)) {
+            victim = &entry;
+        }
+    }
+    if (victim == nullptr) {
+        ESP_LOGE(TAG, "Every decoder is in use");
+        return nullptr;
+    }
+
+    /* Recreate the least recently used idle entry for the new format */
+    victim->decoder.reset();
+    victim->decoder = std::make_unique<OpusDecoderWrapper>(sample_rate, channels, frame_duration);
+    victim->sample_rate = sample_rate;
+    victim->frame_duration = frame_duration;
+    victim->channels = channels;
+    victim->resample = sample_rate != output_sample_rate_;
+    if (victim->resample) {
+        ESP_LOGI(TAG, "Resampling audio from %d to %d", sample_rate, output_sample_rate_);
+        victim->resampler.Configure(sample_rate, output_sample_rate_);
+    }
+    victim->in_use = true;
+    victim->last_used = ++use_counter_;
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return victim;
+}
+
+void OpusDecoderCache::Release(Entry* entry) {
+    if (entry != nullptr) {
+        entry->in_use = false;
+    }
+}
+
+OpusDecoderCacheStatistics OpusDecoderCache::statistics() const {
+    OpusDecoderCacheStatistics statistics;
+    statistics.hits = hits_.load(std::memory_order_relaxed);
+    statistics.misses = misses_.load(std::memory_order_relaxed);
+    return statistics;
+}
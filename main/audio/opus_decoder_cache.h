@@ -0,0 +1,58 @@
+#ifndef OPUS_DECODER_CACHE_H
+#define OPUS_DECODER_CACHE_H
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+#include <opus_decoder.h>
+
+#include "dsp/polyphase_resampler.h"
+
+struct OpusDecoderCacheStatistics {
+    uint32_t hits = 0;      // Format switches served by a decoder that was already set up
+    uint32_t misses = 0;    // Decoders created, including the first one of each format
+};
+
+/*
+ * Keeps the Opus decoders and their output resamplers of the recent stream formats.
+ *
+ * A decoder and its resampler are set up for one (sample rate, frame duration, channels) and
+ * are expensive to create, so a stream that changes format gets back an idle entry of the new
+ * format when there is one. The entry is then reset, so no state leaks from the previous stream.
+ * An entry held by a stream is never handed to another one, when every idle slot has a different
+ * format the least recently used one is recreated.
+ *
+ * Only the opus decode task uses the cache, statistics() may be read from any task.
+ */
+class OpusDecoderCache {
+public:
+    struct Entry {
+        int sample_rate = 0;
+        int frame_duration = 0;
+        int channels = 0;
+        std::unique_ptr<OpusDecoderWrapper> decoder;
+        PolyphaseResampler resampler;   // To the output sample rate, only configured when they differ
+        bool resample = false;
+        bool in_use = false;
+        uint32_t last_used = 0;
+    };
+
+    // capacity must be larger than the number of streams holding an entry at the same time
+    void Initialize(size_t capacity, int output_sample_rate);
+    // Returns the entry for the format, current is kept if it matches and released otherwise
+    Entry* Acquire(Entry* current, int sample_rate, int frame_duration, int channels);
+    void Release(Entry* entry);
+    OpusDecoderCacheStatistics statistics() const;
+
+private:
+    std::vector<Entry> entries_;
+    int output_sample_rate_ = 0;
+    uint32_t use_counter_ = 0;
+    std::atomic<uint32_t> hits_{0};
+    std::atomic<uint32_t> misses_{0};
+};
+
+#endif // OPUS_DECODER_CACHE_H
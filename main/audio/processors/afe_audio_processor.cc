@@ -14,8 +14,9 @@ void AfeAudioProcessor::Initialize(AudioCodec* codec, int frame_duration_ms, srm
     codec_ = codec;
     frame_samples_ = frame_duration_ms * 16000 / 1000;
 
-    // Pre-allocate output buffer capacity
-    output_buffer_.reserve(frame_samples_);
+    // Pre-allocate output buffer capacity, the AFE chunk is smaller than a frame
+    output_buffer_.reserve(frame_samples_ * 2);
+    output_frame_.reserve(frame_samples_);
 
     int ref_num = codec_->input_reference() ? 1 : 0;
 
@@ -157,16 +158,10 @@ void AfeAudioProcessor::AudioProcessorTask() {
             
             // Output complete frames when buffer has enough data
             while (output_buffer_.size() >= frame_samples_) {
-                if (output_buffer_.size() == frame_samples_) {
-                    // If buffer size equals frame size, move the entire buffer
-                    output_callback_(std::move(output_buffer_));
-                    output_buffer_.clear();
-                    output_buffer_.reserve(frame_samples_);
-                } else {
-                    // If buffer size exceeds frame size, copy one frame and remove it
-                    output_callback_(std::vector<int16_t>(output_buffer_.begin(), output_buffer_.begin() + frame_samples_));
-                    output_buffer_.erase(output_buffer_.begin(), output_buffer_.begin() + frame_samples_);
-                }
+                // Copy one frame into the reusable frame buffer and remove it
+                output_frame_.assign(output_buffer_.begin(), output_buffer_.begin() + frame_samples_);
+                output_buffer_.erase(output_buffer_.begin(), output_buffer_.begin() + frame_samples_);
+                output_callback_(std::move(output_frame_));
             }
         }
     }
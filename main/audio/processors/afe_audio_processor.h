@@ -38,6 +38,7 @@ private:
     int frame_samples_ = 0;
     bool is_speaking_ = false;
     std::vector<int16_t> output_buffer_;
+    std::vector<int16_t> output_frame_;
 
     void AudioProcessorTask();
 };
@@ -1,17 +1,27 @@
 #include "audio_debugger.h"
 #include "sdkconfig.h"
 
+#include <cstring>
+#include <algorithm>
+
 #if CONFIG_USE_AUDIO_DEBUGGER
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <errno.h>
-#include <cstring>
 #include <string>
 #endif
 
 #define TAG "AudioDebugger"
 
+// Datagrams stay below this size unless a single frame is larger
+#define AUDIO_DEBUG_MAX_DATAGRAM_BYTES 4096
+#define AUDIO_DEBUG_SEND_INTERVAL_MS 50
+#define AUDIO_DEBUG_TASK_STACK_SIZE 3072
+#define AUDIO_DEBUG_TASK_PRIORITY 1
+
 
 AudioDebugger::AudioDebugger() {
 #if CONFIG_USE_AUDIO_DEBUGGER
@@ -39,11 +49,48 @@ AudioDebugger::AudioDebugger() {
     } else {
         ESP_LOGW(TAG, "Failed to create UDP socket: %d", errno);
     }
+    if (udp_sockfd_ < 0) {
+        return;
+    }
+
+    /* The positions wrap at 2^32, so the ring size must be a power of two */
+    ring_size_ = 1;
+    while (ring_size_ < CONFIG_AUDIO_DEBUG_BUFFER_SIZE_KB * 1024) {
+        ring_size_ <<= 1;
+    }
+    ring_ = (uint8_t*)heap_caps_malloc(ring_size_, MALLOC_CAP_SPIRAM);
+    if (ring_ == nullptr) {
+        ring_ = (uint8_t*)heap_caps_malloc(ring_size_, MALLOC_CAP_8BIT);
+    }
+    if (ring_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %lu bytes for the audio debug buffer", (unsigned long)ring_size_);
+        return;
+    }
+    datagram_.reserve(AUDIO_DEBUG_MAX_DATAGRAM_BYTES);
+
+    running_ = true;
+    xTaskCreate([](void* arg) {
+        auto debugger = (AudioDebugger*)arg;
+        debugger->SenderTask();
+        debugger->sender_task_ = nullptr;
+        vTaskDelete(NULL);
+    }, "audio_debugger", AUDIO_DEBUG_TASK_STACK_SIZE, this, AUDIO_DEBUG_TASK_PRIORITY, &sender_task_);
+    if (sender_task_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create the audio debugger task");
+        running_ = false;
+    }
 #endif
 }
 
 AudioDebugger::~AudioDebugger() {
 #if CONFIG_USE_AUDIO_DEBUGGER
+    running_ = false;
+    while (sender_task_ != nullptr) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    if (ring_ != nullptr) {
+        heap_caps_free(ring_);
+    }
     if (udp_sockfd_ >= 0) {
         close(udp_sockfd_);
         ESP_LOGI(TAG, "Closed UDP socket");
@@ -51,10 +98,88 @@ AudioDebugger::~AudioDebugger() {
 #endif
 }
 
+void AudioDebugger::WriteRing(uint32_t pos, const void* data, size_t size) {
+    size_t offset = pos & (ring_size_ - 1);
+    size_t first = std::min<size_t>(size, ring_size_ - offset);
+    memcpy(ring_ + offset, data, first);
+    memcpy(ring_, (const uint8_t*)data + first, size - first);
+}
+
+void AudioDebugger::ReadRing(uint32_t pos, void* data, size_t size) const {
+    size_t offset = pos & (ring_size_ - 1);
+    size_t first = std::min<size_t>(size, ring_size_ - offset);
+    memcpy(data, ring_ + offset, first);
+    memcpy((uint8_t*)data + first, ring_, size - first);
+}
+
 void AudioDebugger::Feed(const std::vector<int16_t>& data) {
 #if CONFIG_USE_AUDIO_DEBUGGER
-    if (udp_sockfd_ >= 0) {
-        ssize_t sent = sendto(udp_sockfd_, data.data(), data.size() * sizeof(int16_t), 0,
+    if (!running_ || data.empty()) {
+        return;
+    }
+
+    Record record;
+    record.samples = data.size();
+    record.sample_index = fed_samples_;
+    record.timestamp_us = esp_timer_get_time();
+    fed_samples_ += data.size();
+
+    /* Never wait for the sender, a frame that does not fit is dropped and leaves a gap in sample_index */
+    uint32_t size = sizeof(record) + data.size() * sizeof(int16_t);
+    uint32_t write_pos = write_pos_.load(std::memory_order_relaxed);
+    if (ring_size_ - (write_pos - read_pos_.load(std::memory_order_acquire)) < size) {
+        dropped_samples_.fetch_add(data.size(), std::memory_order_relaxed);
+        return;
+    }
+    WriteRing(write_pos, &record, sizeof(record));
+    WriteRing(write_pos + sizeof(record), data.data(), data.size() * sizeof(int16_t));
+    write_pos_.store(write_pos + size, std::memory_order_release);
+#endif
+}
+
+void AudioDebugger::SenderTask() {
+#if CONFIG_USE_AUDIO_DEBUGGER
+    while (running_) {
+        vTaskDelay(pdMS_TO_TICKS(AUDIO_DEBUG_SEND_INTERVAL_MS));
+        SendPending();
+    }
+#endif
+}
+
+void AudioDebugger::SendPending() {
+#if CONFIG_USE_AUDIO_DEBUGGER
+    uint32_t read_pos = read_pos_.load(std::memory_order_relaxed);
+    uint32_t write_pos = write_pos_.load(std::memory_order_acquire);
+    while (read_pos != write_pos) {
+        /* Batch the frames that follow each other until the datagram is full */
+        AudioDebugHeader header;
+        Record record;
+        ReadRing(read_pos, &record, sizeof(record));
+        header.magic = AUDIO_DEBUG_MAGIC;
+        header.sample_index = record.sample_index;
+        header.timestamp_us = record.timestamp_us;
+        uint32_t next_index = record.sample_index;
+        datagram_.resize(sizeof(header));
+        while (read_pos != write_pos) {
+            ReadRing(read_pos, &record, sizeof(record));
+            size_t bytes = record.samples * sizeof(int16_t);
+            if (record.sample_index != next_index ||
+                (datagram_.size() > sizeof(header) && datagram_.size() + bytes > AUDIO_DEBUG_MAX_DATAGRAM_BYTES)) {
+                break;
+            }
+            size_t offset = datagram_.size();
+            datagram_.resize(offset + bytes);
+            ReadRing(read_pos + sizeof(record), datagram_.data() + offset, bytes);
+            read_pos += sizeof(record) + bytes;
+            next_index += record.samples;
+        }
+        // The frames are copied, Feed() may reuse their space while the datagram is sent
+        read_pos_.store(read_pos, std::memory_order_release);
+
+        header.sequence = sequence_++;
+        header.dropped_samples = dropped_samples_.load(std::memory_order_relaxed);
+        memcpy(datagram_.data(), &header, sizeof(header));
+        ssize_t sent = sendto(udp_sockfd_, datagram_.data(), datagram_.size(), 0,
                              (struct sockaddr*)&udp_server_addr_, sizeof(udp_server_addr_));
         if (sent < 0) {
             ESP_LOGW(TAG, "Failed to send audio data to %s: %d", CONFIG_AUDIO_DEBUG_UDP_SERVER, errno);
@@ -64,5 +189,3 @@ void AudioDebugger::Feed(const std::vector<int16_t>& data) {
     }
 #endif
 }
-
- 
\ No newline at end of file
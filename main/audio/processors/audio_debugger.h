@@ -1,12 +1,36 @@
 #ifndef AUDIO_DEBUGGER_H
 #define AUDIO_DEBUGGER_H
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
 #include <vector>
+#include <atomic>
 #include <cstdint>
 
 #include <sys/socket.h>
 #include <netinet/in.h>
 
+#define AUDIO_DEBUG_MAGIC 0x47424441 // "ADBG"
+
+// Header of each datagram, followed by the interleaved samples of one or more frames
+struct __attribute__((packed)) AudioDebugHeader {
+    uint32_t magic;
+    uint32_t sequence;          // Datagram counter, gaps are datagrams lost on the network
+    uint32_t sample_index;      // Samples fed before the first sample, gaps are lost samples
+    uint32_t dropped_samples;   // Samples dropped on the device because the buffer was full
+    int64_t timestamp_us;       // Capture time of the first frame
+};
+
+/*
+ * Sends the raw microphone frames to CONFIG_AUDIO_DEBUG_UDP_SERVER.
+ *
+ * Feed() runs on the audio input task, so it only copies the frame into a lock-free ring
+ * (in PSRAM when there is some) and never waits: when the ring is full the frame is dropped
+ * and counted. A low priority task drains the ring every few frames and sends the frames in
+ * batches, contiguous samples per datagram, so a slow Wi-Fi link never stalls the capture.
+ * scripts/audio_debug_server.py reassembles the stream and reports the losses.
+ */
 class AudioDebugger {
 public:
     AudioDebugger();
@@ -15,8 +39,31 @@ public:
     void Feed(const std::vector<int16_t>& data);
 
 private:
+    struct Record {
+        uint32_t samples;
+        uint32_t sample_index;
+        int64_t timestamp_us;
+    };
+
     int udp_sockfd_ = -1;
     struct sockaddr_in udp_server_addr_;
+
+    uint8_t* ring_ = nullptr;
+    uint32_t ring_size_ = 0;                // Power of two, the positions below run freely
+    std::atomic<uint32_t> write_pos_{0};
+    std::atomic<uint32_t> read_pos_{0};
+    uint32_t fed_samples_ = 0;
+    std::atomic<uint32_t> dropped_samples_{0};
+
+    TaskHandle_t sender_task_ = nullptr;
+    std::atomic<bool> running_{false};
+    std::vector<uint8_t> datagram_;
+    uint32_t sequence_ = 0;
+
+    void SenderTask();
+    void SendPending();
+    void WriteRing(uint32_t pos, const void* data, size_t size);
+    void ReadRing(uint32_t pos, void* data, size_t size) const;
 };
 
-#endif 
\ No newline at end of file
+#endif 
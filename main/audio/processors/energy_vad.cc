@@ -0,0 +1,80 @@
+#include "energy_vad.h"
+
+#include <algorithm>
+
+// Mean square of the quietest frame counted as speech, about -50 dBFS
+#define ENERGY_VAD_MIN_SPEECH_ENERGY (104.0f * 104.0f)
+// Speech is at least 9 dB above the noise floor, 15 dB for noise-like frames
+#define ENERGY_VAD_SPEECH_RATIO 8.0f
+#define ENERGY_VAD_NOISY_SPEECH_RATIO 32.0f
+// Zero crossings per sample above which a frame sounds like noise (about 2.4 kHz at 16 kHz)
+#define ENERGY_VAD_NOISY_ZCR 0.3f
+// The floor is the minimum over ENERGY_VAD_FLOOR_BLOCKS blocks of this length
+#define ENERGY_VAD_FLOOR_BLOCK_MS 1000
+
+
+void EnergyVad::Configure(int frame_duration_ms, int hangover_ms) {
+    hangover_frames_ = std::max(1, hangover_ms / frame_duration_ms);
+    block_frames_ = std::max(1, ENERGY_VAD_FLOOR_BLOCK_MS / frame_duration_ms);
+    Reset();
+}
+
+void EnergyVad::Reset() {
+    silent_frames_ = 0;
+    frames_in_block_ = 0;
+    block_index_ = 0;
+    block_minimum_ = 0;
+    std::fill(block_minima_, block_minima_ + ENERGY_VAD_FLOOR_BLOCKS, 0.0f);
+    speaking_ = false;
+}
+
+void EnergyVad::ResetSpeech() {
+    silent_frames_ = 0;
+    speaking_ = false;
+}
+
+bool EnergyVad::Process(const int16_t* pcm, size_t samples, int channels) {
+    if (samples == 0) {
+        return speaking_;
+    }
+
+    int64_t sum = 0;
+    size_t crossings = 0;
+    int16_t previous = pcm[0];
+    for (size_t i = 0; i < samples; i++) {
+        int16_t sample = pcm[i * channels];
+        sum += sample * sample;
+        if ((sample ^ previous) < 0) {
+            crossings++;
+        }
+        previous = sample;
+    }
+    float energy = std::max(static_cast<float>(sum) / samples, 1.0f);
+    float zcr = static_cast<float>(crossings) / samples;
+
+    /* Minimum statistics: the floor is the quietest frame of the current and the previous blocks */
+    if (frames_in_block_ == 0 || energy < block_minimum_) {
+        block_minimum_ = energy;
+    }
+    float noise_floor = block_minimum_;
+    for (float minimum : block_minima_) {
+        if (minimum > 0) {
+            noise_floor = std::min(noise_floor, minimum);
+        }
+    }
+    if (++frames_in_block_ == block_frames_) {
+        block_minima_[block_index_] = block_minimum_;
+        block_index_ = (block_index_ + 1) % ENERGY_VAD_FLOOR_BLOCKS;
+        frames_in_block_ = 0;
+    }
+
+    float ratio = zcr > ENERGY_VAD_NOISY_ZCR ? ENERGY_VAD_NOISY_SPEECH_RATIO : ENERGY_VAD_SPEECH_RATIO;
+    bool speech = energy >= ENERGY_VAD_MIN_SPEECH_ENERGY && energy >= noise_floor * ratio;
+    if (speech) {
+        silent_frames_ = 0;
+        speaking_ = true;
+    } else if (speaking_ && ++silent_frames_ >= hangover_frames_) {
+        speaking_ = false;
+    }
+    return speaking_;
+}
@@ -0,0 +1,40 @@
+#ifndef ENERGY_VAD_H
+#define ENERGY_VAD_H
+
+#include <cstdint>
+#include <cstddef>
+
+#define ENERGY_VAD_FLOOR_BLOCKS 4
+
+/*
+ * Voice activity detection from frame energy and zero-crossing rate, for the boards without
+ * the AFE and for the wake word input. A few operations per sample, cheap enough for ESP32-C3.
+ *
+ * The noise floor is the quietest frame of the last few seconds (minimum statistics), so it
+ * follows a louder room within seconds but does not creep up during long speech, which always
+ * has short pauses. A frame is speech when it is well above the floor, noise-like frames (high
+ * zero-crossing rate) need a larger margin. Speech starts on the first speech frame and ends
+ * after hangover_ms without one.
+ */
+class EnergyVad {
+public:
+    void Configure(int frame_duration_ms, int hangover_ms);
+    void Reset();
+    // Ends the current speech but keeps the noise floor history, for a new listening session in the same room
+    void ResetSpeech();
+    // Returns whether the speaker is talking after this frame, only the first of the interleaved channels is used
+    bool Process(const int16_t* pcm, size_t samples, int channels = 1);
+    bool speaking() const { return speaking_; }
+
+private:
+    int hangover_frames_ = 0;
+    int block_frames_ = 0;          // Frames per block of the floor history
+    int silent_frames_ = 0;
+    int frames_in_block_ = 0;
+    int block_index_ = 0;
+    float block_minimum_ = 0;
+    float block_minima_[ENERGY_VAD_FLOOR_BLOCKS] = {};     // 0 for the blocks not filled yet
+    bool speaking_ = false;
+};
+
+#endif // ENERGY_VAD_H
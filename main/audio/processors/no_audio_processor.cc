@@ -6,6 +6,8 @@
 void NoAudioProcessor::Initialize(AudioCodec* codec, int frame_duration_ms, srmodel_list_t* models_list) {
     codec_ = codec;
     frame_samples_ = frame_duration_ms * 16000 / 1000;
+    output_buffer_.reserve(frame_samples_);
+    vad_.Configure(frame_duration_ms, CONFIG_NO_AUDIO_PROCESSOR_VAD_HANGOVER_MS);
 }
 
 void NoAudioProcessor::Feed(std::vector<int16_t>&& data) {
@@ -15,22 +17,43 @@ void NoAudioProcessor::Feed(std::vector<int16_t>&& data) {
 
     if (codec_->input_channels() == 2) {
         // If input channels is 2, we need to fetch the left channel data
-        auto mono_data = std::vector<int16_t>(data.size() / 2);
-        for (size_t i = 0, j = 0; i < mono_data.size(); ++i, j += 2) {
-            mono_data[i] = data[j];
+        output_buffer_.resize(data.size() / 2);
+        for (size_t i = 0, j = 0; i < output_buffer_.size(); ++i, j += 2) {
+            output_buffer_[i] = data[j];
         }
-        output_callback_(std::move(mono_data));
+        UpdateVad(output_buffer_);
+        output_callback_(std::move(output_buffer_));
     } else {
+        UpdateVad(data);
         output_callback_(std::move(data));
     }
 }
 
+void NoAudioProcessor::UpdateVad(const std::vector<int16_t>& data) {
+    bool speaking = vad_.Process(data.data(), data.size());
+    if (speaking != is_speaking_) {
+        is_speaking_ = speaking;
+        if (vad_state_change_callback_) {
+            vad_state_change_callback_(speaking);
+        }
+    }
+}
+
 void NoAudioProcessor::Start() {
+    // The floor estimate carries over from the last session, so the first seconds are not judged without one
+    vad_.ResetSpeech();
+    is_speaking_ = false;
     is_running_ = true;
 }
 
 void NoAudioProcessor::Stop() {
     is_running_ = false;
+    if (is_speaking_) {
+        is_speaking_ = false;
+        if (vad_state_change_callback_) {
+            vad_state_change_callback_(false);
+        }
+    }
 }
 
 bool NoAudioProcessor::IsRunning() {
@@ -6,6 +6,7 @@
 
 #include "audio_processor.h"
 #include "audio_codec.h"
+#include "energy_vad.h"
 
 class NoAudioProcessor : public AudioProcessor {
 public:
@@ -25,9 +26,14 @@ public:
 private:
     AudioCodec* codec_ = nullptr;
     int frame_samples_ = 0;
+    std::vector<int16_t> output_buffer_;
     std::function<void(std::vector<int16_t>&& data)> output_callback_;
     std::function<void(bool speaking)> vad_state_change_callback_;
     bool is_running_ = false;
+    EnergyVad vad_;
+    bool is_speaking_ = false;
+
+    void UpdateVad(const std::vector<int16_t>& data);
 };
 
 #endif 
\ No newline at end of file
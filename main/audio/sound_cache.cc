@@ -0,0 +1,161 @@
+#include "sound_cache.h"
+#include "ogg_demuxer.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <opus_decoder.h>
+#include <opus_resampler.h>
+#include <cstring>
+#include <algorithm>
+
+#define TAG "SoundCache"
+
+// Room for the resampler rounding up every packet
+#define SOUND_CACHE_SLACK_MS 120
+
+
+SoundCache::~SoundCache() {
+    for (auto& sound : sounds_) {
+        if (sound->pcm != nullptr) {
+            heap_caps_free(sound->pcm);
+        }
+    }
+}
+
+SoundCache::Sound* SoundCache::Find(std::string_view ogg) {
+    for (auto& sound : sounds_) {
+        if (sound->ogg.data() == ogg.data() && sound->ogg.size() == ogg.size()) {
+            return sound.get();
+        }
+    }
+    return nullptr;
+}
+
+void SoundCache::Add(std::string_view ogg, bool preload) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (ogg.empty() || Find(ogg) != nullptr) {
+        return;
+    }
+    auto sound = std::make_unique<Sound>();
+    sound->ogg = ogg;
+    if (preload) {
+        sound->state = kStatePending;
+        pending_++;
+    }
+    sounds_.push_back(std::move(sound));
+}
+
+bool SoundCache::Lookup(std::string_view ogg, const int16_t*& pcm, size_t& samples) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto sound = Find(ogg);
+    if (sound == nullptr) {
+        return false;
+    }
+    uint8_t state = sound->state.load(std::memory_order_acquire);
+    if (state == kStateReady) {
+        pcm = sound->pcm;
+        samples = sound->samples;
+        return true;
+    }
+    if (state == kStateRegistered) {
+        /* First use, the sound is streamed this time and decoded into the cache afterwards */
+        sound->state = kStatePending;
+        pending_++;
+    }
+    return false;
+}
+
+void SoundCache::DecodePending(int sample_rate, uint32_t max_duration_ms) {
+    Sound* sound = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& s : sounds_) {
+            if (s->state.load(std::memory_order_relaxed) == kStatePending) {
+                sound = s.get();
+                break;
+            }
+        }
+    }
+    if (sound == nullptr) {
+        return;
+    }
+
+    /* Only the decode task writes the PCM, Lookup() reads it once the state says it is ready */
+    bool ok = Decode(*sound, sample_rate, max_duration_ms);
+    sound->state.store(ok ? kStateReady : kStateFailed, std::memory_order_release);
+    pending_--;
+}
+
+bool SoundCache::Decode(Sound& sound, int sample_rate, uint32_t max_duration_ms) {
+    OggDemuxer demuxer;
+    if (!demuxer.Open(sound.ogg)) {
+        return false;
+    }
+    uint32_t duration_ms = demuxer.duration_ms();
+    if (duration_ms == 0 || duration_ms > max_duration_ms) {
+        ESP_LOGW(TAG, "Sound of %lu ms is not cached, the limit is %lu ms", duration_ms, max_duration_ms);
+        return false;
+    }
+
+    int64_t start_time = esp_timer_get_time();
+    size_t capacity = static_cast<size_t>(duration_ms + SOUND_CACHE_SLACK_MS) * sample_rate / 1000;
+    auto pcm = (int16_t*)heap_caps_malloc(capacity * sizeof(int16_t), MALLOC_CAP_SPIRAM);
+    if (pcm == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %u bytes in PSRAM", capacity * sizeof(int16_t));
+        return false;
+    }
+
+    int decode_rate = demuxer.sample_rate();
+    OpusResampler resampler;
+    if (decode_rate != sample_rate) {
+        resampler.Configure(decode_rate, sample_rate);
+    }
+
+    std::unique_ptr<OpusDecoderWrapper> decoder;
+    std::vector<uint8_t> opus;
+    std::vector<int16_t> frame;
+    std::vector<int16_t> resampled;
+    size_t samples = 0;
+    OggOpusPacket packet;
+    while (demuxer.Next(packet) && samples < capacity) {
+        if (packet.samples == 0) {
+            continue;
+        }
+        int frame_duration = packet.samples / 48;
+        if (!decoder || decoder->duration_ms() != frame_duration) {
+            decoder = std::make_unique<OpusDecoderWrapper>(decode_rate, 1, frame_duration);
+        }
+        opus.assign(packet.data, packet.data + packet.size);
+        if (!decoder->Decode(std::move(opus), frame)) {
+            ESP_LOGE(TAG, "Failed to decode sound");
+            heap_caps_free(pcm);
+            return false;
+        }
+
+        size_t trim_start = std::min<size_t>(packet.trim_start * decode_rate / 48000, frame.size());
+        size_t trim_end = std::min<size_t>(packet.trim_end * decode_rate / 48000, frame.size() - trim_start);
+        const int16_t* data = frame.data() + trim_start;
+        size_t count = frame.size() - trim_start - trim_end;
+        if (decode_rate != sample_rate) {
+            resampled.resize(resampler.GetOutputSamples(count));
+            resampler.Process(data, count, resampled.data());
+            data = resampled.data();
+            count = resampled.size();
+        }
+        count = std::min(count, capacity - samples);
+        memcpy(pcm + samples, data, count * sizeof(int16_t));
+        samples += count;
+    }
+
+    if (samples == 0) {
+        heap_caps_free(pcm);
+        return false;
+    }
+    sound.pcm = pcm;
+    sound.samples = samples;
+    memory_usage_ += capacity * sizeof(int16_t);
+    ESP_LOGI(TAG, "Cached sound of %u samples at %d Hz in %lld ms", samples, sample_rate,
+        (esp_timer_get_time() - start_time) / 1000);
+    return true;
+}
@@ -0,0 +1,63 @@
+#ifndef SOUND_CACHE_H
+#define SOUND_CACHE_H
+
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * PCM cache for short system sounds, kept in PSRAM.
+ *
+ * Sounds are registered with Add(), either to be decoded as soon as the decoder is idle
+ * (preload) or only after they have been played once. Decoding runs on the opus decode task
+ * through Decode(), which converts the whole Ogg/Opus stream to 16-bit mono PCM at the codec
+ * output sample rate, so a cached sound is played without touching the Opus decoder or the
+ * resampler.
+ *
+ * Sounds are identified by the address of their Ogg data, which is the flash-mapped asset.
+ */
+class SoundCache {
+public:
+    SoundCache() = default;
+    SoundCache(const SoundCache&) = delete;
+    SoundCache& operator=(const SoundCache&) = delete;
+    ~SoundCache();
+
+    void Add(std::string_view ogg, bool preload);
+    // Returns true with the cached PCM, otherwise requests decoding if the sound was registered
+    bool Lookup(std::string_view ogg, const int16_t*& pcm, size_t& samples);
+    bool HasPending() const { return pending_.load(std::memory_order_relaxed) > 0; }
+    // Decodes one requested sound, called by the decode task while it is idle
+    void DecodePending(int sample_rate, uint32_t max_duration_ms);
+
+    size_t memory_usage() const { return memory_usage_.load(std::memory_order_relaxed); }
+
+private:
+    enum State : uint8_t {
+        kStateRegistered,
+        kStatePending,
+        kStateReady,
+        kStateFailed,
+    };
+
+    struct Sound {
+        std::string_view ogg;
+        int16_t* pcm = nullptr;
+        size_t samples = 0;
+        std::atomic<uint8_t> state{kStateRegistered};
+    };
+
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<Sound>> sounds_;
+    std::atomic<int> pending_{0};
+    std::atomic<size_t> memory_usage_{0};
+
+    Sound* Find(std::string_view ogg);
+    bool Decode(Sound& sound, int sample_rate, uint32_t max_duration_ms);
+};
+
+#endif // SOUND_CACHE_H
@@ -0,0 +1,107 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+/*
+ * Bounded lock-free queue for exactly one producer task and one consumer task.
+ *
+ * Push() may only be called by the producer, Pop() / DropFlushed() only by the consumer.
+ * The read / write positions are free running 32-bit counters, the storage is rounded up
+ * to a power of two while Capacity stays the logical limit of the queue.
+ *
+ * Flush() may be called from any task. It marks everything pushed so far as discarded and
+ * the consumer drops those items on its next Pop(), so items are always destroyed by the
+ * consumer and the producer never writes into a slot that is still in use.
+ */
+template <typename T, size_t Capacity>
+class SpscQueue {
+public:
+    static_assert(Capacity > 0, "SpscQueue capacity must be greater than 0");
+
+    bool Push(T&& item) {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) >= Capacity) {
+            return false;
+        }
+        slots_[head & kMask] = std::move(item);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool Pop(T& item) {
+        DropFlushed();
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = std::move(slots_[tail & kMask]);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Returns the number of items dropped because of a previous Flush()
+    size_t DropFlushed() {
+        if (!flush_pending_.exchange(false, std::memory_order_acquire)) {
+            return 0;
+        }
+        uint32_t until = flush_index_.load(std::memory_order_acquire);
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        size_t dropped = 0;
+        while (static_cast<int32_t>(until - tail) > 0) {
+            slots_[tail & kMask] = T();
+            tail++;
+            dropped++;
+        }
+        tail_.store(tail, std::memory_order_release);
+        return dropped;
+    }
+
+    void Flush() {
+        flush_index_.store(head_.load(std::memory_order_acquire), std::memory_order_release);
+        flush_pending_.store(true, std::memory_order_release);
+    }
+
+    // Number of items the consumer will still receive, pending flushes are not counted
+    size_t Size() const {
+        uint32_t head = head_.load(std::memory_order_acquire);
+        uint32_t tail = tail_.load(std::memory_order_acquire);
+        if (flush_pending_.load(std::memory_order_acquire)) {
+            uint32_t until = flush_index_.load(std::memory_order_acquire);
+            if (static_cast<int32_t>(until - tail) > 0) {
+                tail = until;
+            }
+        }
+        return head - tail;
+    }
+
+    bool Empty() const { return Size() == 0; }
+    // Only meaningful for the producer, items pending a flush still occupy their slots
+    bool Full() const {
+        return head_.load(std::memory_order_relaxed) - tail_.load(std::memory_order_acquire) >= Capacity;
+    }
+    constexpr size_t capacity() const { return Capacity; }
+
+private:
+    static constexpr size_t RoundUpPowerOfTwo(size_t n) {
+        size_t v = 1;
+        while (v < n) {
+            v <<= 1;
+        }
+        return v;
+    }
+    static constexpr size_t kStorageSize = RoundUpPowerOfTwo(Capacity);
+    static constexpr uint32_t kMask = kStorageSize - 1;
+
+    std::array<T, kStorageSize> slots_{};
+    std::atomic<uint32_t> head_{0};
+    std::atomic<uint32_t> tail_{0};
+    std::atomic<uint32_t> flush_index_{0};
+    std::atomic<bool> flush_pending_{false};
+};
+
+#endif // SPSC_QUEUE_H
@@ -0,0 +1,86 @@
+#include "uplink_rate_controller.h"
+
+#include <esp_log.h>
+#include <algorithm>
+
+#define TAG "UplinkRateController"
+
+// Queue depth that counts as congestion, and the depth it must drain below to step back up
+#define UPLINK_CONGESTED_QUEUE_PERCENT 50
+#define UPLINK_CLEAR_QUEUE_DEPTH 1
+// Wait after a step down so the queue can drain before the next one
+#define UPLINK_STEP_DOWN_HOLD_US (1000 * 1000)
+// Time without congestion before stepping back up
+#define UPLINK_STEP_UP_HOLD_US (5000 * 1000)
+
+struct UplinkRateLevel {
+    int bitrate;
+    int frames;     // Packet duration in base frames
+    bool dtx;
+};
+
+// Level 0 is close to the libopus default for 16 kHz VoIP at 60 ms
+static const UplinkRateLevel kLevels[] = {
+    {16000, 1, false},
+    {12000, 1, true},
+    {10000, 1, true},
+    {8000, 2, true},
+    {6000, 2, true},
+};
+static constexpr int kLevelCount = sizeof(kLevels) / sizeof(kLevels[0]);
+
+
+UplinkRateController::UplinkRateController(int base_frame_duration)
+    : base_frame_duration_(base_frame_duration), max_frame_duration_(base_frame_duration) {
+}
+
+bool UplinkRateController::Update(size_t send_queue_depth, size_t send_queue_capacity, int64_t now_us) {
+    bool congested = send_failed_.exchange(false) ||
+        send_queue_depth * 100 >= send_queue_capacity * UPLINK_CONGESTED_QUEUE_PERCENT;
+    int level = level_;
+    if (congested) {
+        last_congestion_us_ = now_us;
+        if (level + 1 < kLevelCount && now_us - last_change_us_ >= UPLINK_STEP_DOWN_HOLD_US) {
+            level++;
+        }
+    } else if (level > 0 && send_queue_depth <= UPLINK_CLEAR_QUEUE_DEPTH &&
+        now_us - last_congestion_us_ >= UPLINK_STEP_UP_HOLD_US &&
+        now_us - last_change_us_ >= UPLINK_STEP_UP_HOLD_US) {
+        level--;
+    }
+    if (level == level_) {
+        return false;
+    }
+
+    level_ = level;
+    last_change_us_ = now_us;
+    auto params = GetParams();
+    ESP_LOGI(TAG, "Uplink level %d: %d bps, %d ms, dtx %s (send queue %u/%u)", level, params.bitrate,
+        params.frame_duration, params.dtx ? "on" : "off", (unsigned)send_queue_depth, (unsigned)send_queue_capacity);
+    return true;
+}
+
+void UplinkRateController::ReportSendResult(bool success) {
+    if (!success) {
+        send_failed_ = true;
+    }
+}
+
+void UplinkRateController::SetMaxFrameDuration(int frame_duration) {
+    max_frame_duration_ = std::max(frame_duration, base_frame_duration_);
+}
+
+void UplinkRateController::Reset() {
+    level_ = 0;
+    send_failed_ = false;
+}
+
+UplinkAudioParams UplinkRateController::GetParams() const {
+    auto& level = kLevels[level_];
+    int max_frames = max_frame_duration_ / base_frame_duration_;
+    UplinkAudioParams params;
+    params.bitrate = level.bitrate;
+    params.frame_duration = std::min(level.frames, max_frames) * base_frame_duration_;
+    params.dtx = level.dtx;
+    return params;
+}
@@ -0,0 +1,50 @@
+#ifndef UPLINK_RATE_CONTROLLER_H
+#define UPLINK_RATE_CONTROLLER_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+struct UplinkAudioParams {
+    int bitrate = 0;            // bits per second
+    int frame_duration = 0;     // ms
+    bool dtx = false;
+};
+
+/*
+ * Picks the uplink Opus parameters from a fixed ladder of levels, one step at a time.
+ *
+ * The send queue filling up or Protocol::SendAudio() failing means the link cannot keep up,
+ * the controller then steps down to a lower bitrate with DTX and, if the server accepted it,
+ * longer packets with less per-packet overhead. Stepping down is limited to once per second
+ * so the queue has time to drain, and after a few quiet seconds it steps back up.
+ *
+ * Update() is called by the encode task, ReportSendResult() by the sending task, and the
+ * current parameters may be read from any task.
+ */
+class UplinkRateController {
+public:
+    // Packets are made of whole frames of base_frame_duration ms, the duration of the encode tasks
+    explicit UplinkRateController(int base_frame_duration);
+
+    // Returns true if the level changed
+    bool Update(size_t send_queue_depth, size_t send_queue_capacity, int64_t now_us);
+    void ReportSendResult(bool success);
+    // Longest packet duration the server accepts, levels above it keep their bitrate with shorter packets
+    void SetMaxFrameDuration(int frame_duration);
+    void Reset();
+
+    UplinkAudioParams GetParams() const;
+    int level() const { return level_; }
+    int max_frame_duration() const { return max_frame_duration_; }
+
+private:
+    const int base_frame_duration_;
+    std::atomic<int> level_{0};
+    std::atomic<int> max_frame_duration_;
+    std::atomic<bool> send_failed_{false};
+    int64_t last_change_us_ = 0;
+    int64_t last_congestion_us_ = 0;
+};
+
+#endif // UPLINK_RATE_CONTROLLER_H
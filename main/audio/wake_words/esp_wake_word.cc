@@ -1,4 +1,6 @@
 #include "esp_wake_word.h"
+#include "audio_service.h"
+
 #include <esp_log.h>
 
 
@@ -41,6 +43,10 @@ bool EspWakeWord::Initialize(AudioCodec* codec, srmodel_list_t* models_list) {
     int audio_chunksize = wakenet_iface_->get_samp_chunksize(wakenet_data_);
     ESP_LOGI(TAG, "Wake word(%s),freq: %d, chunksize: %d", model_name, frequency, audio_chunksize);
 
+#if CONFIG_SEND_WAKE_WORD_DATA
+    wake_word_preroll_.Initialize(OPUS_FRAME_DURATION_MS, CONFIG_WAKE_WORD_PREROLL_MS);
+#endif
+
     return true;
 }
 
@@ -49,6 +55,7 @@ void EspWakeWord::OnWakeWordDetected(std::function<void(const std::string& wake_
 }
 
 void EspWakeWord::Start() {
+    wake_word_preroll_.Reset();
     running_ = true;
 }
 
@@ -61,6 +68,9 @@ void EspWakeWord::Feed(const std::vector<int16_t>& data) {
         return;
     }
 
+    int channels = codec_->input_channels();
+    wake_word_preroll_.Write(data.data(), data.size() / channels, channels);
+
     int res = wakenet_iface_->detect(wakenet_data_, (int16_t *)data.data());
     if (res > 0) {
         last_detected_wake_word_ = wakenet_iface_->get_word_name(wakenet_data_, res);
@@ -80,8 +90,9 @@ size_t EspWakeWord::GetFeedSize() {
 }
 
 void EspWakeWord::EncodeWakeWordData() {
+    wake_word_preroll_.Seal();
 }
 
 bool EspWakeWord::GetWakeWordOpus(std::vector<uint8_t>& opus) {
-    return false;
+    return wake_word_preroll_.Read(opus);
 }
@@ -12,6 +12,7 @@
 
 #include "audio_codec.h"
 #include "wake_word.h"
+#include "wake_word_preroll.h"
 
 class EspWakeWord : public WakeWord {
 public:
@@ -37,6 +38,7 @@ private:
 
     std::function<void(const std::string& wake_word)> wake_word_detected_callback_;
     std::string last_detected_wake_word_;
+    WakeWordPreroll wake_word_preroll_;
 };
 
 #endif
@@ -0,0 +1,169 @@
+#include "wake_word_preroll.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <algorithm>
+#include <cassert>
+
+#define TAG "WakeWordPreroll"
+
+#define WAKE_WORD_PREROLL_SAMPLE_RATE 16000
+#define WAKE_WORD_PREROLL_TASK_STACK_SIZE (4096 * 7)
+// Below the detection task, the encoder only has to keep up on average
+#define WAKE_WORD_PREROLL_TASK_PRIORITY 1
+
+
+WakeWordPreroll::~WakeWordPreroll() {
+    if (encode_task_ != nullptr) {
+        vTaskDelete(encode_task_);
+    }
+    if (encode_task_stack_ != nullptr) {
+        heap_caps_free(encode_task_stack_);
+    }
+    if (encode_task_buffer_ != nullptr) {
+        heap_caps_free(encode_task_buffer_);
+    }
+    if (pcm_ring_ != nullptr) {
+        heap_caps_free(pcm_ring_);
+    }
+}
+
+bool WakeWordPreroll::Initialize(int frame_duration_ms, int duration_ms) {
+    int frames = std::max(1, duration_ms / frame_duration_ms);
+    frame_samples_ = WAKE_WORD_PREROLL_SAMPLE_RATE / 1000 * frame_duration_ms;
+    pcm_capacity_ = frame_samples_ * frames;
+    pcm_ring_ = (int16_t*)heap_caps_malloc(pcm_capacity_ * sizeof(int16_t), MALLOC_CAP_SPIRAM);
+    if (pcm_ring_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %u bytes for the wake word audio", (unsigned)(pcm_capacity_ * sizeof(int16_t)));
+        return false;
+    }
+
+    /* Packets are well below 32kbps, so the slots rarely grow after this */
+    packets_.resize(frames);
+    for (auto& packet : packets_) {
+        packet.reserve(frame_duration_ms * 32000 / 8000);
+    }
+    frame_.resize(frame_samples_);
+    encoder_ = std::make_unique<AdaptiveOpusEncoder>(WAKE_WORD_PREROLL_SAMPLE_RATE, 1, frame_duration_ms);
+    encoder_->SetComplexity(0); // 0 is the fastest
+
+    encode_task_stack_ = (StackType_t*)heap_caps_malloc(WAKE_WORD_PREROLL_TASK_STACK_SIZE, MALLOC_CAP_SPIRAM);
+    encode_task_buffer_ = (StaticTask_t*)heap_caps_malloc(sizeof(StaticTask_t), MALLOC_CAP_INTERNAL);
+    assert(encode_task_stack_ != nullptr && encode_task_buffer_ != nullptr);
+    encode_task_ = xTaskCreateStatic([](void* arg) {
+        auto this_ = (WakeWordPreroll*)arg;
+        this_->EncodeTask();
+        vTaskDelete(NULL);
+    }, "encode_wake_word", WAKE_WORD_PREROLL_TASK_STACK_SIZE, this, WAKE_WORD_PREROLL_TASK_PRIORITY,
+        encode_task_stack_, encode_task_buffer_);
+
+    ESP_LOGI(TAG, "Keeping %d ms of wake word audio as %d packets", frames * frame_duration_ms, frames);
+    return true;
+}
+
+void WakeWordPreroll::Write(const int16_t* data, size_t samples, int channels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pcm_ring_ == nullptr || sealed_) {
+        return;
+    }
+
+    size_t index = pcm_written_ % pcm_capacity_;
+    for (size_t i = 0; i < samples; i++) {
+        pcm_ring_[index] = data[i * channels];
+        if (++index == pcm_capacity_) {
+            index = 0;
+        }
+    }
+    pcm_written_ += samples;
+    // The encoder fell a whole ring behind, the oldest audio has been overwritten
+    if (pcm_written_ - pcm_encoded_ > pcm_capacity_) {
+        pcm_encoded_ = pcm_written_ - pcm_capacity_;
+    }
+    if (pcm_written_ - pcm_encoded_ >= frame_samples_) {
+        cv_.notify_all();
+    }
+}
+
+void WakeWordPreroll::Seal() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sealed_ = true;
+    cv_.notify_all();
+}
+
+bool WakeWordPreroll::Read(std::vector<uint8_t>& opus) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (pcm_ring_ == nullptr) {
+        return false;
+    }
+    cv_.wait(lock, [this]() {
+        return packet_count_ > 0 || drained_;
+    });
+    if (packet_count_ == 0) {
+        return false;
+    }
+    auto& packet = packets_[packet_head_];
+    opus.assign(packet.begin(), packet.end());
+    packet_head_ = (packet_head_ + 1) % packets_.size();
+    packet_count_--;
+    return true;
+}
+
+void WakeWordPreroll::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pcm_written_ = 0;
+    pcm_encoded_ = 0;
+    packet_head_ = 0;
+    packet_count_ = 0;
+    sealed_ = false;
+    drained_ = false;
+    generation_++;
+}
+
+void WakeWordPreroll::EncodeTask() {
+    std::vector<uint8_t> opus;
+    uint32_t encoder_generation = 0;
+
+    while (true) {
+        uint32_t generation;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this]() {
+                return pcm_written_ - pcm_encoded_ >= frame_samples_ || (sealed_ && !drained_);
+            });
+            if (pcm_written_ - pcm_encoded_ < frame_samples_) {
+                /* Sealed, the frame in progress is too short for a packet and is dropped */
+                drained_ = true;
+                cv_.notify_all();
+                continue;
+            }
+
+            size_t index = pcm_encoded_ % pcm_capacity_;
+            size_t first = std::min(frame_samples_, pcm_capacity_ - index);
+            std::copy(pcm_ring_ + index, pcm_ring_ + index + first, frame_.begin());
+            std::copy(pcm_ring_, pcm_ring_ + frame_samples_ - first, frame_.begin() + first);
+            pcm_encoded_ += frame_samples_;
+            generation = generation_;
+        }
+
+        /* Start a new stream after Reset(), the packets before it are gone */
+        if (generation != encoder_generation) {
+            encoder_->ResetState();
+            encoder_generation = generation;
+        }
+        if (!encoder_->Encode(frame_, opus)) {
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (generation != generation_) {
+            continue;
+        }
+        if (packet_count_ == packets_.size()) {
+            packet_head_ = (packet_head_ + 1) % packets_.size();
+            packet_count_--;
+        }
+        packets_[(packet_head_ + packet_count_) % packets_.size()].assign(opus.begin(), opus.end());
+        packet_count_++;
+        cv_.notify_all();
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef WAKE_WORD_PREROLL_H
+#define WAKE_WORD_PREROLL_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+
+#include "adaptive_opus_encoder.h"
+
+/*
+ * The audio leading up to a wake word, kept ready to send as Opus.
+ *
+ * The detection task writes 16 kHz PCM into a fixed ring in PSRAM. A low priority task encodes
+ * it frame by frame as it arrives and keeps the packets of the last duration_ms in a second
+ * ring, dropping the oldest. When the wake word is detected, Seal() stops recording and Read()
+ * returns the packets right away, only the frame in progress is still to be encoded.
+ *
+ * Nothing is allocated after Initialize(), the packet slots keep their capacity.
+ */
+class WakeWordPreroll {
+public:
+    WakeWordPreroll() = default;
+    ~WakeWordPreroll();
+
+    // Allocates the rings and starts the encoder task, the other calls do nothing until then
+    bool Initialize(int frame_duration_ms, int duration_ms);
+    // Stores the first of the interleaved channels, ignored once sealed
+    void Write(const int16_t* data, size_t samples, int channels = 1);
+    // Ends the stream after the audio written so far
+    void Seal();
+    // Blocks until the next packet is ready, returns false at the end of the stream
+    bool Read(std::vector<uint8_t>& opus);
+    // Drops everything and starts recording again
+    void Reset();
+
+private:
+    int16_t* pcm_ring_ = nullptr;
+    size_t pcm_capacity_ = 0;
+    size_t frame_samples_ = 0;
+    uint64_t pcm_written_ = 0;      // Samples written since Reset(), the ring index is modulo pcm_capacity_
+    uint64_t pcm_encoded_ = 0;      // Samples handed to the encoder
+    std::vector<std::vector<uint8_t>> packets_;
+    size_t packet_head_ = 0;        // Oldest packet
+    size_t packet_count_ = 0;
+    bool sealed_ = false;
+    bool drained_ = false;          // Sealed and every whole frame encoded
+    uint32_t generation_ = 0;       // Incremented by Reset(), so a packet encoded before it is dropped
+    std::mutex mutex_;
+    std::condition_variable cv_;
+
+    std::unique_ptr<AdaptiveOpusEncoder> encoder_;
+    std::vector<int16_t> frame_;
+    TaskHandle_t encode_task_ = nullptr;
+    StaticTask_t* encode_task_buffer_ = nullptr;
+    StackType_t* encode_task_stack_ = nullptr;
+
+    void EncodeTask();
+};
+
+#endif // WAKE_WORD_PREROLL_H
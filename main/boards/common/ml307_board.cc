@@ -119,6 +119,11 @@ std::string Ml307Board::GetDeviceStatusJson() {
      *     "audio_speaker": {
      *         "volume": 70
      *     },
+     *     "audio_latency": {
+     *         "speech_end_to_first_output": { "count": 12, "p50": 1000, "p99": 1430, "max": 1430 }
+     *     },
+     *     "audio_downlink": { "received": 1200, "lost": 3, "reordered": 2, "duplicate": 0 },
+     *     "audio_channel": { "handshakes": 4, "handshake_open_ms": 1180, "handshakes_avoided": 17, "reused_open_ms": 95 },
      *     "screen": {
      *         "brightness": 100,
      *         "theme": "light"
@@ -145,6 +150,18 @@ std::string Ml307Board::GetDeviceStatusJson() {
     }
     cJSON_AddItemToObject(root, "audio_speaker", audio_speaker);
 
+    // Audio latency percentiles of the stages recorded so far
+    auto& audio_service = Application::GetInstance().GetAudioService();
+    cJSON_AddItemToObject(root, "audio_latency", audio_service.GetLatencyTracer().GetJson(false));
+
+    // Loss, reorder and duplicate counts of the incoming audio packets
+    auto protocol = Application::GetInstance().GetProtocol();
+    if (protocol != nullptr) {
+        cJSON_AddItemToObject(root, "audio_downlink", protocol->downlink_sequence().GetJson());
+        // Sessions that reused an open connection instead of connecting again, and how long opening took
+        cJSON_AddItemToObject(root, "audio_channel", protocol->GetConnectionJson());
+    }
+
     // Screen brightness
     auto backlight = board.GetBacklight();
     auto screen = cJSON_CreateObject();
@@ -2,12 +2,17 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <atomic>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <esp_http_client.h>
 #include <cJSON.h>
 
 #define MAX_RESPONSE_BUFFER 4096
 
+// Connections opened by the HTTP clients, a request that opened none reused the previous connection
+static std::atomic<uint32_t> connection_count{0};
+
 // HTTP event handler
 static esp_err_t _iot_http_event_handler(esp_http_client_event_t *evt) {
     static int output_len = 0;
@@ -18,6 +23,7 @@ static esp_err_t _iot_http_event_handler(esp_http_client_event_t *evt) {
             break;
         case HTTP_EVENT_ON_CONNECTED:
             ESP_LOGD(IOT_TAG, "HTTP_EVENT_ON_CONNECTED");
+            connection_count++;
             output_len = 0;
             break;
         case HTTP_EVENT_ON_DATA:
@@ -56,9 +62,30 @@ IoTController::IoTController(const std::string& meilin_server, const std::string
 }
 
 IoTController::~IoTController() {
+    if (client_ != nullptr) {
+        esp_http_client_cleanup(client_);
+    }
     ESP_LOGI(IOT_TAG, "IoT Controller destroyed");
 }
 
+esp_http_client_handle_t IoTController::AcquireClient(const std::string& url, char* response_buffer) {
+    if (client_ == nullptr) {
+        esp_http_client_config_t config = {};
+        config.url = url.c_str();
+        config.event_handler = _iot_http_event_handler;
+        config.timeout_ms = 10000;
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+        // When the server has closed the kept connection, the next one resumes the TLS session
+        config.save_client_session = true;
+#endif
+        client_ = esp_http_client_init(&config);
+    } else {
+        esp_http_client_set_url(client_, url.c_str());
+    }
+    esp_http_client_set_user_data(client_, response_buffer);
+    return client_;
+}
+
 IoTCheckResult IoTController::CheckIoTCommand(const std::string& text) {
     IoTCheckResult result = {false, -1, -1, "", ""};
     
@@ -238,6 +265,8 @@ std::string IoTController::GetDeviceList() {
     config.event_handler = _iot_http_event_handler;
     config.user_data = response;
     
+    // Shares the event handler with the POST requests
+    std::lock_guard<std::mutex> lock(mutex_);
     esp_http_client_handle_t client = esp_http_client_init(&config);
     esp_http_client_set_method(client, HTTP_METHOD_GET);
     esp_http_client_set_header(client, "X-API-Key", api_key_.c_str());
@@ -357,30 +386,32 @@ int IoTController::HttpPost(
     size_t buffer_size) {
     
     std::string url = meilin_server_ + endpoint;
-    
-    esp_http_client_config_t config = {};
-    config.url = url.c_str();
-    config.event_handler = _iot_http_event_handler;
-    config.user_data = response_buffer;
-    config.timeout_ms = 10000;
-    
-    esp_http_client_handle_t client = esp_http_client_init(&config);
+
+    // The event handler writes the response of one request at a time
+    std::lock_guard<std::mutex> lock(mutex_);
+    esp_http_client_handle_t client = AcquireClient(url, response_buffer);
     
     esp_http_client_set_method(client, HTTP_METHOD_POST);
     esp_http_client_set_header(client, "Content-Type", "application/json");
     esp_http_client_set_header(client, "X-API-Key", api_key_.c_str());
     esp_http_client_set_post_field(client, json_payload, strlen(json_payload));
     
+    int64_t start_us = esp_timer_get_time();
+    uint32_t connections = connection_count;
     esp_err_t err = esp_http_client_perform(client);
     int status_code = 0;
     
     if (err == ESP_OK) {
         status_code = esp_http_client_get_status_code(client);
-        ESP_LOGI(IOT_TAG, "HTTP POST %s status = %d", endpoint.c_str(), status_code);
+        ESP_LOGI(IOT_TAG, "HTTP POST %s status = %d, took %lld ms %s", endpoint.c_str(), status_code,
+                 (esp_timer_get_time() - start_us) / 1000,
+                 connection_count != connections ? "with a new connection" : "over the open connection");
     } else {
         ESP_LOGE(IOT_TAG, "HTTP POST %s failed: %s", endpoint.c_str(), esp_err_to_name(err));
+        // The next request starts over with a new connection
+        esp_http_client_cleanup(client_);
+        client_ = nullptr;
     }
     
-    esp_http_client_cleanup(client);
     return status_code;
 }
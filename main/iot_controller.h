@@ -3,6 +3,7 @@
 
 #include <string>
 #include <vector>
+#include <mutex>
 #include <esp_http_client.h>
 #include <cJSON.h>
 
@@ -112,6 +113,15 @@ public:
 private:
     std::string meilin_server_;
     std::string api_key_;
+    std::mutex mutex_;                              // Guards client_ and the response of the request in flight
+    esp_http_client_handle_t client_ = nullptr;     // Kept between POST requests
+
+    /**
+     * @brief Get the client for a POST request, the connection of the previous one
+     * is reused while the server keeps it open, so there is no new TLS handshake
+     * Must be called with mutex_ held
+     */
+    esp_http_client_handle_t AcquireClient(const std::string& url, char* response_buffer);
 
     // HTTP helper
     int HttpPost(
@@ -17,6 +17,7 @@
 #include "settings.h"
 #include "lvgl_theme.h"
 #include "lvgl_display.h"
+#include "audio_benchmark.h"
 
 #define TAG "MCP"
 
@@ -52,6 +53,16 @@ void McpServer::AddCommonTools() {
             return board.GetDeviceStatusJson();
         });
 
+    AddTool("self.audio.get_latency",
+        "Provides the latency histograms of the voice pipeline in milliseconds, from the microphone to the network and "
+        "from the network to the speaker, including the time from the end of the user's speech to the first reply sample.\n"
+        "Use this tool only when the user asks about the audio latency or response time of the device.",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            auto& app = Application::GetInstance();
+            return app.GetAudioService().GetLatencyTracer().GetJson(true);
+        });
+
     AddTool("self.audio_speaker.set_volume", 
         "Set the volume of the audio speaker. If the current volume is unknown, you must call `self.get_device_status` tool first and then call this tool.",
         PropertyList({
@@ -170,6 +181,31 @@ void McpServer::AddUserOnlyTools() {
             return true;
         });
 
+    // The benchmark loads the CPU for seconds, it runs on its own task and reports as a notification
+    AddUserOnlyTool("self.audio.run_benchmark",
+        "Runs synthetic speech through the audio pipeline stages (resampling, Opus encoding and decoding, time stretching, "
+        "mixing) as fast as possible in the background. The frames per second, the time per frame of each stage and the "
+        "heap used after warm up are sent as a notifications/message when it is done.",
+        PropertyList({
+            Property("frames", kPropertyTypeInteger, 50, 2, 500)
+        }),
+        [this](const PropertyList& properties) -> ReturnValue {
+            auto codec = Board::GetInstance().GetAudioCodec();
+            return AudioBenchmark::Start(codec->input_sample_rate(), codec->output_sample_rate(),
+                properties["frames"].value<int>(), [this](cJSON* result) {
+                    char* text = cJSON_PrintUnformatted(result);
+                    ESP_LOGI(TAG, "Audio benchmark: %s", text);
+                    std::string params = "{\"level\":\"info\",\"logger\":\"audio_benchmark\",\"data\":";
+                    params += text;
+                    params += "}";
+                    cJSON_free(text);
+                    cJSON_Delete(result);
+                    Application::GetInstance().Schedule([this, params = std::move(params)]() {
+                        SendNotification("notifications/message", params);
+                    });
+                });
+        });
+
     // Display control
 #ifdef HAVE_LVGL
     auto display = dynamic_cast<LvglDisplay*>(Board::GetInstance().GetDisplay());
@@ -445,6 +481,15 @@ void McpServer::ReplyResult(int id, const std::string& result) {
     Application::GetInstance().SendMcpMessage(payload);
 }
 
+void McpServer::SendNotification(const std::string& method, const std::string& params) {
+    std::string payload = "{\"jsonrpc\":\"2.0\",\"method\":\"";
+    payload += method;
+    payload += "\",\"params\":";
+    payload += params;
+    payload += "}";
+    Application::GetInstance().SendMcpMessage(payload);
+}
+
 void McpServer::ReplyError(int id, const std::string& message) {
     std::string payload = "{\"jsonrpc\":\"2.0\",\"id\":";
     payload += std::to_string(id);
@@ -0,0 +1,34 @@
+#include "audio_batch_policy.h"
+
+#include <algorithm>
+
+
+int AudioBatchPolicy::GetTargetFrames(int frame_duration_ms, int max_frames) const {
+    if (max_frames <= 1 || frame_duration_ms <= 0) {
+        return 1;
+    }
+    int frames = 1 + average_send_time_us_ / (frame_duration_ms * 1000);
+    return std::clamp(frames, 1, max_frames);
+}
+
+int64_t AudioBatchPolicy::GetMaxWaitUs(int frame_duration_ms, int max_frames) const {
+    int frames = GetTargetFrames(frame_duration_ms, max_frames);
+    return std::min<int64_t>((frames - 1) * frame_duration_ms, AUDIO_BATCH_MAX_WAIT_MS) * 1000;
+}
+
+bool AudioBatchPolicy::ShouldSend(size_t pending, int64_t waited_us, int frame_duration_ms, int max_frames) const {
+    if (pending == 0) {
+        return false;
+    }
+    return pending >= (size_t)GetTargetFrames(frame_duration_ms, max_frames) ||
+        waited_us >= GetMaxWaitUs(frame_duration_ms, max_frames);
+}
+
+void AudioBatchPolicy::OnSent(int64_t send_time_us) {
+    /* Moving average over about eight messages */
+    average_send_time_us_ += (send_time_us - average_send_time_us_) / 8;
+}
+
+void AudioBatchPolicy::Reset() {
+    average_send_time_us_ = 0;
+}
@@ -0,0 +1,36 @@
+#ifndef AUDIO_BATCH_POLICY_H
+#define AUDIO_BATCH_POLICY_H
+
+#include <cstdint>
+#include <cstddef>
+
+// The first packet of a batch never waits longer than this for the others
+#define AUDIO_BATCH_MAX_WAIT_MS 180
+
+/*
+ * Decides when the uplink packets collected by the main loop go out as one batched message.
+ *
+ * On slow links a message costs about the same whatever it carries (a TLS record, an AES-CTR
+ * call, an AT command round trip on the cellular modems), and sending blocks for about a round
+ * trip. The target batch is the number of frames that arrive while one message is being sent,
+ * from the average time a send blocks, capped by what the server accepted. The first packet
+ * waits for the target for at most the time the frames take to arrive, and a backed up send
+ * queue goes out at once. On a fast link the target is one frame and nothing waits.
+ */
+class AudioBatchPolicy {
+public:
+    // Frames to collect per message, max_frames is what the server accepted
+    int GetTargetFrames(int frame_duration_ms, int max_frames) const;
+    // Longest time the first packet of a batch waits for the others
+    int64_t GetMaxWaitUs(int frame_duration_ms, int max_frames) const;
+    bool ShouldSend(size_t pending, int64_t waited_us, int frame_duration_ms, int max_frames) const;
+    void OnSent(int64_t send_time_us);
+    void Reset();
+
+    int64_t average_send_time_us() const { return average_send_time_us_; }
+
+private:
+    int64_t average_send_time_us_ = 0;
+};
+
+#endif // AUDIO_BATCH_POLICY_H
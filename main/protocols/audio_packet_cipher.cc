@@ -0,0 +1,56 @@
+#include "audio_packet_cipher.h"
+
+#include <esp_log.h>
+#include <arpa/inet.h>
+#include <cstring>
+
+#define TAG "AudioPacketCipher"
+
+
+AudioPacketCipher::AudioPacketCipher() {
+    mbedtls_aes_init(&aes_ctx_);
+}
+
+AudioPacketCipher::~AudioPacketCipher() {
+    mbedtls_aes_free(&aes_ctx_);
+}
+
+bool AudioPacketCipher::SetKey(const std::string& key, const std::string& nonce) {
+    if (key.size() != 16 || nonce.size() != AUDIO_PACKET_NONCE_SIZE) {
+        ESP_LOGE(TAG, "Invalid key or nonce size: %u, %u", (unsigned)key.size(), (unsigned)nonce.size());
+        return false;
+    }
+    memcpy(nonce_, nonce.data(), AUDIO_PACKET_NONCE_SIZE);
+    return mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)key.data(), 128) == 0;
+}
+
+bool AudioPacketCipher::Seal(uint8_t type, const uint8_t* payload, size_t size, uint32_t timestamp, uint32_t sequence,
+    std::string& datagram) {
+    datagram.resize(AUDIO_PACKET_NONCE_SIZE + size);
+    auto header = (uint8_t*)datagram.data();
+    memcpy(header, nonce_, AUDIO_PACKET_NONCE_SIZE);
+    header[0] = type;
+    *(uint16_t*)&header[2] = htons(size);
+    *(uint32_t*)&header[8] = htonl(timestamp);
+    *(uint32_t*)&header[12] = htonl(sequence);
+
+    // The counter block is advanced by the cipher, the header must stay as it is
+    uint8_t counter[AUDIO_PACKET_NONCE_SIZE];
+    memcpy(counter, header, AUDIO_PACKET_NONCE_SIZE);
+    size_t nc_off = 0;
+    uint8_t stream_block[16] = {0};
+    return mbedtls_aes_crypt_ctr(&aes_ctx_, size, &nc_off, counter, stream_block, payload,
+        header + AUDIO_PACKET_NONCE_SIZE) == 0;
+}
+
+bool AudioPacketCipher::Open(const std::string& datagram, uint8_t* out) {
+    if (datagram.size() < AUDIO_PACKET_NONCE_SIZE) {
+        return false;
+    }
+    uint8_t counter[AUDIO_PACKET_NONCE_SIZE];
+    memcpy(counter, datagram.data(), AUDIO_PACKET_NONCE_SIZE);
+    size_t nc_off = 0;
+    uint8_t stream_block[16] = {0};
+    return mbedtls_aes_crypt_ctr(&aes_ctx_, datagram.size() - AUDIO_PACKET_NONCE_SIZE, &nc_off, counter, stream_block,
+        (const uint8_t*)datagram.data() + AUDIO_PACKET_NONCE_SIZE, out) == 0;
+}
@@ -0,0 +1,41 @@
+#ifndef AUDIO_PACKET_CIPHER_H
+#define AUDIO_PACKET_CIPHER_H
+
+#include <mbedtls/aes.h>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+#define AUDIO_PACKET_NONCE_SIZE 16
+
+/*
+ * AES-128-CTR of the MQTT UDP audio datagrams:
+ * |type 1u|flags 1u|payload_len 2u|ssrc 4u|timestamp 4u|sequence 4u|payload payload_len|
+ * The header is the nonce sent by the server with the length, timestamp and sequence filled
+ * in, and it is the initial counter block of the payload.
+ *
+ * Seal() writes the header and encrypts straight into the datagram buffer of the caller, and
+ * Open() decrypts straight into the destination, so there is no staging copy and, once the
+ * buffers have grown, no allocation. With CONFIG_MBEDTLS_HARDWARE_AES (the default) the
+ * streaming CTR call runs on the AES peripheral, one call per datagram.
+ */
+class AudioPacketCipher {
+public:
+    AudioPacketCipher();
+    ~AudioPacketCipher();
+    AudioPacketCipher(const AudioPacketCipher&) = delete;
+    AudioPacketCipher& operator=(const AudioPacketCipher&) = delete;
+
+    // key and nonce are raw bytes, 16 each
+    bool SetKey(const std::string& key, const std::string& nonce);
+    // Replaces datagram with the header and the encrypted payload, keeping its capacity
+    bool Seal(uint8_t type, const uint8_t* payload, size_t size, uint32_t timestamp, uint32_t sequence, std::string& datagram);
+    // Decrypts the payload of datagram (its size minus the header) into out
+    bool Open(const std::string& datagram, uint8_t* out);
+
+private:
+    mbedtls_aes_context aes_ctx_;
+    uint8_t nonce_[AUDIO_PACKET_NONCE_SIZE] = {};
+};
+
+#endif // AUDIO_PACKET_CIPHER_H
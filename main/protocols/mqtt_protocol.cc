@@ -152,30 +152,46 @@ bool MqttProtocol::SendText(const std::string& text) {
     return true;
 }
 
-bool MqttProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
+bool MqttProtocol::SendAudio(AudioStreamPacketPtr packet) {
     std::lock_guard<std::mutex> lock(channel_mutex_);
     if (udp_ == nullptr) {
         return false;
     }
 
-    std::string nonce(aes_nonce_);
-    *(uint16_t*)&nonce[2] = htons(packet->payload.size());
-    *(uint32_t*)&nonce[8] = htonl(packet->timestamp);
-    *(uint32_t*)&nonce[12] = htonl(++local_sequence_);
-
-    std::string encrypted;
-    encrypted.resize(aes_nonce_.size() + packet->payload.size());
-    memcpy(encrypted.data(), nonce.data(), nonce.size());
-
-    size_t nc_off = 0;
-    uint8_t stream_block[16] = {0};
-    if (mbedtls_aes_crypt_ctr(&aes_ctx_, packet->payload.size(), &nc_off, (uint8_t*)nonce.c_str(), stream_block,
-        (uint8_t*)packet->payload.data(), (uint8_t*)&encrypted[nonce.size()]) != 0) {
+    if (!cipher_.Seal(MQTT_UDP_TYPE_AUDIO, packet->data(), packet->size(), packet->timestamp, ++local_sequence_, send_datagram_)) {
         ESP_LOGE(TAG, "Failed to encrypt audio data");
         return false;
     }
+    return udp_->Send(send_datagram_) > 0;
+}
+
+size_t MqttProtocol::SendAudioBatch(std::vector<AudioStreamPacketPtr>& packets) {
+    if (audio_batch_frames_ <= 1) {
+        return Protocol::SendAudioBatch(packets);
+    }
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    if (udp_ == nullptr) {
+        return 0;
+    }
 
-    return udp_->Send(encrypted) > 0;
+    /* The batch takes one sequence number per frame, the header carries the first one */
+    size_t first = 0;
+    while (first < packets.size()) {
+        size_t count = BuildAudioBatch(packets, first, 0, MQTT_UDP_MAX_DATAGRAM_BYTES - AUDIO_PACKET_NONCE_SIZE);
+        if (!cipher_.Seal(MQTT_UDP_TYPE_AUDIO_BATCH, audio_batch_buffer_.data(), audio_batch_buffer_.size(),
+                packets[first]->timestamp, local_sequence_ + 1, send_datagram_)) {
+            ESP_LOGE(TAG, "Failed to encrypt audio data");
+            break;
+        }
+        if (udp_->Send(send_datagram_) <= 0) {
+            break;
+        }
+        local_sequence_ += count;
+        first += count;
+    }
+    /* The batches that did not go out stay with the caller */
+    packets.erase(packets.begin(), packets.begin() + first);
+    return first;
 }
 
 void MqttProtocol::CloseAudioChannel() {
@@ -196,7 +212,10 @@ void MqttProtocol::CloseAudioChannel() {
 }
 
 bool MqttProtocol::OpenAudioChannel() {
-    if (mqtt_ == nullptr || !mqtt_->IsConnected()) {
+    int64_t start_us = esp_timer_get_time();
+    // Usually the hello goes over the broker connection that is already up
+    bool handshake = mqtt_ == nullptr || !mqtt_->IsConnected();
+    if (handshake) {
         ESP_LOGI(TAG, "MQTT is not connected, try to connect now");
         if (!StartMqttClient(true)) {
             return false;
@@ -204,6 +223,7 @@ bool MqttProtocol::OpenAudioChannel() {
     }
 
     error_occurred_ = false;
+    audio_batch_frames_ = 1;
     session_id_ = "";
     xEventGroupClearBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 
@@ -228,48 +248,61 @@ bool MqttProtocol::OpenAudioChannel() {
          * UDP Encrypted OPUS Packet Format:
          * |type 1u|flags 1u|payload_len 2u|ssrc 4u|timestamp 4u|sequence 4u|
          * |payload payload_len|
+         * Type 0x02 carries an AudioBatchHeader payload, its frames are numbered from sequence on.
          */
-        if (data.size() < sizeof(aes_nonce_)) {
+        if (data.size() < AUDIO_PACKET_NONCE_SIZE) {
             ESP_LOGE(TAG, "Invalid audio packet size: %u", data.size());
             return;
         }
-        if (data[0] != 0x01) {
+        if (data[0] != MQTT_UDP_TYPE_AUDIO && data[0] != MQTT_UDP_TYPE_AUDIO_BATCH) {
             ESP_LOGE(TAG, "Invalid audio packet type: %x", data[0]);
             return;
         }
         uint32_t timestamp = ntohl(*(uint32_t*)&data[8]);
         uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
-        if (sequence < remote_sequence_) {
-            ESP_LOGW(TAG, "Received audio packet with old sequence: %lu, expected: %lu", sequence, remote_sequence_);
+        // Reordered packets are passed on, the jitter buffer puts them back in order until their playout time
+        if (!downlink_sequence_.Track(sequence)) {
+            ESP_LOGD(TAG, "Dropped duplicate audio packet: %lu", sequence);
             return;
         }
-        if (sequence != remote_sequence_ + 1) {
-            ESP_LOGW(TAG, "Received audio packet with wrong sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
-        }
 
-        size_t decrypted_size = data.size() - aes_nonce_.size();
-        size_t nc_off = 0;
-        uint8_t stream_block[16] = {0};
-        auto nonce = (uint8_t*)data.data();
-        auto encrypted = (uint8_t*)data.data() + aes_nonce_.size();
-        auto packet = std::make_unique<AudioStreamPacket>();
+        /* The audio is decrypted straight into a pooled packet, batches into a reused buffer */
+        size_t decrypted_size = data.size() - AUDIO_PACKET_NONCE_SIZE;
+        if (data[0] == MQTT_UDP_TYPE_AUDIO_BATCH) {
+            decrypt_buffer_.resize(decrypted_size);
+            if (!cipher_.Open(data, decrypt_buffer_.data())) {
+                ESP_LOGE(TAG, "Failed to decrypt audio data");
+                return;
+            }
+            // The frames of a batch take the sequence numbers from the one in the header on
+            if (decrypted_size >= sizeof(AudioBatchHeader)) {
+                auto frame_count = ((const AudioBatchHeader*)decrypt_buffer_.data())->frame_count;
+                for (int i = 1; i < frame_count; i++) {
+                    downlink_sequence_.Track(sequence + i);
+                }
+            }
+            ParseAudioBatch(decrypt_buffer_.data(), decrypted_size, sequence);
+            last_incoming_time_ = std::chrono::steady_clock::now();
+            return;
+        }
+        auto packet = AcquireIncomingPacket();
         packet->sample_rate = server_sample_rate_;
         packet->frame_duration = server_frame_duration_;
         packet->timestamp = timestamp;
+        packet->sequence = sequence;
         packet->payload.resize(decrypted_size);
-        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce, stream_block, encrypted, (uint8_t*)packet->payload.data());
-        if (ret != 0) {
-            ESP_LOGE(TAG, "Failed to decrypt audio data, ret: %d", ret);
+        if (!cipher_.Open(data, packet->payload.data())) {
+            ESP_LOGE(TAG, "Failed to decrypt audio data");
             return;
         }
         if (on_incoming_audio_ != nullptr) {
             on_incoming_audio_(std::move(packet));
         }
-        remote_sequence_ = sequence;
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
     udp_->Connect(udp_server_, udp_port_);
+    RecordChannelOpen(start_us, handshake);
 
     if (on_audio_channel_opened_ != nullptr) {
         on_audio_channel_opened_();
@@ -288,12 +321,17 @@ std::string MqttProtocol::GetHelloMessage() {
     cJSON_AddBoolToObject(features, "aec", true);
 #endif
     cJSON_AddBoolToObject(features, "mcp", true);
+    cJSON_AddNumberToObject(features, "audio_batch", AUDIO_BATCH_MAX_FRAMES);
     cJSON_AddItemToObject(root, "features", features);
     cJSON* audio_params = cJSON_CreateObject();
     cJSON_AddStringToObject(audio_params, "format", "opus");
     cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
     cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
+    auto uplink_params = Application::GetInstance().GetAudioService().GetUplinkAudioParams();
+    cJSON_AddNumberToObject(audio_params, "frame_duration", uplink_params.frame_duration);
+    cJSON_AddNumberToObject(audio_params, "frame_duration_max", UPLINK_MAX_FRAME_DURATION_MS);
+    cJSON_AddNumberToObject(audio_params, "bitrate", uplink_params.bitrate);
+    cJSON_AddBoolToObject(audio_params, "dtx", uplink_params.dtx);
     cJSON_AddItemToObject(root, "audio_params", audio_params);
     auto json_str = cJSON_PrintUnformatted(root);
     std::string message(json_str);
@@ -316,6 +354,7 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
     }
 
     // Get sample rate from hello message
+    uplink_frame_duration_max_ = 0;
     auto audio_params = cJSON_GetObjectItem(root, "audio_params");
     if (cJSON_IsObject(audio_params)) {
         auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
@@ -326,7 +365,13 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
         if (cJSON_IsNumber(frame_duration)) {
             server_frame_duration_ = frame_duration->valueint;
         }
+        // Uplink packets may be longer than frame_duration only if the server says so
+        auto uplink_frame_duration_max = cJSON_GetObjectItem(audio_params, "uplink_frame_duration_max");
+        if (cJSON_IsNumber(uplink_frame_duration_max)) {
+            uplink_frame_duration_max_ = uplink_frame_duration_max->valueint;
+        }
     }
+    ParseAudioBatchFeature(root);
 
     auto udp = cJSON_GetObjectItem(root, "udp");
     if (!cJSON_IsObject(udp)) {
@@ -340,11 +385,12 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
 
     // auto encryption = cJSON_GetObjectItem(udp, "encryption")->valuestring;
     // ESP_LOGI(TAG, "UDP server: %s, port: %d, encryption: %s", udp_server_.c_str(), udp_port_, encryption);
-    aes_nonce_ = DecodeHexString(nonce);
-    mbedtls_aes_init(&aes_ctx_);
-    mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)DecodeHexString(key).c_str(), 128);
+    if (!cipher_.SetKey(DecodeHexString(key), DecodeHexString(nonce))) {
+        ESP_LOGE(TAG, "Invalid UDP key or nonce");
+        return;
+    }
     local_sequence_ = 0;
-    remote_sequence_ = 0;
+    downlink_sequence_.Reset();
     xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 }
 
@@ -3,10 +3,10 @@
 
 
 #include "protocol.h"
+#include "audio_packet_cipher.h"
 #include <mqtt.h>
 #include <udp.h>
 #include <cJSON.h>
-#include <mbedtls/aes.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
 #include <esp_timer.h>
@@ -21,13 +21,20 @@
 
 #define MQTT_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
 
+// UDP packet types, the first byte of the nonce
+#define MQTT_UDP_TYPE_AUDIO 0x01
+#define MQTT_UDP_TYPE_AUDIO_BATCH BINARY_TYPE_AUDIO_BATCH
+// Batched datagrams stay below the path MTU, a lost fragment would lose the whole batch
+#define MQTT_UDP_MAX_DATAGRAM_BYTES 1200
+
 class MqttProtocol : public Protocol {
 public:
     MqttProtocol();
     ~MqttProtocol();
 
     bool Start() override;
-    bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) override;
+    bool SendAudio(AudioStreamPacketPtr packet) override;
+    size_t SendAudioBatch(std::vector<AudioStreamPacketPtr>& packets) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
@@ -40,12 +47,13 @@ private:
     std::mutex channel_mutex_;
     std::unique_ptr<Mqtt> mqtt_;
     std::unique_ptr<Udp> udp_;
-    mbedtls_aes_context aes_ctx_;
-    std::string aes_nonce_;
+    AudioPacketCipher cipher_;
+    // Reused by every datagram sent, the audio is encrypted straight into it
+    std::string send_datagram_;
     std::string udp_server_;
     int udp_port_;
     uint32_t local_sequence_;
-    uint32_t remote_sequence_;
+    std::vector<uint8_t> decrypt_buffer_;
     esp_timer_handle_t reconnect_timer_;
 
     bool StartMqttClient(bool report_error=false);
@@ -1,14 +1,148 @@
 #include "protocol.h"
+#include "application.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <cstring>
 
 #define TAG "Protocol"
 
+Protocol::Protocol() {
+}
+
+AudioStreamPacketPtr Protocol::AcquireIncomingPacket() {
+    return Application::GetInstance().GetAudioService().AcquireIncomingPacket();
+}
+
+uint8_t* Protocol::PrependHeader(AudioStreamPacket& packet, size_t header_size) {
+    /* Packets not encoded by AudioService (wake word audio) have no headroom, their audio is moved up */
+    if (packet.headroom < header_size) {
+        packet.payload.insert(packet.payload.begin(), header_size - packet.headroom, 0);
+        packet.headroom = header_size;
+    }
+    return packet.payload.data() + packet.headroom - header_size;
+}
+
+size_t Protocol::SendAudioBatch(std::vector<AudioStreamPacketPtr>& packets) {
+    size_t sent = 0;
+    size_t consumed = 0;
+    while (consumed < packets.size()) {
+        // SendAudio() takes the packet, it is gone even if the send fails
+        if (!SendAudio(std::move(packets[consumed++]))) {
+            break;
+        }
+        sent++;
+    }
+    packets.erase(packets.begin(), packets.begin() + consumed);
+    return sent;
+}
+
+void Protocol::RecordChannelOpen(int64_t start_us, bool handshake) {
+    uint32_t elapsed_ms = (esp_timer_get_time() - start_us) / 1000;
+    if (handshake) {
+        handshakes_++;
+        handshake_open_ms_ += elapsed_ms;
+    } else {
+        handshakes_avoided_++;
+        reused_open_ms_ += elapsed_ms;
+    }
+    ESP_LOGI(TAG, "Audio channel opened in %lu ms %s", (unsigned long)elapsed_ms,
+        handshake ? "with a new connection" : "over the open connection");
+}
+
+cJSON* Protocol::GetConnectionJson() const {
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "handshakes", handshakes_);
+    cJSON_AddNumberToObject(root, "handshake_open_ms", handshakes_ > 0 ? handshake_open_ms_ / handshakes_ : 0);
+    cJSON_AddNumberToObject(root, "handshakes_avoided", handshakes_avoided_);
+    cJSON_AddNumberToObject(root, "reused_open_ms", handshakes_avoided_ > 0 ? reused_open_ms_ / handshakes_avoided_ : 0);
+    return root;
+}
+
+void Protocol::ParseAudioBatchFeature(const cJSON* root) {
+    audio_batch_frames_ = 1;
+    auto features = cJSON_GetObjectItem(root, "features");
+    auto audio_batch = cJSON_GetObjectItem(features, "audio_batch");
+    if (cJSON_IsNumber(audio_batch)) {
+        audio_batch_frames_ = std::clamp(audio_batch->valueint, 1, AUDIO_BATCH_MAX_FRAMES);
+        ESP_LOGI(TAG, "Server accepts %d audio frames per message", audio_batch_frames_);
+    }
+}
+
+size_t Protocol::BuildAudioBatch(const std::vector<AudioStreamPacketPtr>& packets, size_t first, size_t header_size, size_t max_size) {
+    /* Take at least one frame, then as many more as the server accepts and fit */
+    size_t count = 0;
+    size_t size = header_size + sizeof(AudioBatchHeader);
+    size_t payload_size = 0;
+    while (first + count < packets.size() && count < (size_t)audio_batch_frames_) {
+        size_t frame_size = packets[first + count]->size();
+        if (count > 0 && size + sizeof(AudioBatchFrame) + frame_size > max_size) {
+            break;
+        }
+        size += sizeof(AudioBatchFrame) + frame_size;
+        payload_size += frame_size;
+        count++;
+    }
+
+    audio_batch_buffer_.resize(size);
+    auto header = (AudioBatchHeader*)(audio_batch_buffer_.data() + header_size);
+    header->frame_count = count;
+    header->reserved = 0;
+    header->payload_size = htons(payload_size);
+    auto table = (AudioBatchFrame*)(header + 1);
+    uint8_t* frames = (uint8_t*)(table + count);
+    for (size_t i = 0; i < count; i++) {
+        auto& packet = packets[first + i];
+        table[i].timestamp = htonl(packet->timestamp);
+        table[i].size = htons(packet->size());
+        memcpy(frames, packet->data(), packet->size());
+        frames += packet->size();
+    }
+    return count;
+}
+
+bool Protocol::ParseAudioBatch(const uint8_t* data, size_t size, uint32_t first_sequence) {
+    if (size < sizeof(AudioBatchHeader)) {
+        ESP_LOGE(TAG, "Invalid audio batch size: %u", (unsigned)size);
+        return false;
+    }
+    auto header = (const AudioBatchHeader*)data;
+    size_t table_size = header->frame_count * sizeof(AudioBatchFrame);
+    if (sizeof(AudioBatchHeader) + table_size + ntohs(header->payload_size) > size) {
+        ESP_LOGE(TAG, "Truncated audio batch of %u frames, size: %u", header->frame_count, (unsigned)size);
+        return false;
+    }
+
+    auto table = (const AudioBatchFrame*)(header + 1);
+    const uint8_t* frame = data + sizeof(AudioBatchHeader) + table_size;
+    const uint8_t* end = frame + ntohs(header->payload_size);
+    for (int i = 0; i < header->frame_count; i++) {
+        size_t frame_size = ntohs(table[i].size);
+        if (frame + frame_size > end) {
+            ESP_LOGE(TAG, "Audio batch frame %d overruns the payload", i);
+            return false;
+        }
+        auto packet = AcquireIncomingPacket();
+        packet->sample_rate = server_sample_rate_;
+        packet->frame_duration = server_frame_duration_;
+        packet->timestamp = ntohl(table[i].timestamp);
+        packet->sequence = first_sequence != 0 ? first_sequence + i : 0;
+        packet->payload.assign(frame, frame + frame_size);
+        frame += frame_size;
+        if (on_incoming_audio_ != nullptr) {
+            on_incoming_audio_(std::move(packet));
+        }
+    }
+    return true;
+}
+
 void Protocol::OnIncomingJson(std::function<void(const cJSON* root)> callback) {
     on_incoming_json_ = callback;
 }
 
-void Protocol::OnIncomingAudio(std::function<void(std::unique_ptr<AudioStreamPacket> packet)> callback) {
+void Protocol::OnIncomingAudio(std::function<void(AudioStreamPacketPtr packet)> callback) {
     on_incoming_audio_ = callback;
 }
 
@@ -7,13 +7,63 @@
 #include <chrono>
 #include <vector>
 
+#include "audio_frame_pool.h"
+#include "sequence_tracker.h"
+
+// Room kept in front of the uplink payload, enough for the largest transport header (BinaryProtocol2)
+#define AUDIO_PACKET_HEADROOM 16
+// Received packets come from a pool of AudioService, so the receive path does not allocate once the buffers have grown
+// A burst deeper than the pool, such as audio arriving faster than real time, takes packets from the heap, see GetFramePoolMisses()
+#define INCOMING_AUDIO_PACKET_POOL_SIZE 24
+#define INCOMING_AUDIO_PACKET_RESERVE_BYTES 256
+// Most frames in one batched audio message, advertised as features.audio_batch in the hello
+#define AUDIO_BATCH_MAX_FRAMES 4
+// Message type of a batched audio message in BinaryProtocol2/3 and the UDP packet header
+#define BINARY_TYPE_AUDIO_BATCH 2
+
 struct AudioStreamPacket {
     int sample_rate = 0;
     int frame_duration = 0;
     uint32_t timestamp = 0;
+    uint32_t sequence = 0;  // 0 if the transport does not number its packets
     std::vector<uint8_t> payload;
+    // Bytes at the start of payload left free for the transport header, the encoded audio follows them
+    uint16_t headroom = 0;
+    // Payload owned elsewhere that outlives the packet (e.g. flash-mapped sounds), used instead of payload when set
+    const uint8_t* payload_view = nullptr;
+    size_t payload_view_size = 0;
+    // The view holds 16-bit PCM at the codec output rate (cached sounds), it skips the decoder
+    bool pcm = false;
+    // AudioMixerChannel a sound is played on, 0 for the server audio
+    uint8_t mixer_channel = 0;
+    // Decoded samples to drop from the start and the end, for Ogg pre-skip and end trimming
+    uint16_t trim_start = 0;
+    uint16_t trim_end = 0;
+    // esp_timer time the audio was captured (uplink) or received (downlink), for latency tracing
+    int64_t trace_time_us = 0;
+
+    const uint8_t* data() const { return payload.data() + headroom; }
+    size_t size() const { return payload.size() - headroom; }
+
+    // Clears the packet for reuse, the payload keeps its capacity
+    void Reset() {
+        payload.clear();
+        headroom = 0;
+        timestamp = 0;
+        sequence = 0;
+        payload_view = nullptr;
+        payload_view_size = 0;
+        pcm = false;
+        mixer_channel = 0;
+        trim_start = 0;
+        trim_end = 0;
+        trace_time_us = 0;
+    }
 };
 
+// Packets from an AudioFramePool go back to the pool when released, std::make_unique packets are deleted
+using AudioStreamPacketPtr = AudioFramePool<AudioStreamPacket>::Ptr;
+
 struct BinaryProtocol2 {
     uint16_t version;
     uint16_t type;          // Message type (0: OPUS, 1: JSON)
@@ -30,6 +80,21 @@ struct BinaryProtocol3 {
     uint8_t payload[];
 } __attribute__((packed));
 
+/*
+ * Payload of a batched audio message, once the server accepted features.audio_batch:
+ * |frame_count 1u|reserved 1u|payload_size 2u|frame_count x (timestamp 4u|size 2u)|frames payload_size|
+ */
+struct AudioBatchHeader {
+    uint8_t frame_count;
+    uint8_t reserved;
+    uint16_t payload_size;  // Bytes of the frames after the table
+} __attribute__((packed));
+
+struct AudioBatchFrame {
+    uint32_t timestamp;
+    uint16_t size;
+} __attribute__((packed));
+
 enum AbortReason {
     kAbortReasonNone,
     kAbortReasonWakeWordDetected
@@ -43,6 +108,7 @@ enum ListeningMode {
 
 class Protocol {
 public:
+    Protocol();
     virtual ~Protocol() = default;
 
     inline int server_sample_rate() const {
@@ -51,11 +117,25 @@ public:
     inline int server_frame_duration() const {
         return server_frame_duration_;
     }
+    // Longest uplink packet the server accepts, 0 if it did not say
+    inline int uplink_frame_duration_max() const {
+        return uplink_frame_duration_max_;
+    }
+    // Frames per audio message the server accepted, 1 if it does not take batches
+    inline int audio_batch_frames() const {
+        return audio_batch_frames_;
+    }
+    // Loss, reorder and duplicate counts of the numbered incoming audio, zero if the transport does not number it
+    inline const SequenceTracker& downlink_sequence() const {
+        return downlink_sequence_;
+    }
     inline const std::string& session_id() const {
         return session_id_;
     }
+    // Channels opened over a new connection and over one already open, with the average time each took
+    cJSON* GetConnectionJson() const;
 
-    void OnIncomingAudio(std::function<void(std::unique_ptr<AudioStreamPacket> packet)> callback);
+    void OnIncomingAudio(std::function<void(AudioStreamPacketPtr packet)> callback);
     void OnIncomingJson(std::function<void(const cJSON* root)> callback);
     void OnAudioChannelOpened(std::function<void()> callback);
     void OnAudioChannelClosed(std::function<void()> callback);
@@ -67,7 +147,13 @@ public:
     virtual bool OpenAudioChannel() = 0;
     virtual void CloseAudioChannel() = 0;
     virtual bool IsAudioChannelOpened() const = 0;
-    virtual bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) = 0;
+    // Drops a connection kept open between sessions, before a firmware upgrade for example
+    virtual void ReleaseIdleConnection() {}
+    virtual bool SendAudio(AudioStreamPacketPtr packet) = 0;
+    // Sends the packets in as few batched messages as possible, one by one if the server takes no batches.
+    // Returns how many went out. They are removed from packets, together with a single packet lost in a
+    // failed SendAudio(), and the packets left are kept by the caller for the next attempt.
+    virtual size_t SendAudioBatch(std::vector<AudioStreamPacketPtr>& packets);
     virtual void SendWakeWordDetected(const std::string& wake_word);
     virtual void SendStartListening(ListeningMode mode);
     virtual void SendStopListening();
@@ -76,7 +162,7 @@ public:
 
 protected:
     std::function<void(const cJSON* root)> on_incoming_json_;
-    std::function<void(std::unique_ptr<AudioStreamPacket> packet)> on_incoming_audio_;
+    std::function<void(AudioStreamPacketPtr packet)> on_incoming_audio_;
     std::function<void()> on_audio_channel_opened_;
     std::function<void()> on_audio_channel_closed_;
     std::function<void(const std::string& message)> on_network_error_;
@@ -85,10 +171,30 @@ protected:
 
     int server_sample_rate_ = 24000;
     int server_frame_duration_ = 60;
+    int uplink_frame_duration_max_ = 0;
     bool error_occurred_ = false;
     std::string session_id_;
     std::chrono::time_point<std::chrono::steady_clock> last_incoming_time_;
+    int audio_batch_frames_ = 1;
+    SequenceTracker downlink_sequence_;
+    uint32_t handshakes_ = 0;
+    uint32_t handshakes_avoided_ = 0;
+    uint64_t handshake_open_ms_ = 0;        // Sum of the open times with a new connection
+    uint64_t reused_open_ms_ = 0;           // Sum of the open times over an open connection
+    std::vector<uint8_t> audio_batch_buffer_;
 
+    // Pooled packet for received audio, see AudioService::AcquireIncomingPacket()
+    AudioStreamPacketPtr AcquireIncomingPacket();
+    // Returns where the header of header_size bytes goes, right in front of the audio of the packet
+    uint8_t* PrependHeader(AudioStreamPacket& packet, size_t header_size);
+    void ParseAudioBatchFeature(const cJSON* root);
+    // Counts a successful OpenAudioChannel() that started at start_us
+    void RecordChannelOpen(int64_t start_us, bool handshake);
+    // Writes packets from first on as a batch into audio_batch_buffer_ after header_size free bytes,
+    // as many as the server accepts and fit in max_size, returns how many were written
+    size_t BuildAudioBatch(const std::vector<AudioStreamPacketPtr>& packets, size_t first, size_t header_size, size_t max_size);
+    // Passes the frames of a received batch on, numbered from first_sequence unless it is 0
+    bool ParseAudioBatch(const uint8_t* data, size_t size, uint32_t first_sequence);
     virtual bool SendText(const std::string& text) = 0;
     virtual void SetError(const std::string& message);
     virtual bool IsTimeout() const;
@@ -0,0 +1,66 @@
+#include "sequence_tracker.h"
+
+#include <esp_log.h>
+
+#define TAG "SequenceTracker"
+
+
+bool SequenceTracker::Track(uint32_t sequence) {
+    int32_t distance = static_cast<int32_t>(sequence - newest_);
+    if (started_ && (distance > SEQUENCE_TRACKER_RESTART_DISTANCE || distance < -SEQUENCE_TRACKER_RESTART_DISTANCE)) {
+        ESP_LOGW(TAG, "Sequence jumped from %lu to %lu, restarting", (unsigned long)newest_, (unsigned long)sequence);
+        started_ = false;
+    }
+    if (!started_) {
+        started_ = true;
+        newest_ = sequence;
+        seen_ = 1;
+        expected_.fetch_add(1, std::memory_order_relaxed);
+        received_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    if (distance > 0) {
+        seen_ = distance >= (int32_t)SEQUENCE_TRACKER_WINDOW ? 1 : (seen_ << distance) | 1;
+        newest_ = sequence;
+        expected_.fetch_add(distance, std::memory_order_relaxed);
+    } else if (-distance < (int32_t)SEQUENCE_TRACKER_WINDOW) {
+        uint64_t bit = 1ULL << -distance;
+        if (seen_ & bit) {
+            duplicates_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        seen_ |= bit;
+        reordered_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        // Too old to tell a duplicate, the jitter buffer drops it if it is late
+        reordered_.fetch_add(1, std::memory_order_relaxed);
+    }
+    received_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void SequenceTracker::Reset() {
+    started_ = false;
+    newest_ = 0;
+    seen_ = 0;
+    expected_ = 0;
+    received_ = 0;
+    reordered_ = 0;
+    duplicates_ = 0;
+}
+
+uint32_t SequenceTracker::lost() const {
+    uint32_t expected = expected_.load(std::memory_order_relaxed);
+    uint32_t received = received_.load(std::memory_order_relaxed);
+    return expected > received ? expected - received : 0;
+}
+
+cJSON* SequenceTracker::GetJson() const {
+    auto root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "received", received());
+    cJSON_AddNumberToObject(root, "lost", lost());
+    cJSON_AddNumberToObject(root, "reordered", reordered());
+    cJSON_AddNumberToObject(root, "duplicate", duplicates());
+    return root;
+}
@@ -0,0 +1,47 @@
+#ifndef SEQUENCE_TRACKER_H
+#define SEQUENCE_TRACKER_H
+
+#include <atomic>
+#include <cstdint>
+#include <cJSON.h>
+
+// A jump this far from the newest sequence number means the sender started over
+#define SEQUENCE_TRACKER_RESTART_DISTANCE 1024
+
+/*
+ * Counts loss, reordering and duplicates of a numbered packet stream, and tells duplicates apart.
+ *
+ * The packets seen among the SEQUENCE_TRACKER_WINDOW newest sequence numbers are kept in a
+ * bitmap. A packet behind the newest one is reordered if it was not seen yet and a duplicate
+ * otherwise, older packets are counted as reordered. Loss is the count of sequence numbers up
+ * to the newest one that never arrived, late arrivals make up for it. Packets are put back in
+ * order by the jitter buffer, which holds them until their playout time.
+ *
+ * Track() is called by the receiving task, the statistics may be read from any task.
+ */
+class SequenceTracker {
+public:
+    static constexpr uint32_t SEQUENCE_TRACKER_WINDOW = 64;
+
+    // Returns false for a duplicate, which should be dropped
+    bool Track(uint32_t sequence);
+    void Reset();
+
+    uint32_t received() const { return received_.load(std::memory_order_relaxed); }
+    uint32_t lost() const;
+    uint32_t reordered() const { return reordered_.load(std::memory_order_relaxed); }
+    uint32_t duplicates() const { return duplicates_.load(std::memory_order_relaxed); }
+    // {"received", "lost", "reordered", "duplicate"}
+    cJSON* GetJson() const;
+
+private:
+    bool started_ = false;
+    uint32_t newest_ = 0;
+    uint64_t seen_ = 0;     // Bit i is set if newest_ - i arrived
+    std::atomic<uint32_t> expected_{0};
+    std::atomic<uint32_t> received_{0};
+    std::atomic<uint32_t> reordered_{0};
+    std::atomic<uint32_t> duplicates_{0};
+};
+
+#endif // SEQUENCE_TRACKER_H
@@ -14,9 +14,30 @@
 
 WebsocketProtocol::WebsocketProtocol() {
     event_group_handle_ = xEventGroupCreate();
+
+#if CONFIG_WEBSOCKET_IDLE_KEEPALIVE_SEC > 0
+    esp_timer_create_args_t keep_alive_timer_args = {
+        .callback = [](void* arg) {
+            // The socket is only used from the main loop
+            auto protocol = (WebsocketProtocol*)arg;
+            Application::GetInstance().Schedule([protocol]() {
+                protocol->KeepIdleConnectionAlive();
+            });
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "ws_keep_alive",
+        .skip_unhandled_events = true
+    };
+    esp_timer_create(&keep_alive_timer_args, &keep_alive_timer_);
+#endif
 }
 
 WebsocketProtocol::~WebsocketProtocol() {
+    if (keep_alive_timer_ != nullptr) {
+        esp_timer_stop(keep_alive_timer_);
+        esp_timer_delete(keep_alive_timer_);
+    }
     vEventGroupDelete(event_group_handle_);
 }
 
@@ -25,36 +46,68 @@ bool WebsocketProtocol::Start() {
     return true;
 }
 
-bool WebsocketProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
-    if (websocket_ == nullptr || !websocket_->IsConnected()) {
+bool WebsocketProtocol::SendAudio(AudioStreamPacketPtr packet) {
+    // After the goodbye the connection may still be open, but no session takes the audio
+    if (websocket_ == nullptr || !websocket_->IsConnected() || !channel_opened_) {
         return false;
     }
 
+    /* The header goes into the headroom in front of the audio, the frame is sent from the packet buffer */
+    size_t payload_size = packet->size();
     if (version_ == 2) {
-        std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol2) + packet->payload.size());
-        auto bp2 = (BinaryProtocol2*)serialized.data();
+        auto bp2 = (BinaryProtocol2*)PrependHeader(*packet, sizeof(BinaryProtocol2));
         bp2->version = htons(version_);
         bp2->type = 0;
         bp2->reserved = 0;
         bp2->timestamp = htonl(packet->timestamp);
-        bp2->payload_size = htonl(packet->payload.size());
-        memcpy(bp2->payload, packet->payload.data(), packet->payload.size());
-
-        return websocket_->Send(serialized.data(), serialized.size(), true);
+        bp2->payload_size = htonl(payload_size);
+        return websocket_->Send(bp2, sizeof(BinaryProtocol2) + payload_size, true);
     } else if (version_ == 3) {
-        std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol3) + packet->payload.size());
-        auto bp3 = (BinaryProtocol3*)serialized.data();
+        auto bp3 = (BinaryProtocol3*)PrependHeader(*packet, sizeof(BinaryProtocol3));
         bp3->type = 0;
         bp3->reserved = 0;
-        bp3->payload_size = htons(packet->payload.size());
-        memcpy(bp3->payload, packet->payload.data(), packet->payload.size());
-
-        return websocket_->Send(serialized.data(), serialized.size(), true);
+        bp3->payload_size = htons(payload_size);
+        return websocket_->Send(bp3, sizeof(BinaryProtocol3) + payload_size, true);
     } else {
-        return websocket_->Send(packet->payload.data(), packet->payload.size(), true);
+        return websocket_->Send(packet->data(), payload_size, true);
+    }
+}
+
+size_t WebsocketProtocol::SendAudioBatch(std::vector<AudioStreamPacketPtr>& packets) {
+    if (audio_batch_frames_ <= 1) {
+        return Protocol::SendAudioBatch(packets);
     }
+    if (websocket_ == nullptr || !websocket_->IsConnected() || !channel_opened_) {
+        return 0;
+    }
+
+    /* The server only accepts batches on version 2 and 3, which have a message type */
+    size_t header_size = version_ == 2 ? sizeof(BinaryProtocol2) : sizeof(BinaryProtocol3);
+    size_t first = 0;
+    while (first < packets.size()) {
+        size_t count = BuildAudioBatch(packets, first, header_size, header_size + UINT16_MAX);
+        size_t payload_size = audio_batch_buffer_.size() - header_size;
+        if (version_ == 2) {
+            auto bp2 = (BinaryProtocol2*)audio_batch_buffer_.data();
+            bp2->version = htons(version_);
+            bp2->type = htons(BINARY_TYPE_AUDIO_BATCH);
+            bp2->reserved = 0;
+            bp2->timestamp = htonl(packets[first]->timestamp);
+            bp2->payload_size = htonl(payload_size);
+        } else {
+            auto bp3 = (BinaryProtocol3*)audio_batch_buffer_.data();
+            bp3->type = BINARY_TYPE_AUDIO_BATCH;
+            bp3->reserved = 0;
+            bp3->payload_size = htons(payload_size);
+        }
+        if (!websocket_->Send(audio_batch_buffer_.data(), audio_batch_buffer_.size(), true)) {
+            break;
+        }
+        first += count;
+    }
+    /* The batches that did not go out stay with the caller */
+    packets.erase(packets.begin(), packets.begin() + first);
+    return first;
 }
 
 bool WebsocketProtocol::SendText(const std::string& text) {
@@ -72,14 +125,76 @@ bool WebsocketProtocol::SendText(const std::string& text) {
 }
 
 bool WebsocketProtocol::IsAudioChannelOpened() const {
-    return websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_ && !IsTimeout();
+    return websocket_ != nullptr && websocket_->IsConnected() && channel_opened_ && !error_occurred_ && !IsTimeout();
 }
 
 void WebsocketProtocol::CloseAudioChannel() {
+#if CONFIG_WEBSOCKET_IDLE_KEEPALIVE_SEC > 0
+    /* Only the session ends, the authenticated connection waits for the next one, if the server agreed to it */
+    if (websocket_ != nullptr && websocket_->IsConnected() && channel_opened_ && !error_occurred_ && session_reuse_) {
+        channel_opened_ = false;
+        websocket_->Send("{\"session_id\":\"" + session_id_ + "\",\"type\":\"goodbye\"}");
+        idle_since_us_ = esp_timer_get_time();
+        esp_timer_start_periodic(keep_alive_timer_, WEBSOCKET_IDLE_PING_INTERVAL_MS * 1000);
+        ESP_LOGI(TAG, "Session closed, keeping the connection for %d seconds", CONFIG_WEBSOCKET_IDLE_KEEPALIVE_SEC);
+        if (on_audio_channel_closed_ != nullptr) {
+            on_audio_channel_closed_();
+        }
+        return;
+    }
+#endif
     websocket_.reset();
 }
 
+void WebsocketProtocol::ReleaseIdleConnection() {
+    if (websocket_ != nullptr && !channel_opened_) {
+        ESP_LOGI(TAG, "Closing the idle connection");
+        if (keep_alive_timer_ != nullptr) {
+            esp_timer_stop(keep_alive_timer_);
+        }
+        websocket_.reset();
+    }
+}
+
+void WebsocketProtocol::KeepIdleConnectionAlive() {
+    if (websocket_ == nullptr || channel_opened_) {
+        esp_timer_stop(keep_alive_timer_);
+        return;
+    }
+    if (!websocket_->IsConnected()) {
+        ESP_LOGI(TAG, "The server closed the idle connection");
+        esp_timer_stop(keep_alive_timer_);
+        websocket_.reset();
+        return;
+    }
+    if (esp_timer_get_time() - idle_since_us_ >= CONFIG_WEBSOCKET_IDLE_KEEPALIVE_SEC * 1000000LL) {
+        ReleaseIdleConnection();
+        return;
+    }
+    // A dead connection fails the ping, a silent one fails the next hello
+    websocket_->Ping();
+}
+
+bool WebsocketProtocol::SendHello(int timeout_ms) {
+    xEventGroupClearBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
+    channel_opened_ = true;
+    // Send hello message to describe the client
+    if (!websocket_->Send(GetHelloMessage())) {
+        ESP_LOGE(TAG, "Failed to send hello");
+        return false;
+    }
+
+    // Wait for server hello
+    EventBits_t bits = xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(timeout_ms));
+    if (!(bits & WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT)) {
+        ESP_LOGE(TAG, "Failed to receive server hello");
+        return false;
+    }
+    return true;
+}
+
 bool WebsocketProtocol::OpenAudioChannel() {
+    int64_t start_us = esp_timer_get_time();
     Settings settings("websocket", false);
     std::string url = settings.GetString("url");
     std::string token = settings.GetString("token");
@@ -89,6 +204,26 @@ bool WebsocketProtocol::OpenAudioChannel() {
     }
 
     error_occurred_ = false;
+    audio_batch_frames_ = 1;
+
+    /* A connection kept from the last session only needs a new hello */
+    if (keep_alive_timer_ != nullptr) {
+        esp_timer_stop(keep_alive_timer_);
+    }
+    if (websocket_ != nullptr && websocket_->IsConnected() && !channel_opened_ &&
+        url == connected_url_ && version_ == connected_version_) {
+        ESP_LOGI(TAG, "Reusing the connection, idle for %lld ms", (esp_timer_get_time() - idle_since_us_) / 1000);
+        if (SendHello(WEBSOCKET_REUSE_HELLO_TIMEOUT_MS)) {
+            RecordChannelOpen(start_us, false);
+            if (on_audio_channel_opened_ != nullptr) {
+                on_audio_channel_opened_();
+            }
+            return true;
+        }
+        ESP_LOGW(TAG, "The idle connection did not answer, connecting again");
+    }
+    channel_opened_ = false;
+    websocket_.reset();
 
     auto network = Board::GetInstance().GetNetwork();
     websocket_ = network->CreateWebSocket(1);
@@ -110,39 +245,44 @@ bool WebsocketProtocol::OpenAudioChannel() {
 
     websocket_->OnData([this](const char* data, size_t len, bool binary) {
         if (binary) {
-            if (on_incoming_audio_ != nullptr) {
+            // Whatever the server still sends after the goodbye is not for the next session
+            if (on_incoming_audio_ != nullptr && channel_opened_) {
+                /* The audio is copied once out of the receive buffer, into a pooled packet that keeps its capacity */
+                auto packet = AcquireIncomingPacket();
+                packet->sample_rate = server_sample_rate_;
+                packet->frame_duration = server_frame_duration_;
                 if (version_ == 2) {
-                    BinaryProtocol2* bp2 = (BinaryProtocol2*)data;
-                    bp2->version = ntohs(bp2->version);
-                    bp2->type = ntohs(bp2->type);
-                    bp2->timestamp = ntohl(bp2->timestamp);
-                    bp2->payload_size = ntohl(bp2->payload_size);
-                    auto payload = (uint8_t*)bp2->payload;
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = bp2->timestamp,
-                        .payload = std::vector<uint8_t>(payload, payload + bp2->payload_size)
-                    }));
+                    auto bp2 = (const BinaryProtocol2*)data;
+                    auto payload = (const uint8_t*)bp2->payload;
+                    /* The size in the header is checked against what was received, a bad frame is dropped */
+                    if (len < sizeof(BinaryProtocol2) || ntohl(bp2->payload_size) > len - sizeof(BinaryProtocol2)) {
+                        ESP_LOGE(TAG, "Invalid binary frame of %u bytes", (unsigned)len);
+                        return;
+                    }
+                    if (ntohs(bp2->type) == BINARY_TYPE_AUDIO_BATCH) {
+                        ParseAudioBatch(payload, ntohl(bp2->payload_size), 0);
+                        last_incoming_time_ = std::chrono::steady_clock::now();
+                        return;
+                    }
+                    packet->timestamp = ntohl(bp2->timestamp);
+                    packet->payload.assign(payload, payload + ntohl(bp2->payload_size));
                 } else if (version_ == 3) {
-                    BinaryProtocol3* bp3 = (BinaryProtocol3*)data;
-                    bp3->type = bp3->type;
-                    bp3->payload_size = ntohs(bp3->payload_size);
-                    auto payload = (uint8_t*)bp3->payload;
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = 0,
-                        .payload = std::vector<uint8_t>(payload, payload + bp3->payload_size)
-                    }));
+                    auto bp3 = (const BinaryProtocol3*)data;
+                    auto payload = (const uint8_t*)bp3->payload;
+                    if (len < sizeof(BinaryProtocol3) || ntohs(bp3->payload_size) > len - sizeof(BinaryProtocol3)) {
+                        ESP_LOGE(TAG, "Invalid binary frame of %u bytes", (unsigned)len);
+                        return;
+                    }
+                    if (bp3->type == BINARY_TYPE_AUDIO_BATCH) {
+                        ParseAudioBatch(payload, ntohs(bp3->payload_size), 0);
+                        last_incoming_time_ = std::chrono::steady_clock::now();
+                        return;
+                    }
+                    packet->payload.assign(payload, payload + ntohs(bp3->payload_size));
                 } else {
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = 0,
-                        .payload = std::vector<uint8_t>((uint8_t*)data, (uint8_t*)data + len)
-                    }));
+                    packet->payload.assign((const uint8_t*)data, (const uint8_t*)data + len);
                 }
+                on_incoming_audio_(std::move(packet));
             }
         } else {
             // Parse JSON data
@@ -151,7 +291,7 @@ bool WebsocketProtocol::OpenAudioChannel() {
             if (cJSON_IsString(type)) {
                 if (strcmp(type->valuestring, "hello") == 0) {
                     ParseServerHello(root);
-                } else {
+                } else if (channel_opened_) {
                     if (on_incoming_json_ != nullptr) {
                         on_incoming_json_(root);
                     }
@@ -166,7 +306,8 @@ bool WebsocketProtocol::OpenAudioChannel() {
 
     websocket_->OnDisconnected([this]() {
         ESP_LOGI(TAG, "Websocket disconnected");
-        if (on_audio_channel_closed_ != nullptr) {
+        // The session of an idle connection was already closed
+        if (channel_opened_ && on_audio_channel_closed_ != nullptr) {
             on_audio_channel_closed_();
         }
     });
@@ -177,20 +318,15 @@ bool WebsocketProtocol::OpenAudioChannel() {
         SetError(Lang::Strings::SERVER_NOT_CONNECTED);
         return false;
     }
+    ESP_LOGI(TAG, "Connected in %lld ms", (esp_timer_get_time() - start_us) / 1000);
+    connected_url_ = url;
+    connected_version_ = version_;
 
-    // Send hello message to describe the client
-    auto message = GetHelloMessage();
-    if (!SendText(message)) {
-        return false;
-    }
-
-    // Wait for server hello
-    EventBits_t bits = xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(10000));
-    if (!(bits & WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT)) {
-        ESP_LOGE(TAG, "Failed to receive server hello");
+    if (!SendHello(WEBSOCKET_SERVER_HELLO_TIMEOUT_MS)) {
         SetError(Lang::Strings::SERVER_TIMEOUT);
         return false;
     }
+    RecordChannelOpen(start_us, true);
 
     if (on_audio_channel_opened_ != nullptr) {
         on_audio_channel_opened_();
@@ -200,7 +336,7 @@ bool WebsocketProtocol::OpenAudioChannel() {
 }
 
 std::string WebsocketProtocol::GetHelloMessage() {
-    // keys: message type, version, audio_params (format, sample_rate, channels)
+    // keys: message type, version, audio_params (format, sample_rate, channels, frame_duration, frame_duration_max, bitrate, dtx)
     cJSON* root = cJSON_CreateObject();
     cJSON_AddStringToObject(root, "type", "hello");
     cJSON_AddNumberToObject(root, "version", version_);
@@ -209,13 +345,25 @@ std::string WebsocketProtocol::GetHelloMessage() {
     cJSON_AddBoolToObject(features, "aec", true);
 #endif
     cJSON_AddBoolToObject(features, "mcp", true);
+    // Batched audio messages need the message type of version 2 and 3
+    if (version_ >= 2) {
+        cJSON_AddNumberToObject(features, "audio_batch", AUDIO_BATCH_MAX_FRAMES);
+    }
+#if CONFIG_WEBSOCKET_IDLE_KEEPALIVE_SEC > 0
+    // The connection is kept after a goodbye only if the server echoes this
+    cJSON_AddBoolToObject(features, "session_reuse", true);
+#endif
     cJSON_AddItemToObject(root, "features", features);
     cJSON_AddStringToObject(root, "transport", "websocket");
     cJSON* audio_params = cJSON_CreateObject();
     cJSON_AddStringToObject(audio_params, "format", "opus");
     cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
     cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
+    auto uplink_params = Application::GetInstance().GetAudioService().GetUplinkAudioParams();
+    cJSON_AddNumberToObject(audio_params, "frame_duration", uplink_params.frame_duration);
+    cJSON_AddNumberToObject(audio_params, "frame_duration_max", UPLINK_MAX_FRAME_DURATION_MS);
+    cJSON_AddNumberToObject(audio_params, "bitrate", uplink_params.bitrate);
+    cJSON_AddBoolToObject(audio_params, "dtx", uplink_params.dtx);
     cJSON_AddItemToObject(root, "audio_params", audio_params);
     auto json_str = cJSON_PrintUnformatted(root);
     std::string message(json_str);
@@ -237,6 +385,7 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
         ESP_LOGI(TAG, "Session ID: %s", session_id_.c_str());
     }
 
+    uplink_frame_duration_max_ = 0;
     auto audio_params = cJSON_GetObjectItem(root, "audio_params");
     if (cJSON_IsObject(audio_params)) {
         auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
@@ -247,7 +396,19 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
         if (cJSON_IsNumber(frame_duration)) {
             server_frame_duration_ = frame_duration->valueint;
         }
+        // Uplink packets may be longer than frame_duration only if the server says so
+        auto uplink_frame_duration_max = cJSON_GetObjectItem(audio_params, "uplink_frame_duration_max");
+        if (cJSON_IsNumber(uplink_frame_duration_max)) {
+            uplink_frame_duration_max_ = uplink_frame_duration_max->valueint;
+        }
     }
+    ParseAudioBatchFeature(root);
+    if (version_ < 2) {
+        audio_batch_frames_ = 1;
+    }
+
+    auto features = cJSON_GetObjectItem(root, "features");
+    session_reuse_ = cJSON_IsTrue(cJSON_GetObjectItem(features, "session_reuse"));
 
     xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
 }
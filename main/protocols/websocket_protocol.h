@@ -7,8 +7,14 @@
 #include <web_socket.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
+#include <esp_timer.h>
+#include <atomic>
 
 #define WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
+#define WEBSOCKET_SERVER_HELLO_TIMEOUT_MS 10000
+// A connection kept open between sessions has to answer the hello quickly, or a new one is made
+#define WEBSOCKET_REUSE_HELLO_TIMEOUT_MS 3000
+#define WEBSOCKET_IDLE_PING_INTERVAL_MS 15000
 
 class WebsocketProtocol : public Protocol {
 public:
@@ -16,19 +22,30 @@ public:
     ~WebsocketProtocol();
 
     bool Start() override;
-    bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) override;
+    bool SendAudio(AudioStreamPacketPtr packet) override;
+    size_t SendAudioBatch(std::vector<AudioStreamPacketPtr>& packets) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
+    void ReleaseIdleConnection() override;
 
 private:
     EventGroupHandle_t event_group_handle_;
     std::unique_ptr<WebSocket> websocket_;
     int version_ = 1;
+    // Cleared when a session ends, the connection may stay open for the next one
+    std::atomic<bool> channel_opened_{false};
+    std::string connected_url_;
+    int connected_version_ = 0;
+    bool session_reuse_ = false;        // The server hello accepted a new hello after a goodbye
+    int64_t idle_since_us_ = 0;
+    esp_timer_handle_t keep_alive_timer_ = nullptr;
 
     void ParseServerHello(const cJSON* root);
     bool SendText(const std::string& text) override;
     std::string GetHelloMessage();
+    bool SendHello(int timeout_ms);
+    void KeepIdleConnectionAlive();
 };
 
 #endif
@@ -1,4 +1,5 @@
 import sys
+import struct
 import numpy as np
 import asyncio
 import wave
@@ -19,6 +20,10 @@ from PyQt6.QtCore import QTimer
 # 导入解码器
 from demod import RealTimeAFSKDecoder
 
+# AudioDebugger 数据报头: magic, sequence, sample_index, dropped_samples, timestamp_us
+AUDIO_DEBUG_HEADER = struct.Struct('<IIIIq')
+AUDIO_DEBUG_MAGIC = 0x47424441
+
 
 class UDPServerProtocol(asyncio.DatagramProtocol):
     """UDP服务器协议类"""
@@ -37,7 +42,9 @@ class UDPServerProtocol(asyncio.DatagramProtocol):
         
         # 只处理来自已记录客户端的数据
         if addr == self.client_address:
-            # 将接收到的音频数据添加到队列
+            # 去掉数据报头，将音频数据添加到队列
+            if len(data) >= AUDIO_DEBUG_HEADER.size and AUDIO_DEBUG_HEADER.unpack_from(data)[0] == AUDIO_DEBUG_MAGIC:
+                data = data[AUDIO_DEBUG_HEADER.size:]
             self.data_queue.extend(data)
         else:
             print(f"忽略来自未知地址 {addr} 的数据")
@@ -1,17 +1,81 @@
 import socket
+import struct
 import wave
 import argparse
 
 
 '''
   Create a UDP socket and bind it to the server's IP:8000.
-  Listen for incoming messages and print them to the console.
-  Save the audio to a WAV file.
+  Receive the batched audio datagrams of AudioDebugger, put them back in order and report losses.
+  Save the audio to a WAV file, lost samples are filled with silence.
+
+  Each datagram starts with a little-endian header:
+    uint32 magic ("ADBG"), uint32 sequence, uint32 sample_index, uint32 dropped_samples, int64 timestamp_us
+  followed by the interleaved 16-bit samples of one or more frames.
 '''
-def main(samplerate, channels):
+HEADER = struct.Struct('<IIIIq')
+MAGIC = 0x47424441
+# Datagrams may arrive out of order, they are held until this many newer ones arrived
+REORDER_WINDOW = 8
+
+
+class Stream:
+    def __init__(self, wav_file):
+        self.wav_file = wav_file
+        self.pending = {}
+        self.next_sequence = None
+        self.next_sample = None
+        self.received = 0
+        self.lost_datagrams = 0
+        self.late_datagrams = 0
+        self.lost_samples = 0
+        self.device_dropped = 0
+
+    def push(self, sequence, sample_index, dropped_samples, timestamp_us, samples):
+        self.received += 1
+        self.device_dropped = dropped_samples
+        if self.next_sequence is None:
+            self.next_sequence = sequence
+            self.next_sample = sample_index
+        if (sequence - self.next_sequence) & 0xffffffff >= 0x80000000:
+            self.late_datagrams += 1
+            return
+        self.pending[sequence] = (sample_index, timestamp_us, samples)
+        while self.pending:
+            if self.next_sequence in self.pending:
+                self.write(*self.pending.pop(self.next_sequence))
+            elif len(self.pending) > REORDER_WINDOW:
+                self.lost_datagrams += 1
+            else:
+                break
+            self.next_sequence = (self.next_sequence + 1) & 0xffffffff
+
+    def write(self, sample_index, timestamp_us, samples):
+        gap = (sample_index - self.next_sample) & 0xffffffff
+        if gap >= 0x80000000:
+            return
+        if gap > 0:
+            # Lost on the network or dropped on the device, keep the timeline with silence
+            self.lost_samples += gap
+            print(f"Lost {gap} samples before {sample_index} (t={timestamp_us / 1e6:.3f}s)")
+            self.wav_file.writeframes(bytes(gap * 2))
+        self.wav_file.writeframes(samples)
+        self.next_sample = (sample_index + len(samples) // 2) & 0xffffffff
+
+    def flush(self):
+        for sequence in sorted(self.pending, key=lambda s: (s - self.next_sequence) & 0xffffffff):
+            self.write(*self.pending[sequence])
+        self.pending.clear()
+
+    def report(self):
+        print(f"Datagrams: {self.received} received, {self.lost_datagrams} lost, {self.late_datagrams} too late")
+        print(f"Samples: {self.lost_samples} lost in total, {self.device_dropped} dropped on the device")
+
+
+def main(samplerate, channels, port):
     # Create a UDP socket
     server_socket = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
-    server_socket.bind(('0.0.0.0', 8000))
+    server_socket.bind(('0.0.0.0', port))
 
     # Create WAV file with parameters
     filename = f"{samplerate}_{channels}.wav"
@@ -19,25 +83,32 @@ def main(samplerate, channels):
     wav_file.setnchannels(channels)     # channels parameter
     wav_file.setsampwidth(2)            # 2 bytes per sample (16-bit)
     wav_file.setframerate(samplerate)   # samplerate parameter
+    stream = Stream(wav_file)
 
-    print(f"Start saving audio from 0.0.0.0:8000 to {filename}...")
+    print(f"Start saving audio from 0.0.0.0:{port} to {filename}...")
 
     try:
         while True:
             # Receive a message from the client
-            message, address = server_socket.recvfrom(8000)
-            
-            # Write PCM data to WAV file
-            wav_file.writeframes(message)
+            message, address = server_socket.recvfrom(65536)
+            if len(message) < HEADER.size:
+                continue
+            magic, sequence, sample_index, dropped_samples, timestamp_us = HEADER.unpack_from(message)
+            if magic != MAGIC:
+                print(f"Ignored {len(message)} bytes from {address}, not an audio debugger datagram")
+                continue
+            stream.push(sequence, sample_index, dropped_samples, timestamp_us, message[HEADER.size:])
 
-            # Print length of the message
-            print(f"Received {len(message)} bytes from {address}")
+            if stream.received % 100 == 0:
+                stream.report()
     
     except KeyboardInterrupt:
         print("\nStopping recording...")
     
     finally:
         # Close files and socket
+        stream.flush()
+        stream.report()
         wav_file.close()
         server_socket.close()
         print(f"WAV file '{filename}' saved successfully")
@@ -49,6 +120,8 @@ if __name__ == "__main__":
                         help='采样率 (默认: 16000)')
     parser.add_argument('--channels', '-c', type=int, default=2, 
                         help='声道数 (默认: 2)')
+    parser.add_argument('--port', '-p', type=int, default=8000,
+                        help='UDP端口 (默认: 8000)')
     
     args = parser.parse_args()
-    main(args.samplerate, args.channels)
+    main(args.samplerate, args.channels, args.port)
@@ -0,0 +1,15 @@
+#ifndef ALLOCATION_COUNTER_H
+#define ALLOCATION_COUNTER_H
+
+#include <cstdint>
+
+/*
+ * Counts the calls of the global operator new and new[], from every thread, through the
+ * replacement operators in allocation_counter.cc. Link that file into the executable itself,
+ * from a static library the replacement is not guaranteed to be picked up.
+ *
+ * Memory taken with malloc() directly, such as the heap_caps_malloc() shim, is not counted.
+ */
+uint64_t GetAllocationCount();
+
+#endif // ALLOCATION_COUNTER_H
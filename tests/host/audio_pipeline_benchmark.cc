@@ -0,0 +1,173 @@
+/*
+ * Host benchmark of the audio paths, the counterpart of the on-device AudioBenchmark.
+ *
+ * Runs synthetic speech through each stage as fast as it goes and prints the time per 60 ms
+ * frame and the real-time factor: the PCM kernels, the input and output resamplers, the Opus
+ * encoder and decoder (when libopus is installed), the time stretcher and the mixer. Exits with 1 if the slowest stage falls below --min-realtime,
+ * so ctest fails on a performance regression.
+ */
+#include "dsp/audio_dsp.h"
+#include "dsp/polyphase_resampler.h"
+#include "dsp/time_stretcher.h"
+#include "audio_mixer.h"
+#include "synthetic_speech.h"
+
+#if AUDIO_BENCHMARK_HAVE_OPUS
+#include <opus.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#define BENCHMARK_FRAME_MS 60
+// Frames of synthetic speech, looped over the timed frames
+#define BENCHMARK_SPEECH_FRAMES 50
+#define BENCHMARK_FRAMES 1000
+
+namespace {
+
+struct StageResult {
+    std::string name;
+    double us_per_frame;
+    double realtime;
+};
+
+StageResult Run(const char* name, size_t frames, const std::function<void(size_t)>& process) {
+    // Warm up caches and let the stage grow its buffers
+    for (size_t i = 0; i < 10; i++) {
+        process(i);
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < frames; i++) {
+        process(i);
+    }
+    double elapsed_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    double us_per_frame = elapsed_us / frames;
+    return {name, us_per_frame, BENCHMARK_FRAME_MS * 1000.0 / us_per_frame};
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    double min_realtime = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--min-realtime") == 0 && i + 1 < argc) {
+            min_realtime = atof(argv[++i]);
+        }
+    }
+
+    const int codec_rate = 48000;
+    const int server_rate = 24000;
+    const int uplink_rate = 16000;
+    const size_t frames = BENCHMARK_FRAMES;
+    const size_t codec_frame = codec_rate * BENCHMARK_FRAME_MS / 1000;
+    const size_t server_frame = server_rate * BENCHMARK_FRAME_MS / 1000;
+
+    auto mic = SyntheticSpeech(codec_rate, codec_frame * BENCHMARK_SPEECH_FRAMES);
+    auto speech = SyntheticSpeech(server_rate, server_frame * BENCHMARK_SPEECH_FRAMES);
+    std::vector<StageResult> results;
+
+    audio_dsp::AlignedVector<int16_t> stereo(codec_frame * 2), left(codec_frame), right(codec_frame);
+    audio_dsp::Interleave(mic.data(), mic.data(), stereo.data(), codec_frame);
+    results.push_back(Run("deinterleave", frames, [&](size_t) {
+        audio_dsp::Deinterleave(stereo.data(), left.data(), right.data(), codec_frame);
+    }));
+
+    audio_dsp::AlignedVector<int16_t> gained(codec_frame);
+    results.push_back(Run("gain", frames, [&](size_t i) {
+        audio_dsp::ApplyGain(mic.data() + i % BENCHMARK_SPEECH_FRAMES * codec_frame, gained.data(), codec_frame, 20000, 15);
+    }));
+
+    PolyphaseResampler input_resampler;
+    input_resampler.Configure(codec_rate, uplink_rate);
+    std::vector<int16_t> uplink(input_resampler.GetOutputSamples(codec_frame) + 1);
+    results.push_back(Run("input resample 48k->16k", frames, [&](size_t i) {
+        input_resampler.Process(mic.data() + i % BENCHMARK_SPEECH_FRAMES * codec_frame, codec_frame, uplink.data());
+    }));
+
+    PolyphaseResampler output_resampler;
+    output_resampler.Configure(server_rate, codec_rate);
+    std::vector<int16_t> downlink(output_resampler.GetOutputSamples(server_frame) + 1);
+    results.push_back(Run("output resample 24k->48k", frames, [&](size_t i) {
+        output_resampler.Process(speech.data() + i % BENCHMARK_SPEECH_FRAMES * server_frame, server_frame, downlink.data());
+    }));
+
+#if AUDIO_BENCHMARK_HAVE_OPUS
+    /* Same settings as the uplink encoder and the stream decoder on the device */
+    int error = 0;
+    OpusEncoder* encoder = opus_encoder_create(uplink_rate, 1, OPUS_APPLICATION_VOIP, &error);
+    opus_encoder_ctl(encoder, OPUS_SET_COMPLEXITY(0));
+    opus_encoder_ctl(encoder, OPUS_SET_BITRATE(16000));
+    OpusDecoder* decoder = opus_decoder_create(server_rate, 1, &error);
+    const size_t uplink_frame = uplink_rate * BENCHMARK_FRAME_MS / 1000;
+    auto voice = SyntheticSpeech(uplink_rate, uplink_frame * BENCHMARK_SPEECH_FRAMES);
+    std::vector<std::vector<uint8_t>> packets(BENCHMARK_SPEECH_FRAMES);
+    std::vector<uint8_t> opus(1500);
+    results.push_back(Run("opus encode 16k", frames, [&](size_t i) {
+        size_t index = i % BENCHMARK_SPEECH_FRAMES;
+        int bytes = opus_encode(encoder, voice.data() + index * uplink_frame, uplink_frame, opus.data(), opus.size());
+        packets[index].assign(opus.begin(), opus.begin() + std::max(bytes, 0));
+    }));
+
+    std::vector<uint8_t> speech_opus(1500);
+    OpusEncoder* speech_encoder = opus_encoder_create(server_rate, 1, OPUS_APPLICATION_VOIP, &error);
+    for (size_t i = 0; i < BENCHMARK_SPEECH_FRAMES; i++) {
+        int bytes = opus_encode(speech_encoder, speech.data() + i * server_frame, server_frame, speech_opus.data(), speech_opus.size());
+        packets[i].assign(speech_opus.begin(), speech_opus.begin() + std::max(bytes, 0));
+    }
+    opus_encoder_destroy(speech_encoder);
+    std::vector<int16_t> decoded(server_frame);
+    results.push_back(Run("opus decode 24k", frames, [&](size_t i) {
+        auto& packet = packets[i % BENCHMARK_SPEECH_FRAMES];
+        opus_decode(decoder, packet.data(), packet.size(), decoded.data(), server_frame, 0);
+    }));
+    opus_encoder_destroy(encoder);
+    opus_decoder_destroy(decoder);
+#endif
+
+    /* Catching up at 115%, the most expensive case of the decode task */
+    TimeStretcher time_stretcher;
+    time_stretcher.Configure(codec_rate);
+    std::vector<int16_t> stretched;
+    stretched.reserve(codec_frame * 2);
+    size_t stretch_credit = 0;
+    results.push_back(Run("time stretch 48k", frames, [&](size_t i) {
+        stretched.assign(mic.begin() + i % BENCHMARK_SPEECH_FRAMES * codec_frame,
+            mic.begin() + (i % BENCHMARK_SPEECH_FRAMES + 1) * codec_frame);
+        stretch_credit = std::min(stretch_credit + codec_frame * 15 / 115, codec_frame / 2);
+        stretch_credit -= time_stretcher.Compress(stretched, stretch_credit);
+    }));
+
+    AudioMixer mixer;
+    mixer.Initialize(codec_frame * 2);
+    std::vector<int16_t> sound(codec_frame, 4000);
+    std::vector<int16_t> mixed(codec_frame);
+    results.push_back(Run("mix 48k", frames, [&](size_t i) {
+        std::copy(mic.begin() + i % BENCHMARK_SPEECH_FRAMES * codec_frame,
+            mic.begin() + (i % BENCHMARK_SPEECH_FRAMES + 1) * codec_frame, mixed.begin());
+        mixer.Write(kMixerChannelNotification, sound.data(), std::min(sound.size(), mixer.GetWritableSamples(kMixerChannelNotification)));
+        mixer.Mix(mixed.data(), mixed.size());
+    }));
+
+    double slowest = 0;
+    printf("%-28s %12s %12s\n", "stage", "us/frame", "realtime");
+    for (const auto& result : results) {
+        printf("%-28s %12.1f %11.0fx\n", result.name.c_str(), result.us_per_frame, result.realtime);
+        if (slowest == 0 || result.realtime < slowest) {
+            slowest = result.realtime;
+        }
+    }
+
+    if (min_realtime > 0 && slowest < min_realtime) {
+        printf("FAILED: slowest stage runs %.0fx real time, below the required %.0fx\n", slowest, min_realtime);
+        return 1;
+    }
+    return 0;
+}
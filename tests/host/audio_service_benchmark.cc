@@ -0,0 +1,210 @@
+/*
+ * Host benchmark of AudioService end to end.
+ *
+ * A WavAudioCodec feeds a WAV to AudioService with NoAudioProcessor, synthetic speech unless
+ * --input is given. The main thread takes the encoded packets out of the send queue and pushes
+ * them back into the decode queue, like a server echoing the audio, and the decoded audio is
+ * saved to --output. The audio tasks run on the FreeRTOS shim, so the queues, notifications and
+ * event groups are those of the device, only the scheduler differs.
+ *
+ * Prints the frames per second played, the latency of each LatencyTracer stage, the busy time of
+ * the codec tasks and the heap allocations per frame once the pipeline is warm, counted by the
+ * operator new hook of allocation_counter.cc. Exits with 1 if the pipeline stalled, or if it
+ * allocated more often than --max-allocations after the warm-up.
+ */
+#include "audio_service.h"
+#include "allocation_counter.h"
+#include "synthetic_speech.h"
+#include "wav_audio_codec.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#define BENCHMARK_INPUT_RATE 24000
+#define BENCHMARK_OUTPUT_RATE 24000
+#define BENCHMARK_SPEECH_MS 3000
+#define BENCHMARK_FRAMES 500
+// Output frames before the measurement starts, the pools and buffers have grown by then
+#define BENCHMARK_WARMUP_FRAMES 50
+// Time the pipeline may go without playing a frame before it counts as stalled
+#define BENCHMARK_STALL_MS 5000
+#define BENCHMARK_DRAIN_MS 2000
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Sends the packets in the send queue to a server echoing them back. At most a queue full, an
+// unpaced pipeline refills the queue as fast as it is drained.
+void LoopBackQueuedAudio(AudioService& service) {
+    for (int i = 0; i < MAX_SEND_PACKETS_IN_QUEUE; i++) {
+        auto packet = service.PopPacketFromSendQueue();
+        if (!packet) {
+            return;
+        }
+        service.GetLatencyTracer().Record(kLatencyMicToSent, packet->trace_time_us);
+        service.ReportSendResult(true);
+        auto incoming = service.AcquireIncomingPacket();
+        incoming->sample_rate = packet->sample_rate;
+        incoming->frame_duration = packet->frame_duration;
+        incoming->payload.assign(packet->data(), packet->data() + packet->size());
+        service.PushPacketToDecodeQueue(std::move(incoming), true);
+    }
+}
+
+void PrintUsage(const char* name, const AudioCodecTaskUsage& usage, double seconds) {
+    printf("%-14s %8lu %14.1f %14lu %9.1f%%\n", name, (unsigned long)usage.frames,
+        usage.frames > 0 ? static_cast<double>(usage.busy_us) / usage.frames : 0.0,
+        (unsigned long)usage.max_frame_us, usage.busy_us / 1e4 / seconds);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    uint32_t frames = BENCHMARK_FRAMES;
+    double speed = 0;
+    long max_allocations = -1;
+    std::string input_path;
+    std::string output_path = "audio_service_output.wav";
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            speed = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--max-allocations") == 0 && i + 1 < argc) {
+            max_allocations = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+            input_path = argv[++i];
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output_path = argv[++i];
+        }
+    }
+
+    if (input_path.empty()) {
+        input_path = "audio_service_input.wav";
+        auto speech = SyntheticSpeech(BENCHMARK_INPUT_RATE, BENCHMARK_INPUT_RATE * BENCHMARK_SPEECH_MS / 1000);
+        if (!WavAudioCodec::WriteWav(input_path, speech.data(), speech.size(), BENCHMARK_INPUT_RATE)) {
+            printf("FAILED: cannot write %s\n", input_path.c_str());
+            return 1;
+        }
+    }
+    WavAudioCodec codec(BENCHMARK_OUTPUT_RATE, speed);
+    if (!codec.OpenInput(input_path)) {
+        return 1;
+    }
+    // Room for the frames lengthened by the time stretcher
+    size_t output_frame_samples = BENCHMARK_OUTPUT_RATE * OPUS_FRAME_DURATION_MS / 1000;
+    codec.OpenOutput(output_path, (BENCHMARK_WARMUP_FRAMES + frames) * output_frame_samples * 5 / 4);
+
+    AudioService service;
+    TaskHandle_t main_task = xTaskGetCurrentTaskHandle();
+    AudioServiceCallbacks callbacks;
+    callbacks.on_send_queue_available = [main_task]() {
+        xTaskNotifyGive(main_task);
+    };
+    service.SetCallbacks(callbacks);
+    service.Initialize(&codec);
+    service.Start();
+    service.EnableVoiceProcessing(true);
+
+    /* The main loop of the application, reduced to the audio it sends */
+    bool warm = false;
+    bool stalled = false;
+    uint64_t allocations = 0;
+    uint32_t pool_misses = 0;
+    uint32_t start_frames = 0;
+    auto start = Clock::now();
+    auto last_progress = Clock::now();
+    uint32_t last_frames = 0;
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10));
+        LoopBackQueuedAudio(service);
+
+        uint32_t played = codec.output_frames();
+        if (!warm && played >= BENCHMARK_WARMUP_FRAMES) {
+            warm = true;
+            service.GetLatencyTracer().Reset();
+            allocations = GetAllocationCount();
+            pool_misses = service.GetFramePoolMisses();
+            start_frames = played;
+            start = Clock::now();
+        }
+        if (warm && played - start_frames >= frames) {
+            break;
+        }
+        if (played != last_frames) {
+            last_frames = played;
+            last_progress = Clock::now();
+        } else if (Clock::now() - last_progress > std::chrono::milliseconds(BENCHMARK_STALL_MS)) {
+            stalled = true;
+            break;
+        }
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    uint32_t played = codec.output_frames() - start_frames;
+    allocations = GetAllocationCount() - allocations;
+    pool_misses = service.GetFramePoolMisses() - pool_misses;
+    auto encode_usage = service.GetEncodeTaskUsage();
+    auto decode_usage = service.GetDecodeTaskUsage();
+    auto jitter = service.GetJitterBufferStatistics();
+
+    /* Stop the input, play out what is in flight, then stop the tasks */
+    service.EnableVoiceProcessing(false);
+    auto drain_start = Clock::now();
+    while (!service.IsIdle() && Clock::now() - drain_start < std::chrono::milliseconds(BENCHMARK_DRAIN_MS)) {
+        LoopBackQueuedAudio(service);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    service.Stop();
+    HostWaitForTasks();
+    bool saved = codec.Close();
+
+#if HOST_OPUS_FALLBACK
+    const char* opus = "host fallback codec, not Opus: the encode and decode stages leave out the Opus cost";
+#else
+    const char* opus = "libopus";
+#endif
+    printf("AudioService end to end: %d Hz in, %d Hz out, %s, %s\n", codec.input_sample_rate(),
+        codec.output_sample_rate(), speed > 0 ? "codec paced" : "codec unpaced", opus);
+    printf("%u frames of %d ms played in %.2f s: %.1f frames/s, %.1fx real time\n", played, OPUS_FRAME_DURATION_MS,
+        seconds, played / seconds, played * OPUS_FRAME_DURATION_MS / 1000.0 / seconds);
+
+    auto& tracer = service.GetLatencyTracer();
+    printf("%-28s %8s %8s %8s %8s\n", "latency stage", "count", "p50 ms", "p99 ms", "max ms");
+    for (int i = 0; i < kLatencyStageCount; i++) {
+        auto stage = static_cast<LatencyStage>(i);
+        if (tracer.GetCount(stage) == 0) {
+            continue;
+        }
+        printf("%-28s %8lu %8lu %8lu %8lu\n", LatencyTracer::GetStageName(stage), (unsigned long)tracer.GetCount(stage),
+            (unsigned long)tracer.GetPercentile(stage, 50), (unsigned long)tracer.GetPercentile(stage, 99),
+            (unsigned long)tracer.GetPercentile(stage, 100));
+    }
+
+    printf("%-14s %8s %14s %14s %10s\n", "task", "frames", "avg us/frame", "max us/frame", "busy");
+    PrintUsage("opus_encode", encode_usage, seconds);
+    PrintUsage("opus_decode", decode_usage, seconds);
+    printf("jitter buffer: %lu received, %lu late, %lu lost, %lu concealed\n", (unsigned long)jitter.received,
+        (unsigned long)jitter.late, (unsigned long)jitter.lost, (unsigned long)jitter.concealed);
+    printf("heap allocations after warm-up: %llu (%.2f per frame), frame pool misses: %lu\n",
+        (unsigned long long)allocations, played > 0 ? static_cast<double>(allocations) / played : 0.0,
+        (unsigned long)pool_misses);
+    if (saved) {
+        printf("output saved to %s\n", output_path.c_str());
+    }
+
+    if (stalled) {
+        printf("FAILED: no frame was played for %d ms\n", BENCHMARK_STALL_MS);
+        return 1;
+    }
+    if (max_allocations >= 0 && allocations > static_cast<uint64_t>(max_allocations)) {
+        printf("FAILED: %llu heap allocations after warm-up, at most %ld allowed\n",
+            (unsigned long long)allocations, max_allocations);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,49 @@
+/*
+ * Host build without libopus: the part of the libopus API the audio components use, backed by a
+ * stand-in codec so AudioService can run end to end. It is NOT Opus and much cheaper, so a
+ * benchmark built on it leaves the Opus cost out of the encode and decode stages.
+ *
+ * A packet is a TOC-like byte, 0 for a DTX frame and 1 for audio, the duration in 2.5 ms units,
+ * and for audio the frame point-sampled to 8 bits, as many points as the bitrate allows. The
+ * decoder interpolates the points back to the frame size of its own sample rate. With DTX on,
+ * quiet frames become 2-byte packets like the DTX frames of libopus.
+ */
+#pragma once
+
+#include <cstdint>
+
+typedef int16_t opus_int16;
+typedef int32_t opus_int32;
+typedef struct OpusEncoder OpusEncoder;
+typedef struct OpusDecoder OpusDecoder;
+
+#define OPUS_OK 0
+#define OPUS_BAD_ARG -1
+#define OPUS_BUFFER_TOO_SMALL -2
+#define OPUS_INVALID_PACKET -4
+#define OPUS_UNIMPLEMENTED -5
+
+#define OPUS_APPLICATION_VOIP 2048
+#define OPUS_AUTO -1000
+
+#define OPUS_SET_BITRATE_REQUEST 4002
+#define OPUS_SET_COMPLEXITY_REQUEST 4010
+#define OPUS_SET_DTX_REQUEST 4016
+#define OPUS_RESET_STATE 4028
+
+#define OPUS_SET_BITRATE(x) OPUS_SET_BITRATE_REQUEST, (opus_int32)(x)
+#define OPUS_SET_COMPLEXITY(x) OPUS_SET_COMPLEXITY_REQUEST, (opus_int32)(x)
+#define OPUS_SET_DTX(x) OPUS_SET_DTX_REQUEST, (opus_int32)(x)
+
+OpusEncoder* opus_encoder_create(opus_int32 sample_rate, int channels, int application, int* error);
+void opus_encoder_destroy(OpusEncoder* encoder);
+int opus_encoder_ctl(OpusEncoder* encoder, int request, ...);
+opus_int32 opus_encode(OpusEncoder* encoder, const opus_int16* pcm, int frame_size, unsigned char* data,
+    opus_int32 max_data_bytes);
+
+OpusDecoder* opus_decoder_create(opus_int32 sample_rate, int channels, int* error);
+void opus_decoder_destroy(OpusDecoder* decoder);
+int opus_decoder_ctl(OpusDecoder* decoder, int request, ...);
+// A null packet conceals frame_size samples
+int opus_decode(OpusDecoder* decoder, const unsigned char* data, opus_int32 len, opus_int16* pcm, int frame_size,
+    int decode_fec);
@@ -0,0 +1,162 @@
+// Host build: the stand-in codec behind opus_fallback/opus.h
+#include "opus.h"
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdlib>
+
+#define FALLBACK_TOC_DTX 0
+#define FALLBACK_TOC_AUDIO 1
+#define FALLBACK_HEADER_BYTES 2
+// Bitrate when it is left to the codec, the 16 kHz VoIP default of libopus at 60 ms
+#define FALLBACK_DEFAULT_BITRATE 16000
+// Mean absolute sample value below which a DTX frame is sent, about -54 dBFS
+#define FALLBACK_DTX_LEVEL 64
+
+struct OpusEncoder {
+    int sample_rate;
+    int channels;
+    int bitrate = FALLBACK_DEFAULT_BITRATE;
+    bool dtx = false;
+};
+
+struct OpusDecoder {
+    int sample_rate;
+    int channels;
+    int16_t last_sample = 0;   // Held during concealment
+};
+
+static bool ValidFrameSize(int sample_rate, int frame_size) {
+    // 2.5 ms to 120 ms in the steps Opus allows
+    for (int units : {1, 2, 4, 8, 16, 24, 32, 40, 48}) {
+        if (frame_size * 400 == sample_rate * units) {
+            return true;
+        }
+    }
+    return false;
+}
+
+OpusEncoder* opus_encoder_create(opus_int32 sample_rate, int channels, int, int* error) {
+    if (sample_rate <= 0 || sample_rate % 400 != 0 || channels < 1 || channels > 2) {
+        *error = OPUS_BAD_ARG;
+        return nullptr;
+    }
+    *error = OPUS_OK;
+    return new OpusEncoder{sample_rate, channels};
+}
+
+void opus_encoder_destroy(OpusEncoder* encoder) {
+    delete encoder;
+}
+
+int opus_encoder_ctl(OpusEncoder* encoder, int request, ...) {
+    va_list args;
+    va_start(args, request);
+    int result = OPUS_OK;
+    switch (request) {
+    case OPUS_SET_BITRATE_REQUEST: {
+        opus_int32 bitrate = va_arg(args, opus_int32);
+        encoder->bitrate = bitrate == OPUS_AUTO ? FALLBACK_DEFAULT_BITRATE : bitrate;
+        break;
+    }
+    case OPUS_SET_DTX_REQUEST:
+        encoder->dtx = va_arg(args, opus_int32) != 0;
+        break;
+    case OPUS_SET_COMPLEXITY_REQUEST:
+        va_arg(args, opus_int32);
+        break;
+    case OPUS_RESET_STATE:
+        break;
+    default:
+        result = OPUS_UNIMPLEMENTED;
+        break;
+    }
+    va_end(args);
+    return result;
+}
+
+opus_int32 opus_encode(OpusEncoder* encoder, const opus_int16* pcm, int frame_size, unsigned char* data,
+    opus_int32 max_data_bytes) {
+    if (!ValidFrameSize(encoder->sample_rate, frame_size)) {
+        return OPUS_BAD_ARG;
+    }
+    if (max_data_bytes < FALLBACK_HEADER_BYTES + 1) {
+        return OPUS_BUFFER_TOO_SMALL;
+    }
+    int samples = frame_size * encoder->channels;
+    data[1] = frame_size * 400 / encoder->sample_rate;
+
+    if (encoder->dtx) {
+        int64_t level = 0;
+        for (int i = 0; i < samples; i++) {
+            level += abs(pcm[i]);
+        }
+        if (level < (int64_t)FALLBACK_DTX_LEVEL * samples) {
+            data[0] = FALLBACK_TOC_DTX;
+            return FALLBACK_HEADER_BYTES;
+        }
+    }
+
+    int64_t bytes = (int64_t)encoder->bitrate * frame_size / encoder->sample_rate / 8;
+    int points = std::clamp<int64_t>(bytes - FALLBACK_HEADER_BYTES, 1, std::min(max_data_bytes - FALLBACK_HEADER_BYTES, samples));
+    data[0] = FALLBACK_TOC_AUDIO;
+    for (int i = 0; i < points; i++) {
+        data[FALLBACK_HEADER_BYTES + i] = (uint8_t)(pcm[(int64_t)i * samples / points] >> 8);
+    }
+    return FALLBACK_HEADER_BYTES + points;
+}
+
+OpusDecoder* opus_decoder_create(opus_int32 sample_rate, int channels, int* error) {
+    if (sample_rate <= 0 || sample_rate % 400 != 0 || channels < 1 || channels > 2) {
+        *error = OPUS_BAD_ARG;
+        return nullptr;
+    }
+    *error = OPUS_OK;
+    return new OpusDecoder{sample_rate, channels};
+}
+
+void opus_decoder_destroy(OpusDecoder* decoder) {
+    delete decoder;
+}
+
+int opus_decoder_ctl(OpusDecoder* decoder, int request, ...) {
+    if (request != OPUS_RESET_STATE) {
+        return OPUS_UNIMPLEMENTED;
+    }
+    decoder->last_sample = 0;
+    return OPUS_OK;
+}
+
+int opus_decode(OpusDecoder* decoder, const unsigned char* data, opus_int32 len, opus_int16* pcm, int frame_size, int) {
+    if (data == nullptr || len == 0) {
+        std::fill(pcm, pcm + frame_size * decoder->channels, decoder->last_sample);
+        return frame_size;
+    }
+    if (len < FALLBACK_HEADER_BYTES || data[0] > FALLBACK_TOC_AUDIO) {
+        return OPUS_INVALID_PACKET;
+    }
+    int decoded = data[1] * decoder->sample_rate / 400;
+    if (decoded > frame_size) {
+        return OPUS_BUFFER_TOO_SMALL;
+    }
+    int samples = decoded * decoder->channels;
+    int points = len - FALLBACK_HEADER_BYTES;
+    if (data[0] == FALLBACK_TOC_DTX || points == 0) {
+        std::fill(pcm, pcm + samples, 0);
+        decoder->last_sample = 0;
+        return decoded;
+    }
+
+    /* Linear interpolation between the points, the last one is held to the end of the frame */
+    const int8_t* values = reinterpret_cast<const int8_t*>(data + FALLBACK_HEADER_BYTES);
+    for (int i = 0; i < samples; i++) {
+        int64_t position = (int64_t)i * points * 256 / samples;
+        int index = position >> 8;
+        int fraction = position & 0xff;
+        int current = values[index] * 256;
+        int next = index + 1 < points ? values[index + 1] * 256 : current;
+        pcm[i] = (opus_int16)(current + (next - current) * fraction / 256);
+    }
+    decoder->last_sample = pcm[samples - 1];
+    return decoded;
+}
@@ -0,0 +1,179 @@
+/*
+ * Host microbenchmark of the SpscQueue hops of AudioService.
+ *
+ * One thread per audio task, connected like on the device: the input task pushes a frame into
+ * the encode queue every 60 ms, the encode task moves it on to the send queue and the main loop
+ * takes it out; the network pushes into the decode queue at the same cadence, the decode task
+ * moves it to the playback queue and the output task takes it out. Consumers sleep on a task
+ * notification, as ulTaskNotifyTake() does on the device.
+ *
+ * Prints the latency of each hop from Push() to the Pop() of the woken consumer, and the context
+ * switches per second of the process. Exits with 1 if a frame was lost or reordered.
+ */
+#include "spsc_queue.h"
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define BENCHMARK_FRAME_MS 60
+#define BENCHMARK_FRAMES 50
+// Bound of each queue, the cadence keeps at most a frame or two in flight
+#define BENCHMARK_QUEUE_SIZE 16
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Binary task notification, xTaskNotifyGive() / ulTaskNotifyTake(pdTRUE, portMAX_DELAY)
+class TaskNotification {
+public:
+    void Give() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            pending_ = true;
+        }
+        cv_.notify_one();
+    }
+
+    void Take() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return pending_; });
+        pending_ = false;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool pending_ = false;
+};
+
+struct Frame {
+    uint32_t sequence = 0;
+    Clock::time_point pushed;
+};
+using FramePtr = std::unique_ptr<Frame>;
+using Queue = SpscQueue<FramePtr, BENCHMARK_QUEUE_SIZE>;
+
+struct Hop {
+    std::string name;
+    Queue queue;
+    TaskNotification notification;
+    std::vector<double> latencies_us;
+    uint32_t next_sequence = 0;
+    bool in_order = true;
+
+    void Push(FramePtr frame) {
+        frame->pushed = Clock::now();
+        if (!queue.Push(std::move(frame))) {
+            in_order = false;
+        }
+        notification.Give();
+    }
+
+    // Takes everything the producer queued before each notification, until the last frame
+    template <typename Next>
+    void Consume(uint32_t frames, Next next) {
+        while (next_sequence < frames) {
+            notification.Take();
+            FramePtr frame;
+            while (queue.Pop(frame)) {
+                latencies_us.push_back(std::chrono::duration<double, std::micro>(Clock::now() - frame->pushed).count());
+                in_order = in_order && frame->sequence == next_sequence;
+                next_sequence = frame->sequence + 1;
+                next(std::move(frame));
+            }
+        }
+    }
+};
+
+long ContextSwitches() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+double Percentile(std::vector<double> values, double percentile) {
+    if (values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    size_t index = std::min(values.size() - 1, static_cast<size_t>(percentile / 100 * values.size()));
+    return values[index];
+}
+
+// A task producing one frame per BENCHMARK_FRAME_MS into the first hop
+void RunSource(Hop& hop, uint32_t frames) {
+    auto next = Clock::now();
+    for (uint32_t i = 0; i < frames; i++) {
+        std::this_thread::sleep_until(next);
+        auto frame = std::make_unique<Frame>();
+        frame->sequence = i;
+        hop.Push(std::move(frame));
+        next += std::chrono::milliseconds(BENCHMARK_FRAME_MS);
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    uint32_t frames = BENCHMARK_FRAMES;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = std::max(1, atoi(argv[++i]));
+        }
+    }
+
+    Hop encode_queue{"encode queue"};
+    Hop send_queue{"send queue"};
+    Hop decode_queue{"decode queue"};
+    Hop playback_queue{"playback queue"};
+
+    long switches_before = ContextSwitches();
+    auto start = Clock::now();
+
+    std::vector<std::thread> tasks;
+    tasks.emplace_back([&]() { RunSource(encode_queue, frames); });
+    tasks.emplace_back([&]() { encode_queue.Consume(frames, [&](FramePtr frame) { send_queue.Push(std::move(frame)); }); });
+    tasks.emplace_back([&]() { send_queue.Consume(frames, [](FramePtr) {}); });
+    tasks.emplace_back([&]() { RunSource(decode_queue, frames); });
+    tasks.emplace_back([&]() { decode_queue.Consume(frames, [&](FramePtr frame) { playback_queue.Push(std::move(frame)); }); });
+    tasks.emplace_back([&]() { playback_queue.Consume(frames, [](FramePtr) {}); });
+    for (auto& task : tasks) {
+        task.join();
+    }
+
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    long switches = ContextSwitches() - switches_before;
+
+    bool ok = true;
+    printf("%u frames every %d ms, %.1f s\n", frames, BENCHMARK_FRAME_MS, seconds);
+    printf("%-16s %10s %10s %10s %10s\n", "hop", "avg us", "p50 us", "p99 us", "max us");
+    for (Hop* hop : {&encode_queue, &send_queue, &decode_queue, &playback_queue}) {
+        double sum = 0;
+        for (double latency : hop->latencies_us) {
+            sum += latency;
+        }
+        double average = hop->latencies_us.empty() ? 0 : sum / hop->latencies_us.size();
+        printf("%-16s %10.1f %10.1f %10.1f %10.1f\n", hop->name.c_str(), average,
+            Percentile(hop->latencies_us, 50), Percentile(hop->latencies_us, 99), Percentile(hop->latencies_us, 100));
+        if (!hop->in_order || hop->latencies_us.size() != frames) {
+            printf("FAILED: %s delivered %zu of %u frames%s\n", hop->name.c_str(), hop->latencies_us.size(), frames,
+                hop->in_order ? "" : " out of order");
+            ok = false;
+        }
+    }
+    printf("context switches: %ld, %.1f/s\n", switches, switches / seconds);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,2 @@
+// Host build: audio_codec.h includes the board, nothing of it is used by the audio components
+#pragma once
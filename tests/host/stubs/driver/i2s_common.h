@@ -0,0 +1,9 @@
+// Host build: never called, the host codecs have no I2S channel
+#pragma once
+
+#include "driver/i2s_std.h"
+#include "esp_err.h"
+
+inline esp_err_t i2s_channel_enable(i2s_chan_handle_t) {
+    return ESP_OK;
+}
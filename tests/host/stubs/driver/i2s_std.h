@@ -0,0 +1,4 @@
+// Host build: AudioCodec keeps the I2S channel handles, host codecs leave them null
+#pragma once
+
+typedef struct i2s_channel_obj_t* i2s_chan_handle_t;
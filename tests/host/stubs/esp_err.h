@@ -0,0 +1,20 @@
+// Host build: error codes, ESP_ERROR_CHECK aborts like on the device
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_INVALID_STATE 0x103
+
+#define ESP_ERROR_CHECK(x) do {                                                 \
+        esp_err_t err_rc_ = (x);                                                \
+        if (err_rc_ != ESP_OK) {                                                \
+            fprintf(stderr, "ESP_ERROR_CHECK failed: %d at %s:%d\n", err_rc_,   \
+                __FILE__, __LINE__);                                            \
+            abort();                                                            \
+        }                                                                       \
+    } while (0)
@@ -0,0 +1,21 @@
+// Host build: capability allocations map to the C heap
+#pragma once
+
+#include <cstdlib>
+#include <cstddef>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+inline void* heap_caps_malloc(size_t size, unsigned int) {
+    return malloc(size);
+}
+
+inline void* heap_caps_aligned_alloc(size_t alignment, size_t size, unsigned int) {
+    return aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+inline void heap_caps_free(void* p) {
+    free(p);
+}
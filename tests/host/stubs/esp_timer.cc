@@ -0,0 +1,107 @@
+// Host build: esp_timer on std::chrono::steady_clock
+#include "esp_timer.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+using Clock = std::chrono::steady_clock;
+
+struct HostTimer {
+    esp_timer_create_args_t args;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool running = false;
+    bool deleted = false;
+    uint64_t period_us = 0;     // 0 for a one-shot timer
+    Clock::time_point next;
+    uint32_t generation = 0;    // Bumped by every start and stop, a pending expiry of an older one is dropped
+    std::thread thread;
+
+    void Run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!deleted) {
+            if (!running) {
+                cv.wait(lock);
+                continue;
+            }
+            uint32_t started = generation;
+            if (cv.wait_until(lock, next, [this, started]() { return deleted || generation != started; })) {
+                continue;
+            }
+            if (period_us > 0) {
+                next += std::chrono::microseconds(period_us);
+                // Expiries missed while the callback ran late are skipped, as with skip_unhandled_events
+                if (next < Clock::now()) {
+                    next = Clock::now() + std::chrono::microseconds(period_us);
+                }
+            } else {
+                running = false;
+            }
+            // The callback may stop or restart the timer
+            lock.unlock();
+            args.callback(args.arg);
+            lock.lock();
+        }
+    }
+};
+
+int64_t esp_timer_get_time() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now().time_since_epoch()).count();
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* timer) {
+    auto host_timer = new HostTimer();
+    host_timer->args = *args;
+    host_timer->thread = std::thread([host_timer]() { host_timer->Run(); });
+    *timer = host_timer;
+    return ESP_OK;
+}
+
+static esp_err_t Start(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period_us) {
+    {
+        std::lock_guard<std::mutex> lock(timer->mutex);
+        if (timer->running) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        timer->running = true;
+        timer->period_us = period_us;
+        timer->next = Clock::now() + std::chrono::microseconds(timeout_us);
+        timer->generation++;
+    }
+    timer->cv.notify_all();
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    return Start(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us) {
+    return Start(timer, period_us, period_us);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    {
+        std::lock_guard<std::mutex> lock(timer->mutex);
+        if (!timer->running) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        timer->running = false;
+        timer->generation++;
+    }
+    timer->cv.notify_all();
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+    {
+        std::lock_guard<std::mutex> lock(timer->mutex);
+        timer->deleted = true;
+    }
+    timer->cv.notify_all();
+    timer->thread.join();
+    delete timer;
+    return ESP_OK;
+}
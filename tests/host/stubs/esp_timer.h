@@ -0,0 +1,32 @@
+// Host build: esp_timer on the monotonic clock, each timer dispatches from a thread of its own (esp_timer.cc)
+#pragma once
+
+#include <cstdint>
+
+#include "esp_err.h"
+
+typedef struct HostTimer* esp_timer_handle_t;
+typedef void (*esp_timer_cb_t)(void* arg);
+
+typedef enum {
+    ESP_TIMER_TASK,
+    ESP_TIMER_ISR,
+} esp_timer_dispatch_t;
+
+typedef struct {
+    esp_timer_cb_t callback;
+    void* arg;
+    esp_timer_dispatch_t dispatch_method;
+    const char* name;
+    bool skip_unhandled_events;
+} esp_timer_create_args_t;
+
+// Microseconds of the monotonic clock, always positive
+int64_t esp_timer_get_time();
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* timer);
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us);
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us);
+// ESP_ERR_INVALID_STATE if the timer is not running
+esp_err_t esp_timer_stop(esp_timer_handle_t timer);
+// Must not be called from the callback of the timer
+esp_err_t esp_timer_delete(esp_timer_handle_t timer);
@@ -0,0 +1,8 @@
+// Host build: see esp_wn_iface.h
+#pragma once
+
+#include "esp_wn_iface.h"
+
+inline const esp_wn_iface_t* esp_wn_handle_from_name(const char*) {
+    return nullptr;
+}
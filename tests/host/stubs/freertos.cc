@@ -0,0 +1,177 @@
+// Host build: FreeRTOS tasks, task notifications and event groups on std::thread
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct HostTask {
+    std::string name;
+    std::mutex mutex;
+    std::condition_variable cv;
+    uint32_t notifications = 0;
+};
+
+struct HostEventGroup {
+    std::mutex mutex;
+    std::condition_variable cv;
+    EventBits_t bits = 0;
+};
+
+namespace {
+
+// Tasks are never freed, a notification may still be given to a task that has just returned
+std::mutex tasks_mutex;
+std::condition_variable tasks_cv;
+std::vector<std::unique_ptr<HostTask>> tasks;
+int running_tasks = 0;
+thread_local HostTask* current_task = nullptr;
+
+HostTask* NewTask(const char* name) {
+    std::lock_guard<std::mutex> lock(tasks_mutex);
+    tasks.push_back(std::make_unique<HostTask>());
+    tasks.back()->name = name;
+    return tasks.back().get();
+}
+
+// Waits on cv until done() holds or the ticks ran out, returns done()
+template <typename Done>
+bool WaitFor(std::condition_variable& cv, std::unique_lock<std::mutex>& lock, TickType_t ticks, Done done) {
+    if (ticks == portMAX_DELAY) {
+        cv.wait(lock, done);
+        return true;
+    }
+    return cv.wait_for(lock, std::chrono::milliseconds(ticks * portTICK_PERIOD_MS), done);
+}
+
+} // namespace
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char* name, uint32_t, void* arg,
+    UBaseType_t, TaskHandle_t* created_task, BaseType_t) {
+    HostTask* task = NewTask(name);
+    // Set before the task runs, it may clear its own handle when it returns
+    if (created_task != nullptr) {
+        *created_task = task;
+    }
+    {
+        std::lock_guard<std::mutex> lock(tasks_mutex);
+        running_tasks++;
+    }
+    std::thread([function, arg, task]() {
+        current_task = task;
+        function(arg);
+        std::lock_guard<std::mutex> lock(tasks_mutex);
+        running_tasks--;
+        tasks_cv.notify_all();
+    }).detach();
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char* name, uint32_t stack_depth, void* arg,
+    UBaseType_t priority, TaskHandle_t* created_task) {
+    return xTaskCreatePinnedToCore(function, name, stack_depth, arg, priority, created_task, tskNO_AFFINITY);
+}
+
+TaskHandle_t xTaskCreateStatic(TaskFunction_t function, const char* name, uint32_t stack_depth, void* arg,
+    UBaseType_t priority, StackType_t*, StaticTask_t*) {
+    TaskHandle_t task = nullptr;
+    xTaskCreate(function, name, stack_depth, arg, priority, &task);
+    return task;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    if (task != nullptr && task != current_task) {
+        fprintf(stderr, "vTaskDelete() of another task (%s) is not supported on the host\n", task->name.c_str());
+        abort();
+    }
+}
+
+void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks * portTICK_PERIOD_MS));
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+    // Threads not started by xTaskCreate(), such as main(), get a task on first use
+    if (current_task == nullptr) {
+        current_task = NewTask("host");
+    }
+    return current_task;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    {
+        std::lock_guard<std::mutex> lock(task->mutex);
+        task->notifications++;
+    }
+    task->cv.notify_one();
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_count_on_exit, TickType_t ticks_to_wait) {
+    HostTask* task = xTaskGetCurrentTaskHandle();
+    std::unique_lock<std::mutex> lock(task->mutex);
+    WaitFor(task->cv, lock, ticks_to_wait, [task]() { return task->notifications > 0; });
+    uint32_t count = task->notifications;
+    if (count > 0) {
+        task->notifications = clear_count_on_exit ? 0 : count - 1;
+    }
+    return count;
+}
+
+void HostWaitForTasks() {
+    std::unique_lock<std::mutex> lock(tasks_mutex);
+    tasks_cv.wait(lock, []() { return running_tasks == 0; });
+}
+
+EventGroupHandle_t xEventGroupCreate() {
+    return new HostEventGroup();
+}
+
+void vEventGroupDelete(EventGroupHandle_t group) {
+    delete group;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+    EventBits_t result;
+    {
+        std::lock_guard<std::mutex> lock(group->mutex);
+        group->bits |= bits;
+        result = group->bits;
+    }
+    group->cv.notify_all();
+    return result;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+    std::lock_guard<std::mutex> lock(group->mutex);
+    EventBits_t result = group->bits;
+    group->bits &= ~bits;
+    return result;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group) {
+    std::lock_guard<std::mutex> lock(group->mutex);
+    return group->bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+    BaseType_t wait_for_all_bits, TickType_t ticks_to_wait) {
+    std::unique_lock<std::mutex> lock(group->mutex);
+    auto done = [group, bits, wait_for_all_bits]() {
+        return wait_for_all_bits ? (group->bits & bits) == bits : (group->bits & bits) != 0;
+    };
+    bool satisfied = WaitFor(group->cv, lock, ticks_to_wait, done);
+    EventBits_t result = group->bits;
+    if (satisfied && clear_on_exit) {
+        group->bits &= ~bits;
+    }
+    return result;
+}
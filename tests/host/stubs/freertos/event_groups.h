@@ -0,0 +1,18 @@
+// Host build: event groups are a bit mask under a mutex, see freertos.cc
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct HostEventGroup* EventGroupHandle_t;
+// uint32_t on the device, where it is an unsigned long, so the firmware logs it with %lx
+typedef unsigned long EventBits_t;
+
+EventGroupHandle_t xEventGroupCreate();
+void vEventGroupDelete(EventGroupHandle_t group);
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits);
+// Returns the bits before they were cleared
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group);
+// Returns the bits when the wait ended, before clear_on_exit cleared them
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+    BaseType_t wait_for_all_bits, TickType_t ticks_to_wait);
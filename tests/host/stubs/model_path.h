@@ -0,0 +1,24 @@
+// Host build: there are no speech models, so AudioService runs without a wake word
+#pragma once
+
+#include <cstddef>
+
+#define ESP_WN_PREFIX "wn"
+#define ESP_MN_PREFIX "mn"
+
+typedef struct {
+    char** model_name;
+    char** model_info;
+    int num;
+} srmodel_list_t;
+
+inline srmodel_list_t* esp_srmodel_init(const char*) {
+    return nullptr;
+}
+
+inline void esp_srmodel_deinit(srmodel_list_t*) {
+}
+
+inline char* esp_srmodel_filter(srmodel_list_t*, const char*, const char*) {
+    return nullptr;
+}
@@ -0,0 +1,64 @@
+// Host build: OpusDecoderWrapper of the esp-opus-encoder component, on <opus.h> (libopus, or the
+// fallback codec in opus_fallback/ when libopus is not installed)
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include <esp_log.h>
+#include <opus.h>
+
+class OpusDecoderWrapper {
+public:
+    OpusDecoderWrapper(int sample_rate, int channels, int duration_ms = 60)
+        : sample_rate_(sample_rate), duration_ms_(duration_ms) {
+        int error;
+        audio_dec_ = opus_decoder_create(sample_rate, channels, &error);
+        if (audio_dec_ == nullptr) {
+            ESP_LOGE("OpusDecoderWrapper", "Failed to create audio decoder, error code: %d", error);
+            return;
+        }
+        frame_size_ = sample_rate / 1000 * channels * duration_ms;
+    }
+
+    ~OpusDecoderWrapper() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (audio_dec_ != nullptr) {
+            opus_decoder_destroy(audio_dec_);
+        }
+    }
+
+    // An empty packet runs packet loss concealment for one frame
+    bool Decode(std::vector<uint8_t>&& opus, std::vector<int16_t>& pcm) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (audio_dec_ == nullptr) {
+            return false;
+        }
+        pcm.resize(frame_size_);
+        int ret = opus_decode(audio_dec_, opus.empty() ? nullptr : opus.data(), opus.size(), pcm.data(), pcm.size(), 0);
+        if (ret < 0) {
+            ESP_LOGE("OpusDecoderWrapper", "Failed to decode audio, error code: %d", ret);
+            return false;
+        }
+        pcm.resize(ret);
+        return true;
+    }
+
+    void ResetState() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (audio_dec_ != nullptr) {
+            opus_decoder_ctl(audio_dec_, OPUS_RESET_STATE);
+        }
+    }
+
+    int sample_rate() const { return sample_rate_; }
+    int duration_ms() const { return duration_ms_; }
+
+private:
+    std::mutex mutex_;
+    OpusDecoder* audio_dec_ = nullptr;
+    int frame_size_ = 0;
+    int sample_rate_;
+    int duration_ms_;
+};
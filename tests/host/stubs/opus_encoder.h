@@ -0,0 +1,3 @@
+// Host build: audio_service.h includes the encoder wrapper of the esp-opus-encoder component, the
+// uplink runs on AdaptiveOpusEncoder, which owns the libopus encoder directly
+#pragma once
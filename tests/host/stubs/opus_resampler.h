@@ -0,0 +1,24 @@
+// Host build: the 44.1k fallback of PolyphaseResampler is not tested, this keeps it linkable
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+class OpusResampler {
+public:
+    void Configure(int input_sample_rate, int output_sample_rate) {
+        input_sample_rate_ = input_sample_rate;
+        output_sample_rate_ = output_sample_rate;
+    }
+    int GetOutputSamples(int input_samples) const {
+        return static_cast<int64_t>(input_samples) * output_sample_rate_ / input_sample_rate_;
+    }
+    void Process(const int16_t*, int input_samples, int16_t* output) {
+        memset(output, 0, GetOutputSamples(input_samples) * sizeof(int16_t));
+    }
+
+private:
+    int input_sample_rate_ = 0;
+    int output_sample_rate_ = 0;
+};
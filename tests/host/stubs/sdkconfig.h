@@ -0,0 +1,2 @@
+// Host build: no Kconfig options are set, every IDF_TARGET check takes the portable path
+#pragma once
@@ -0,0 +1,58 @@
+// Host build: the settings live in memory for the lifetime of the process
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+class Settings {
+public:
+    Settings(const std::string& ns, bool read_write = false) : ns_(ns + "."), read_write_(read_write) {}
+
+    std::string GetString(const std::string& key, const std::string& default_value = "") {
+        std::lock_guard<std::mutex> lock(Mutex());
+        auto it = Strings().find(ns_ + key);
+        return it != Strings().end() ? it->second : default_value;
+    }
+    void SetString(const std::string& key, const std::string& value) {
+        if (read_write_) {
+            std::lock_guard<std::mutex> lock(Mutex());
+            Strings()[ns_ + key] = value;
+        }
+    }
+    int32_t GetInt(const std::string& key, int32_t default_value = 0) {
+        std::lock_guard<std::mutex> lock(Mutex());
+        auto it = Ints().find(ns_ + key);
+        return it != Ints().end() ? it->second : default_value;
+    }
+    void SetInt(const std::string& key, int32_t value) {
+        if (read_write_) {
+            std::lock_guard<std::mutex> lock(Mutex());
+            Ints()[ns_ + key] = value;
+        }
+    }
+    bool GetBool(const std::string& key, bool default_value = false) {
+        return GetInt(key, default_value ? 1 : 0) != 0;
+    }
+    void SetBool(const std::string& key, bool value) {
+        SetInt(key, value ? 1 : 0);
+    }
+
+private:
+    std::string ns_;
+    bool read_write_;
+
+    static std::mutex& Mutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+    static std::map<std::string, std::string>& Strings() {
+        static std::map<std::string, std::string> strings;
+        return strings;
+    }
+    static std::map<std::string, int32_t>& Ints() {
+        static std::map<std::string, int32_t> ints;
+        return ints;
+    }
+};
@@ -0,0 +1,33 @@
+// Test signal shared by the host benchmarks
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A vowel-like signal: a 140 Hz pulse train through a few formants, with a slow envelope
+inline std::vector<int16_t> SyntheticSpeech(int sample_rate, size_t samples) {
+    const double formants[] = {700, 1220, 2600};
+    std::vector<double> weights;
+    for (int h = 1; h * 140 < sample_rate / 2; h++) {
+        double weight = 0;
+        for (double formant : formants) {
+            weight += 1.0 / (1.0 + pow((h * 140.0 - formant) / 150.0, 2));
+        }
+        weights.push_back(weight);
+    }
+
+    std::vector<int16_t> pcm(samples);
+    for (size_t i = 0; i < samples; i++) {
+        double t = static_cast<double>(i) / sample_rate;
+        double value = 0;
+        for (size_t h = 0; h < weights.size(); h++) {
+            value += weights[h] * sin(2 * M_PI * 140.0 * (h + 1) * t);
+        }
+        double envelope = 0.5 + 0.5 * sin(2 * M_PI * 3 * t);
+        pcm[i] = static_cast<int16_t>(std::clamp(value * envelope * 3000, -32767.0, 32767.0));
+    }
+    return pcm;
+}
@@ -0,0 +1,97 @@
+#include "dsp/audio_dsp.h"
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <random>
+
+namespace {
+
+std::vector<int16_t> RandomSamples(size_t count, uint32_t seed) {
+    std::mt19937 random(seed);
+    std::uniform_int_distribution<int> distribution(INT16_MIN, INT16_MAX);
+    std::vector<int16_t> samples(count);
+    for (auto& sample : samples) {
+        sample = distribution(random);
+    }
+    return samples;
+}
+
+} // namespace
+
+TEST(AudioDsp, DeinterleaveThenInterleaveRestoresInput) {
+    // 965 frames, so both the block loop and the tail are exercised
+    const size_t frames = 965;
+    auto input = RandomSamples(frames * 2, 1);
+    audio_dsp::AlignedVector<int16_t> left(frames), right(frames), output(frames * 2);
+
+    audio_dsp::Deinterleave(input.data(), left.data(), right.data(), frames);
+    for (size_t i = 0; i < frames; i++) {
+        ASSERT_EQ(left[i], input[2 * i]);
+        ASSERT_EQ(right[i], input[2 * i + 1]);
+    }
+
+    audio_dsp::Interleave(left.data(), right.data(), output.data(), frames);
+    EXPECT_TRUE(std::equal(output.begin(), output.end(), input.begin()));
+}
+
+TEST(AudioDsp, ApplyGainScalesAndSaturates) {
+    const int16_t input[] = {0, 1000, -1000, INT16_MAX, INT16_MIN, 25000, -25000};
+    int16_t output[7];
+
+    audio_dsp::ApplyGain(input, output, 7, 1 << 13, 14);    // 0.5
+    EXPECT_EQ(output[1], 500);
+    EXPECT_EQ(output[2], -500);
+    EXPECT_EQ(output[3], INT16_MAX / 2);
+    EXPECT_EQ(output[4], INT16_MIN / 2);
+
+    audio_dsp::ApplyGain(input, output, 7, 3 << 13, 14);    // 1.5, saturates
+    EXPECT_EQ(output[0], 0);
+    EXPECT_EQ(output[1], 1500);
+    EXPECT_EQ(output[3], INT16_MAX);
+    EXPECT_EQ(output[4], INT16_MIN);
+    EXPECT_EQ(output[5], INT16_MAX);
+    EXPECT_EQ(output[6], INT16_MIN);
+}
+
+TEST(AudioDsp, ApplyGainInPlace) {
+    auto samples = RandomSamples(480, 2);
+    auto expected = samples;
+    for (auto& sample : expected) {
+        sample = static_cast<int16_t>((sample * 12000) >> 15);
+    }
+    audio_dsp::ApplyGain(samples.data(), samples.data(), samples.size(), 12000, 15);
+    EXPECT_EQ(samples, expected);
+}
+
+TEST(AudioDsp, Int16ToInt32AppliesQ16Gain) {
+    const int16_t input[] = {1, -1, INT16_MAX, INT16_MIN};
+    int32_t output[4];
+    audio_dsp::Int16ToInt32(input, output, 4, 65536);
+    EXPECT_EQ(output[0], 65536);
+    EXPECT_EQ(output[1], -65536);
+    EXPECT_EQ(output[2], INT16_MAX * 65536);
+    EXPECT_EQ(output[3], INT16_MIN * 65536);
+
+    audio_dsp::Int16ToInt32(input, output, 4, 0);
+    EXPECT_EQ(output[2], 0);
+}
+
+TEST(AudioDsp, Int32ToInt16ShiftsAndClamps) {
+    const int32_t input[] = {1 << 16, -(1 << 16), INT32_MAX, INT32_MIN, 12345 << 8};
+    int16_t output[5];
+    audio_dsp::Int32ToInt16(input, output, 5, 16);
+    EXPECT_EQ(output[0], 1);
+    EXPECT_EQ(output[1], -1);
+    EXPECT_EQ(output[2], INT16_MAX);
+    EXPECT_EQ(output[3], -INT16_MAX);
+
+    audio_dsp::Int32ToInt16(input, output, 5, 8);
+    EXPECT_EQ(output[4], 12345);
+    EXPECT_EQ(output[2], INT16_MAX);
+    EXPECT_EQ(output[3], -INT16_MAX);
+}
+
+TEST(AudioDsp, AlignedVectorIsAligned) {
+    audio_dsp::AlignedVector<int16_t> samples(37);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(samples.data()) & 15, 0u);
+}
@@ -0,0 +1,128 @@
+#include "audio_service.h"
+#include "allocation_counter.h"
+#include "synthetic_speech.h"
+#include "wav_audio_codec.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <vector>
+
+#define TEST_SAMPLE_RATE 24000
+// Four times real time, fast enough for ctest and slow enough that the queues stay shallow
+#define TEST_SPEED 4
+#define TEST_WARMUP_FRAMES 50
+#define TEST_FRAMES 100
+#define TEST_STALL_MS 5000
+
+namespace {
+
+// Echoes the send queue back into the decode queue, like the server
+void LoopBackQueuedAudio(AudioService& service) {
+    for (int i = 0; i < MAX_SEND_PACKETS_IN_QUEUE; i++) {
+        auto packet = service.PopPacketFromSendQueue();
+        if (!packet) {
+            return;
+        }
+        service.ReportSendResult(true);
+        auto incoming = service.AcquireIncomingPacket();
+        incoming->sample_rate = packet->sample_rate;
+        incoming->frame_duration = packet->frame_duration;
+        incoming->payload.assign(packet->data(), packet->data() + packet->size());
+        service.PushPacketToDecodeQueue(std::move(incoming), true);
+    }
+}
+
+} // namespace
+
+TEST(AudioFramePool, MissIsNotOneAllocation) {
+    AudioFramePool<std::vector<int16_t>> pool;
+    pool.Initialize(2, [](std::vector<int16_t>& frame) { frame.reserve(480); },
+        [](std::vector<int16_t>& frame) { frame.clear(); });
+
+    uint64_t allocations = GetAllocationCount();
+    auto first = pool.Acquire();
+    auto second = pool.Acquire();
+    first->resize(480);
+    EXPECT_EQ(GetAllocationCount(), allocations);
+    EXPECT_EQ(pool.misses(), 0u);
+
+    // The missed frame comes without its reserved buffer, which then grows on the heap
+    auto third = pool.Acquire();
+    EXPECT_EQ(pool.misses(), 1u);
+    uint64_t after_miss = GetAllocationCount();
+    EXPECT_EQ(after_miss, allocations + 1);
+    third->resize(480);
+    EXPECT_GT(GetAllocationCount(), after_miss);
+
+    // The pool keeps its two frames, the third is freed
+    first.reset();
+    second.reset();
+    third.reset();
+    EXPECT_EQ(pool.available(), 2u);
+    allocations = GetAllocationCount();
+    first = pool.Acquire();
+    second = pool.Acquire();
+    EXPECT_EQ(GetAllocationCount(), allocations);
+    EXPECT_EQ(pool.misses(), 1u);
+}
+
+TEST(AudioService, SteadyStateDoesNotAllocate) {
+    const char* input_path = "test_audio_service_input.wav";
+    auto speech = SyntheticSpeech(TEST_SAMPLE_RATE, TEST_SAMPLE_RATE * 3);
+    ASSERT_TRUE(WavAudioCodec::WriteWav(input_path, speech.data(), speech.size(), TEST_SAMPLE_RATE));
+    WavAudioCodec codec(TEST_SAMPLE_RATE, TEST_SPEED);
+    ASSERT_TRUE(codec.OpenInput(input_path));
+
+    AudioService service;
+    TaskHandle_t main_task = xTaskGetCurrentTaskHandle();
+    AudioServiceCallbacks callbacks;
+    callbacks.on_send_queue_available = [main_task]() {
+        xTaskNotifyGive(main_task);
+    };
+    service.SetCallbacks(callbacks);
+    service.Initialize(&codec);
+    service.Start();
+    service.EnableVoiceProcessing(true);
+
+    bool warm = false;
+    bool stalled = false;
+    uint64_t allocations = 0;
+    uint32_t misses = 0;
+    uint32_t start_frames = 0;
+    uint32_t last_frames = 0;
+    auto last_progress = std::chrono::steady_clock::now();
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10));
+        LoopBackQueuedAudio(service);
+
+        uint32_t played = codec.output_frames();
+        if (!warm && played >= TEST_WARMUP_FRAMES) {
+            warm = true;
+            allocations = GetAllocationCount();
+            misses = service.GetFramePoolMisses();
+            start_frames = played;
+        }
+        if (warm && played - start_frames >= TEST_FRAMES) {
+            break;
+        }
+        if (played != last_frames) {
+            last_frames = played;
+            last_progress = std::chrono::steady_clock::now();
+        } else if (std::chrono::steady_clock::now() - last_progress > std::chrono::milliseconds(TEST_STALL_MS)) {
+            stalled = true;
+            break;
+        }
+    }
+    allocations = GetAllocationCount() - allocations;
+    misses = service.GetFramePoolMisses() - misses;
+
+    service.EnableVoiceProcessing(false);
+    service.Stop();
+    HostWaitForTasks();
+
+    ASSERT_FALSE(stalled);
+    // Every operator new of every task counts, not only the pool misses
+    EXPECT_EQ(allocations, 0u);
+    EXPECT_EQ(misses, 0u);
+}
@@ -0,0 +1,118 @@
+#include "jitter_buffer.h"
+
+#include <gtest/gtest.h>
+
+namespace {
+
+const int kFrameMs = 60;
+const int64_t kFrameUs = kFrameMs * 1000;
+
+AudioStreamPacketPtr Packet(uint32_t sequence) {
+    AudioStreamPacketPtr packet(new AudioStreamPacket());
+    packet->frame_duration = kFrameMs;
+    packet->sequence = sequence;
+    packet->payload.assign(40, static_cast<uint8_t>(sequence));
+    return packet;
+}
+
+// Delivers frames first..last one frame apart from start_us, each delayed by delay_us(sequence),
+// and plays the buffer out at the frame rate until it is empty again
+struct Stream {
+    JitterBuffer buffer{32, 2, 20, 3};
+    int64_t now_us = 0;
+    std::vector<uint32_t> played;
+
+    void Deliver(uint32_t first, uint32_t last, int64_t start_us, int64_t (*delay_us)(uint32_t) = nullptr) {
+        std::vector<std::pair<int64_t, uint32_t>> arrivals;
+        for (uint32_t sequence = first; sequence <= last; sequence++) {
+            int64_t delay = delay_us ? delay_us(sequence) : 0;
+            arrivals.push_back({start_us + (sequence - first) * kFrameUs + delay, sequence});
+        }
+        std::sort(arrivals.begin(), arrivals.end());
+        size_t next = 0;
+        int64_t end_us = arrivals.back().first + 40 * kFrameUs;
+        for (now_us = start_us; now_us < end_us; now_us += kFrameUs / 4) {
+            while (next < arrivals.size() && arrivals[next].first <= now_us) {
+                auto packet = Packet(arrivals[next].second);
+                EXPECT_TRUE(buffer.Put(packet, arrivals[next].first));
+                next++;
+            }
+            if ((now_us - start_us) % kFrameUs == 0) {
+                AudioStreamPacketPtr packet;
+                if (buffer.Get(packet, now_us) == kJitterBufferPacket) {
+                    played.push_back(packet->sequence);
+                }
+            }
+        }
+    }
+};
+
+} // namespace
+
+TEST(JitterBuffer, PlaysInOrder) {
+    Stream stream;
+    stream.Deliver(1, 50, 0);
+    ASSERT_EQ(stream.played.size(), 50u);
+    for (uint32_t i = 0; i < 50; i++) {
+        EXPECT_EQ(stream.played[i], i + 1);
+    }
+    EXPECT_EQ(stream.buffer.statistics().lost, 0u);
+}
+
+TEST(JitterBuffer, ReordersPackets) {
+    Stream stream;
+    // Every fifth packet arrives a frame and a half late, behind the next one
+    stream.Deliver(1, 50, 0, [](uint32_t sequence) -> int64_t { return sequence % 5 == 0 ? kFrameUs * 3 / 2 : 0; });
+    auto statistics = stream.buffer.statistics();
+    EXPECT_TRUE(std::is_sorted(stream.played.begin(), stream.played.end()));
+    EXPECT_EQ(stream.played.size() + statistics.late, 50u);
+}
+
+TEST(JitterBuffer, ConcealsMissingFrame) {
+    JitterBuffer buffer(32, 2, 20, 3);
+    for (uint32_t sequence : {1u, 2u, 4u, 5u}) {
+        auto packet = Packet(sequence);
+        buffer.Put(packet, 0);
+    }
+    AudioStreamPacketPtr packet;
+    EXPECT_EQ(buffer.Get(packet, 0), kJitterBufferPacket);
+    EXPECT_EQ(buffer.Get(packet, 0), kJitterBufferPacket);
+    EXPECT_EQ(buffer.Get(packet, 0), kJitterBufferConceal);
+    EXPECT_EQ(buffer.Get(packet, 0), kJitterBufferPacket);
+    EXPECT_EQ(packet->sequence, 4u);
+    EXPECT_EQ(buffer.statistics().concealed, 1u);
+}
+
+TEST(JitterBuffer, SteadyStreamKeepsMinimumDepth) {
+    Stream stream;
+    stream.Deliver(1, 100, 0);
+    EXPECT_EQ(stream.buffer.target_depth(), 2);
+    EXPECT_LT(stream.buffer.statistics().jitter_ms, 1u);
+}
+
+TEST(JitterBuffer, PauseBetweenSentencesIsNotJitter) {
+    Stream stream;
+    stream.Deliver(1, 30, 0);
+    // The server keeps numbering after a 1.5 s pause in the speech
+    stream.Deliver(31, 60, stream.now_us + 1500 * 1000);
+    EXPECT_EQ(stream.buffer.target_depth(), 2);
+    EXPECT_LT(stream.buffer.statistics().jitter_ms, 5u);
+}
+
+TEST(JitterBuffer, JitterRaisesTargetDepth) {
+    Stream stream;
+    stream.Deliver(1, 100, 0, [](uint32_t sequence) -> int64_t { return (sequence * 7919 % 5) * 30 * 1000; });
+    EXPECT_GT(stream.buffer.statistics().jitter_ms, 30u);
+    EXPECT_GT(stream.buffer.target_depth(), 2);
+    EXPECT_LE(stream.buffer.target_depth(), 20);
+}
+
+TEST(JitterBuffer, ResetRestoresInitialTarget) {
+    Stream stream;
+    stream.Deliver(1, 100, 0, [](uint32_t sequence) -> int64_t { return (sequence * 7919 % 5) * 30 * 1000; });
+    ASSERT_GT(stream.buffer.target_depth(), 2);
+    stream.buffer.Reset();
+    EXPECT_EQ(stream.buffer.target_depth(), 2);
+    EXPECT_EQ(stream.buffer.statistics().jitter_ms, 0u);
+    EXPECT_EQ(stream.buffer.depth(), 0u);
+}
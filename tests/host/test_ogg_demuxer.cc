@@ -0,0 +1,319 @@
+#include "ogg_demuxer.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace {
+
+const int kGranuleRateKhz = 48;
+
+// The sounds the firmware embeds as Lang::Sounds, the common ones and those of the default language
+std::vector<std::filesystem::path> Clips() {
+    std::vector<std::filesystem::path> clips;
+    for (const char* dir : {"common", "locales/en-US"}) {
+        for (const auto& entry : std::filesystem::directory_iterator(std::filesystem::path(OGG_SOUNDS_DIR) / dir)) {
+            if (entry.path().extension() == ".ogg") {
+                clips.push_back(entry.path());
+            }
+        }
+    }
+    std::sort(clips.begin(), clips.end());
+    return clips;
+}
+
+std::string ReadFile(const std::filesystem::path& path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+struct Page {
+    uint8_t header_type = 0;
+    int64_t granule = -1;
+    std::vector<uint8_t> lacing;
+    std::vector<uint8_t> body;
+};
+
+struct Packet {
+    std::vector<uint8_t> bytes;
+    size_t offset = 0;          // In the stream, when the packet is on a single page
+    bool spans_pages = false;
+    int64_t start = 0;          // First sample, pre-skip included
+    uint32_t samples = 0;
+};
+
+// An Ogg/Opus stream taken apart without OggDemuxer, as the reference for its results
+struct Stream {
+    std::vector<Page> pages;
+    std::vector<Packet> packets;   // Audio packets, the two header packets are left out
+    uint16_t pre_skip = 0;
+    int64_t last_granule = 0;
+
+    explicit Stream(const std::string& ogg) {
+        auto data = reinterpret_cast<const uint8_t*>(ogg.data());
+        size_t offset = 0;
+        std::vector<Packet> all;
+        bool open = false;
+        while (offset + 27 <= ogg.size()) {
+            EXPECT_EQ(memcmp(data + offset, "OggS", 4), 0);
+            Page page;
+            page.header_type = data[offset + 5];
+            memcpy(&page.granule, data + offset + 6, 8);
+            int segments = data[offset + 26];
+            page.lacing.assign(data + offset + 27, data + offset + 27 + segments);
+            size_t body = offset + 27 + segments;
+            for (size_t i = 0; i < page.lacing.size(); i++) {
+                uint8_t lacing = page.lacing[i];
+                if (!open) {
+                    all.push_back(Packet());
+                    all.back().offset = body;
+                    open = true;
+                } else if (i == 0) {
+                    all.back().spans_pages = true;
+                }
+                all.back().bytes.insert(all.back().bytes.end(), data + body, data + body + lacing);
+                body += lacing;
+                open = lacing == 255;
+            }
+            page.body.assign(data + offset + 27 + segments, data + body);
+            pages.push_back(page);
+            offset = body;
+        }
+        last_granule = pages.back().granule;
+        pre_skip = all[0].bytes[10] | (all[0].bytes[11] << 8);
+        packets.assign(all.begin() + 2, all.end());
+
+        // Opus streams start at granule 0, the pages then give the end of their last complete packet
+        int64_t position = 0;
+        for (auto& packet : packets) {
+            packet.start = position;
+            packet.samples = OggDemuxer::GetPacketSamples(packet.bytes.data(), packet.bytes.size());
+            position += packet.samples;
+        }
+    }
+
+    // Written back with at most max_body bytes per page, and the packets padded to pad_to bytes,
+    // so they continue on the next page. Ogg only splits packets of 255 bytes or more, which the
+    // sounds do not have, and only the TOC byte matters to the demuxer.
+    std::string Repage(size_t max_body, size_t pad_to) const {
+        std::string ogg;
+        auto write_page = [&ogg](uint8_t header_type, int64_t granule, const std::vector<uint8_t>& lacing,
+                              const std::vector<uint8_t>& body) {
+            uint8_t header[27] = {'O', 'g', 'g', 'S', 0, header_type};
+            memcpy(header + 6, &granule, 8);
+            header[26] = lacing.size();
+            ogg.append(reinterpret_cast<const char*>(header), sizeof(header));
+            ogg.append(lacing.begin(), lacing.end());
+            ogg.append(body.begin(), body.end());
+        };
+        // The header packets keep pages of their own
+        for (size_t i = 0; i < 2; i++) {
+            write_page(i == 0 ? 0x02 : 0, 0, pages[i].lacing, pages[i].body);
+        }
+
+        std::vector<uint8_t> lacing, body;
+        int64_t granule = -1;
+        bool continued = false;
+        for (size_t i = 0; i < packets.size(); i++) {
+            auto bytes = packets[i].bytes;
+            bytes.resize(std::max(bytes.size(), pad_to), 0);
+            size_t done = 0;
+            while (true) {
+                size_t chunk = std::min<size_t>(bytes.size() - done, 255);
+                if (!body.empty() && (body.size() + chunk > max_body || lacing.size() == 255)) {
+                    write_page(continued ? 0x01 : 0, granule, lacing, body);
+                    continued = done > 0;
+                    lacing.clear();
+                    body.clear();
+                    granule = -1;
+                }
+                lacing.push_back(chunk);
+                body.insert(body.end(), bytes.begin() + done, bytes.begin() + done + chunk);
+                done += chunk;
+                if (chunk < 255) {
+                    break;
+                }
+            }
+            granule = packets[i].start + packets[i].samples;
+        }
+        write_page((continued ? 0x01 : 0) | 0x04, last_granule, lacing, body);
+        return ogg;
+    }
+};
+
+// Every packet the demuxer returns, compared with the reference
+void ExpectPackets(const std::string& ogg, const Stream& stream, size_t& copied_bytes) {
+    OggDemuxer demuxer;
+    ASSERT_TRUE(demuxer.Open(ogg));
+    EXPECT_EQ(demuxer.pre_skip(), stream.pre_skip);
+    EXPECT_EQ(demuxer.duration_ms(), (stream.last_granule - stream.pre_skip) / kGranuleRateKhz);
+
+    auto base = reinterpret_cast<const uint8_t*>(ogg.data());
+    copied_bytes = 0;
+    int64_t kept = 0;
+    OggOpusPacket packet;
+    for (size_t i = 0; i < stream.packets.size(); i++) {
+        const auto& expected = stream.packets[i];
+        ASSERT_TRUE(demuxer.Next(packet)) << "packet " << i;
+        ASSERT_EQ(packet.size, expected.bytes.size());
+        EXPECT_EQ(memcmp(packet.data, expected.bytes.data(), packet.size), 0);
+        if (packet.data < base || packet.data >= base + ogg.size()) {
+            copied_bytes += packet.size;
+            EXPECT_TRUE(expected.spans_pages) << "packet " << i << " was copied";
+        } else {
+            EXPECT_EQ(packet.data, base + expected.offset);
+        }
+
+        EXPECT_EQ(packet.granule, expected.start);
+        EXPECT_EQ(packet.samples, expected.samples);
+        int64_t end = expected.start + expected.samples;
+        EXPECT_EQ(packet.trim_start, std::clamp<int64_t>(stream.pre_skip - expected.start, 0, expected.samples));
+        bool last = i + 1 == stream.packets.size();
+        EXPECT_EQ(packet.trim_end, last ? end - stream.last_granule : 0) << "packet " << i;
+        kept += packet.samples - packet.trim_start - packet.trim_end;
+    }
+    EXPECT_FALSE(demuxer.Next(packet));
+    EXPECT_EQ(kept, stream.last_granule - stream.pre_skip);
+}
+
+// After Seek() the packets before the target are trimmed whole, they only warm the decoder up,
+// and the first sample kept is the one at the target
+void ExpectSeek(const std::string& ogg, const Stream& stream, uint32_t position_ms) {
+    OggDemuxer demuxer;
+    ASSERT_TRUE(demuxer.Open(ogg));
+    ASSERT_TRUE(demuxer.Seek(position_ms));
+    int64_t target = stream.pre_skip + static_cast<int64_t>(position_ms) * kGranuleRateKhz;
+
+    auto expected = std::find_if(stream.packets.begin(), stream.packets.end(), [target](const Packet& packet) {
+        return packet.start + packet.samples > target;
+    });
+    OggOpusPacket packet;
+    while (true) {
+        ASSERT_TRUE(demuxer.Next(packet)) << "seek to " << position_ms << " ms";
+        auto found = std::find_if(stream.packets.begin(), stream.packets.end(), [&packet](const Packet& candidate) {
+            return candidate.bytes.size() == packet.size && memcmp(candidate.bytes.data(), packet.data, packet.size) == 0 &&
+                candidate.start == packet.granule;
+        });
+        ASSERT_NE(found, stream.packets.end()) << "seek to " << position_ms << " ms returned a wrong position";
+        ASSERT_LE(found - stream.packets.begin(), expected - stream.packets.begin()) << "seek to " << position_ms << " ms";
+        if (packet.trim_start < packet.samples) {
+            EXPECT_EQ(found, expected) << "seek to " << position_ms << " ms";
+            EXPECT_EQ(packet.granule + packet.trim_start, target);
+            break;
+        }
+    }
+}
+
+} // namespace
+
+TEST(OggDemuxer, PacketSamplesFromToc) {
+    const uint8_t silk_60ms[] = {0x18};     // config 3, one frame
+    const uint8_t celt_20ms_two[] = {0xF9}; // config 31, two equal frames
+    const uint8_t celt_code3[] = {0xFB, 0x03};
+    EXPECT_EQ(OggDemuxer::GetPacketSamples(silk_60ms, 1), 2880u);
+    EXPECT_EQ(OggDemuxer::GetPacketSamples(celt_20ms_two, 1), 1920u);
+    EXPECT_EQ(OggDemuxer::GetPacketSamples(celt_code3, 2), 2880u);
+    EXPECT_EQ(OggDemuxer::GetPacketSamples(celt_code3, 1), 0u);
+}
+
+TEST(OggDemuxer, SoundsAreNotCopied) {
+    auto clips = Clips();
+    ASSERT_FALSE(clips.empty());
+    for (const auto& clip : clips) {
+        SCOPED_TRACE(clip.string());
+        auto ogg = ReadFile(clip);
+        Stream stream(ogg);
+        size_t copied_bytes;
+        ExpectPackets(ogg, stream, copied_bytes);
+        EXPECT_EQ(copied_bytes, 0u);
+    }
+}
+
+TEST(OggDemuxer, JoinsPacketsAcrossPages) {
+    for (const auto& clip : Clips()) {
+        SCOPED_TRACE(clip.string());
+        Stream original(ReadFile(clip));
+        auto ogg = original.Repage(700, 400);
+        Stream stream(ogg);
+        size_t spanning_bytes = 0;
+        for (const auto& packet : stream.packets) {
+            spanning_bytes += packet.spans_pages ? packet.bytes.size() : 0;
+        }
+        ASSERT_GT(spanning_bytes, 0u);
+        size_t copied_bytes;
+        ExpectPackets(ogg, stream, copied_bytes);
+        EXPECT_EQ(copied_bytes, spanning_bytes);
+    }
+}
+
+TEST(OggDemuxer, SeekLandsOnThePacket) {
+    for (const auto& clip : Clips()) {
+        SCOPED_TRACE(clip.string());
+        auto ogg = ReadFile(clip);
+        Stream stream(ogg);
+        uint32_t duration_ms = (stream.last_granule - stream.pre_skip) / kGranuleRateKhz;
+        for (uint32_t position_ms = 0; position_ms < duration_ms; position_ms += 37) {
+            ExpectSeek(ogg, stream, position_ms);
+        }
+    }
+}
+
+TEST(OggDemuxer, SeekOverContinuedPages) {
+    for (const auto& clip : Clips()) {
+        SCOPED_TRACE(clip.string());
+        auto ogg = Stream(ReadFile(clip)).Repage(700, 400);
+        Stream stream(ogg);
+        uint32_t duration_ms = (stream.last_granule - stream.pre_skip) / kGranuleRateKhz;
+        for (uint32_t position_ms = 0; position_ms < duration_ms; position_ms += 13) {
+            ExpectSeek(ogg, stream, position_ms);
+        }
+    }
+}
+
+TEST(OggDemuxer, SeekPastTheEndFails) {
+    auto ogg = ReadFile(Clips().front());
+    OggDemuxer demuxer;
+    ASSERT_TRUE(demuxer.Open(ogg));
+    EXPECT_FALSE(demuxer.Seek(demuxer.duration_ms() + 1000));
+    // The demuxer is rewound and plays from the start
+    OggOpusPacket packet;
+    ASSERT_TRUE(demuxer.Next(packet));
+    EXPECT_EQ(packet.granule, 0);
+}
+
+// Demuxes every sound the way PlaySound() does and reports the time and the bytes copied
+TEST(OggDemuxer, Benchmark) {
+    std::vector<std::string> sounds;
+    for (const auto& clip : Clips()) {
+        sounds.push_back(ReadFile(clip));
+    }
+    const int kRounds = 2000;
+    size_t packets = 0, bytes = 0, copied_bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < kRounds; round++) {
+        for (const auto& ogg : sounds) {
+            OggDemuxer demuxer;
+            demuxer.Open(ogg);
+            auto base = reinterpret_cast<const uint8_t*>(ogg.data());
+            OggOpusPacket packet;
+            while (demuxer.Next(packet)) {
+                packets++;
+                bytes += packet.size;
+                if (packet.data < base || packet.data >= base + ogg.size()) {
+                    copied_bytes += packet.size;
+                }
+            }
+        }
+    }
+    double elapsed_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    printf("%zu sounds: %.3f us per packet, %zu of %zu bytes copied\n", sounds.size(), elapsed_us / packets,
+        copied_bytes / kRounds, bytes / kRounds);
+    EXPECT_EQ(copied_bytes, 0u);
+}
@@ -0,0 +1,117 @@
+#include "dsp/polyphase_resampler.h"
+
+#include <gtest/gtest.h>
+#include <cmath>
+#include <tuple>
+
+namespace {
+
+std::vector<int16_t> Tone(int sample_rate, double frequency, size_t samples, double amplitude = 16000) {
+    std::vector<int16_t> pcm(samples);
+    for (size_t i = 0; i < samples; i++) {
+        pcm[i] = static_cast<int16_t>(lround(amplitude * sin(2 * M_PI * frequency * i / sample_rate)));
+    }
+    return pcm;
+}
+
+// Resamples input in frames of frame_ms, as the audio paths do
+std::vector<int16_t> Resample(PolyphaseResampler& resampler, const std::vector<int16_t>& input, int frame_ms) {
+    size_t frame = resampler.input_sample_rate() * frame_ms / 1000;
+    std::vector<int16_t> output;
+    for (size_t offset = 0; offset + frame <= input.size(); offset += frame) {
+        size_t expected = resampler.GetOutputSamples(frame);
+        size_t start = output.size();
+        output.resize(start + expected);
+        size_t produced = resampler.Process(input.data() + offset, frame, output.data() + start);
+        EXPECT_EQ(produced, expected);
+    }
+    return output;
+}
+
+double Rms(const int16_t* pcm, size_t samples) {
+    double sum = 0;
+    for (size_t i = 0; i < samples; i++) {
+        sum += static_cast<double>(pcm[i]) * pcm[i];
+    }
+    return sqrt(sum / samples);
+}
+
+} // namespace
+
+class PolyphaseResamplerRates : public ::testing::TestWithParam<std::tuple<int, int>> {};
+
+TEST_P(PolyphaseResamplerRates, OutputCountMatchesRatio) {
+    auto [input_rate, output_rate] = GetParam();
+    PolyphaseResampler resampler;
+    resampler.Configure(input_rate, output_rate);
+
+    auto input = Tone(input_rate, 440, input_rate * 3);     // 50 frames of 60 ms
+    auto output = Resample(resampler, input, 60);
+    EXPECT_NEAR(static_cast<double>(output.size()), output_rate * 3, 1);
+}
+
+TEST_P(PolyphaseResamplerRates, PassbandKeepsGain) {
+    auto [input_rate, output_rate] = GetParam();
+    PolyphaseResampler resampler;
+    resampler.Configure(input_rate, output_rate);
+
+    auto input = Tone(input_rate, 500, input_rate);
+    auto output = Resample(resampler, input, 20);
+    // Skip the filter delay at the start
+    size_t settle = output_rate / 10;
+    double gain = Rms(output.data() + settle, output.size() - settle) / Rms(input.data(), input.size());
+    EXPECT_NEAR(gain, 1.0, 0.01);
+}
+
+TEST_P(PolyphaseResamplerRates, StreamingMatchesOneShot) {
+    auto [input_rate, output_rate] = GetParam();
+    PolyphaseResampler streaming, one_shot;
+    streaming.Configure(input_rate, output_rate);
+    one_shot.Configure(input_rate, output_rate);
+
+    auto input = Tone(input_rate, 1000, input_rate * 60 / 1000 * 5);
+    auto frames = Resample(streaming, input, 60);
+    std::vector<int16_t> whole(one_shot.GetOutputSamples(input.size()));
+    whole.resize(one_shot.Process(input.data(), input.size(), whole.data()));
+    EXPECT_EQ(frames, whole);
+}
+
+INSTANTIATE_TEST_SUITE_P(CodecRates, PolyphaseResamplerRates, ::testing::Values(
+    std::make_tuple(48000, 16000), std::make_tuple(16000, 48000),
+    std::make_tuple(24000, 16000), std::make_tuple(16000, 24000),
+    std::make_tuple(16000, 8000), std::make_tuple(8000, 16000),
+    std::make_tuple(48000, 24000), std::make_tuple(24000, 48000)));
+
+TEST(PolyphaseResampler, DownsamplingRejectsAliases) {
+    PolyphaseResampler resampler;
+    resampler.Configure(48000, 16000);
+    // 12 kHz is above the 8 kHz output Nyquist frequency
+    auto input = Tone(48000, 12000, 48000);
+    auto output = Resample(resampler, input, 60);
+    double attenuation = 20 * log10(Rms(output.data() + 1600, output.size() - 1600) / Rms(input.data(), input.size()));
+    EXPECT_LT(attenuation, -60);
+}
+
+TEST(PolyphaseResampler, SameRateCopies) {
+    PolyphaseResampler resampler;
+    resampler.Configure(16000, 16000);
+    auto input = Tone(16000, 440, 960);
+    std::vector<int16_t> output(resampler.GetOutputSamples(input.size()));
+    EXPECT_EQ(resampler.Process(input.data(), input.size(), output.data()), input.size());
+    EXPECT_EQ(output, input);
+}
+
+TEST(PolyphaseResampler, ResetClearsHistory) {
+    PolyphaseResampler resampler;
+    resampler.Configure(16000, 24000);
+    auto input = Tone(16000, 440, 960);
+    std::vector<int16_t> first(resampler.GetOutputSamples(input.size()));
+    resampler.Process(input.data(), input.size(), first.data());
+
+    std::vector<int16_t> second(resampler.GetOutputSamples(input.size()));
+    resampler.Process(input.data(), input.size(), second.data());
+    resampler.Reset();
+    std::vector<int16_t> again(resampler.GetOutputSamples(input.size()));
+    resampler.Process(input.data(), input.size(), again.data());
+    EXPECT_EQ(first, again);
+}
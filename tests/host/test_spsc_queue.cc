@@ -0,0 +1,172 @@
+#include "spsc_queue.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+TEST(SpscQueue, FullAndEmpty) {
+    SpscQueue<int, 3> queue;
+    int item;
+    EXPECT_TRUE(queue.Empty());
+    EXPECT_FALSE(queue.Pop(item));
+
+    EXPECT_TRUE(queue.Push(1));
+    EXPECT_TRUE(queue.Push(2));
+    EXPECT_TRUE(queue.Push(3));
+    // The storage is rounded up to 4 slots, the capacity stays 3
+    EXPECT_TRUE(queue.Full());
+    EXPECT_FALSE(queue.Push(4));
+    EXPECT_EQ(queue.Size(), 3u);
+
+    ASSERT_TRUE(queue.Pop(item));
+    EXPECT_EQ(item, 1);
+    EXPECT_FALSE(queue.Full());
+    EXPECT_TRUE(queue.Push(4));
+
+    for (int expected = 2; expected <= 4; expected++) {
+        ASSERT_TRUE(queue.Pop(item));
+        EXPECT_EQ(item, expected);
+    }
+    EXPECT_TRUE(queue.Empty());
+    EXPECT_FALSE(queue.Pop(item));
+}
+
+TEST(SpscQueue, WrapsAround) {
+    SpscQueue<int, 5> queue;
+    int next_push = 0;
+    int next_pop = 0;
+    // Uneven pushes and pops walk the positions around the 8 slots many times
+    for (int round = 0; round < 1000; round++) {
+        int pushes = round % 5 + 1;
+        for (int i = 0; i < pushes && queue.Push(int(next_push)); i++) {
+            next_push++;
+        }
+        int pops = (round * 7) % 5 + 1;
+        int item;
+        for (int i = 0; i < pops && queue.Pop(item); i++) {
+            EXPECT_EQ(item, next_pop);
+            next_pop++;
+        }
+        EXPECT_EQ(queue.Size(), static_cast<size_t>(next_push - next_pop));
+    }
+    EXPECT_GT(next_pop, 1000);
+}
+
+TEST(SpscQueue, MovesOwnership) {
+    SpscQueue<std::unique_ptr<int>, 2> queue;
+    EXPECT_TRUE(queue.Push(std::make_unique<int>(7)));
+    std::unique_ptr<int> item;
+    ASSERT_TRUE(queue.Pop(item));
+    ASSERT_NE(item, nullptr);
+    EXPECT_EQ(*item, 7);
+}
+
+TEST(SpscQueue, FlushDropsWhatWasPushed) {
+    SpscQueue<std::shared_ptr<int>, 4> queue;
+    auto tracked = std::make_shared<int>(1);
+    EXPECT_TRUE(queue.Push(std::shared_ptr<int>(tracked)));
+    EXPECT_TRUE(queue.Push(std::make_shared<int>(2)));
+    queue.Flush();
+    EXPECT_TRUE(queue.Empty());
+    // Flushed items keep their slots until the consumer drops them
+    EXPECT_TRUE(queue.Push(std::make_shared<int>(3)));
+    EXPECT_EQ(queue.Size(), 1u);
+    EXPECT_EQ(tracked.use_count(), 2);
+
+    std::shared_ptr<int> item;
+    ASSERT_TRUE(queue.Pop(item));
+    EXPECT_EQ(*item, 3);
+    EXPECT_EQ(tracked.use_count(), 1);
+    EXPECT_EQ(queue.DropFlushed(), 0u);
+}
+
+TEST(SpscQueue, DropFlushedCounts) {
+    SpscQueue<int, 8> queue;
+    for (int i = 0; i < 5; i++) {
+        EXPECT_TRUE(queue.Push(int(i)));
+    }
+    int item;
+    ASSERT_TRUE(queue.Pop(item));
+    queue.Flush();
+    EXPECT_EQ(queue.DropFlushed(), 4u);
+    EXPECT_FALSE(queue.Pop(item));
+}
+
+TEST(SpscQueue, ConcurrentProducerAndConsumer) {
+    const uint32_t kItems = 200000;
+    SpscQueue<uint32_t, 16> queue;
+    std::thread producer([&queue]() {
+        for (uint32_t i = 0; i < kItems;) {
+            if (queue.Push(uint32_t(i))) {
+                i++;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    uint32_t expected = 0;
+    while (expected < kItems) {
+        uint32_t item;
+        if (queue.Pop(item)) {
+            ASSERT_EQ(item, expected);
+            expected++;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+    EXPECT_TRUE(queue.Empty());
+}
+
+TEST(SpscQueue, FlushWhilePushing) {
+    const uint32_t kItems = 200000;
+    SpscQueue<uint32_t, 16> queue;
+    std::atomic<bool> done{false};
+    std::thread producer([&]() {
+        for (uint32_t i = 0; i < kItems;) {
+            if (queue.Push(uint32_t(i))) {
+                i++;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+        done = true;
+    });
+    // Flush() may come from a third task, like ResetDecoder() from the main loop
+    std::thread flusher([&]() {
+        while (!done) {
+            queue.Flush();
+            std::this_thread::yield();
+        }
+    });
+
+    // Every item is either received in order or dropped, none is seen twice. Pop() drops
+    // flushed items on its own, so the explicit DropFlushed() calls only see some of them.
+    uint64_t received = 0;
+    uint64_t dropped = 0;
+    int64_t last = -1;
+    while (true) {
+        dropped += queue.DropFlushed();
+        uint32_t item;
+        if (queue.Pop(item)) {
+            ASSERT_GT(static_cast<int64_t>(item), last);
+            last = item;
+            received++;
+        } else if (done && queue.Empty()) {
+            dropped += queue.DropFlushed();
+            break;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+    flusher.join();
+    EXPECT_GT(received, 0u);
+    EXPECT_LE(received + dropped, kItems);
+    EXPECT_EQ(queue.DropFlushed(), 0u);
+    EXPECT_EQ(queue.Size(), 0u);
+}
@@ -0,0 +1,122 @@
+#include "dsp/time_stretcher.h"
+
+#include <gtest/gtest.h>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+
+namespace {
+
+const int kSampleRate = 24000;
+const size_t kFrameSamples = kSampleRate * 60 / 1000;
+
+// A voiced frame with a 200 Hz fundamental, a period of 120 samples
+std::vector<int16_t> Voiced(size_t samples) {
+    std::vector<int16_t> pcm(samples);
+    for (size_t i = 0; i < samples; i++) {
+        double t = static_cast<double>(i) / kSampleRate;
+        pcm[i] = static_cast<int16_t>(8000 * sin(2 * M_PI * 200 * t) + 3000 * sin(2 * M_PI * 400 * t + 0.5) +
+            1500 * sin(2 * M_PI * 600 * t + 1.3));
+    }
+    return pcm;
+}
+
+int MaxStep(const std::vector<int16_t>& pcm) {
+    int step = 0;
+    for (size_t i = 1; i < pcm.size(); i++) {
+        step = std::max(step, std::abs(pcm[i] - pcm[i - 1]));
+    }
+    return step;
+}
+
+TimeStretcher Stretcher() {
+    TimeStretcher stretcher;
+    stretcher.Configure(kSampleRate);
+    return stretcher;
+}
+
+} // namespace
+
+TEST(TimeStretcher, CompressRemovesPitchPeriods) {
+    auto stretcher = Stretcher();
+    auto input = Voiced(kFrameSamples);
+    auto pcm = input;
+
+    size_t removed = stretcher.Compress(pcm, kFrameSamples / 2);
+    ASSERT_GT(removed, 0u);
+    EXPECT_EQ(pcm.size(), input.size() - removed);
+    EXPECT_EQ(removed % 120, 0u);
+    EXPECT_LE(removed, kFrameSamples / 2);
+}
+
+TEST(TimeStretcher, ExpandRepeatsPitchPeriods) {
+    auto stretcher = Stretcher();
+    auto input = Voiced(kFrameSamples);
+    auto pcm = input;
+
+    size_t added = stretcher.Expand(pcm, kFrameSamples / 2);
+    ASSERT_GT(added, 0u);
+    EXPECT_EQ(pcm.size(), input.size() + added);
+    EXPECT_EQ(added % 120, 0u);
+}
+
+TEST(TimeStretcher, SpliceIsContinuous) {
+    auto stretcher = Stretcher();
+    auto input = Voiced(kFrameSamples);
+    // The splice may not add a step larger than the signal itself has
+    int limit = MaxStep(input) * 11 / 10;
+
+    auto compressed = input;
+    ASSERT_GT(stretcher.Compress(compressed, kFrameSamples / 2), 0u);
+    EXPECT_LE(MaxStep(compressed), limit);
+
+    auto expanded = input;
+    ASSERT_GT(stretcher.Expand(expanded, kFrameSamples / 2), 0u);
+    EXPECT_LE(MaxStep(expanded), limit);
+}
+
+TEST(TimeStretcher, EdgesAreUntouched) {
+    auto stretcher = Stretcher();
+    auto input = Voiced(kFrameSamples);
+
+    for (bool compress : {true, false}) {
+        auto pcm = input;
+        size_t changed = compress ? stretcher.Compress(pcm, kFrameSamples / 2) : stretcher.Expand(pcm, kFrameSamples / 2);
+        ASSERT_GT(changed, 0u);
+        // The frame starts and ends as before, so it joins its neighbours without a click
+        EXPECT_EQ(pcm.front(), input.front());
+        size_t tail = input.size() - 2 * changed;
+        EXPECT_TRUE(std::equal(input.end() - tail, input.end(), pcm.end() - tail));
+    }
+}
+
+TEST(TimeStretcher, RespectsMaxSamples) {
+    auto stretcher = Stretcher();
+    auto pcm = Voiced(kFrameSamples);
+    // Less than the shortest period searched (2.5 ms)
+    EXPECT_EQ(stretcher.Compress(pcm, 50), 0u);
+    EXPECT_EQ(pcm.size(), kFrameSamples);
+    EXPECT_LE(stretcher.Expand(pcm, 200), 200u);
+}
+
+TEST(TimeStretcher, LeavesNoiseAlone) {
+    auto stretcher = Stretcher();
+    std::mt19937 random(3);
+    std::uniform_int_distribution<int> distribution(-12000, 12000);
+    std::vector<int16_t> pcm(kFrameSamples);
+    for (auto& sample : pcm) {
+        sample = distribution(random);
+    }
+    auto input = pcm;
+    EXPECT_EQ(stretcher.Compress(pcm, kFrameSamples / 2), 0u);
+    EXPECT_EQ(stretcher.Expand(pcm, kFrameSamples / 2), 0u);
+    EXPECT_EQ(pcm, input);
+}
+
+TEST(TimeStretcher, CutsSilenceByLargestLag) {
+    auto stretcher = Stretcher();
+    std::vector<int16_t> pcm(kFrameSamples, 0);
+    // 15 ms at 24 kHz
+    EXPECT_EQ(stretcher.Compress(pcm, kFrameSamples / 2), 360u);
+    EXPECT_EQ(pcm.size(), kFrameSamples - 360);
+}
@@ -0,0 +1,154 @@
+#include "wav_audio_codec.h"
+
+#include <esp_log.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#define TAG "WavAudioCodec"
+
+namespace {
+
+struct WavHeader {
+    char riff[4];
+    uint32_t riff_size;
+    char wave[4];
+    char fmt[4];
+    uint32_t fmt_size;
+    uint16_t format;
+    uint16_t channels;
+    uint32_t sample_rate;
+    uint32_t byte_rate;
+    uint16_t block_align;
+    uint16_t bits_per_sample;
+} __attribute__((packed));
+
+struct WavChunk {
+    char id[4];
+    uint32_t size;
+} __attribute__((packed));
+
+} // namespace
+
+WavAudioCodec::WavAudioCodec(int output_sample_rate, double speed) : speed_(speed) {
+    output_sample_rate_ = output_sample_rate;
+    input_channels_ = 1;
+    output_channels_ = 1;
+}
+
+bool WavAudioCodec::OpenInput(const std::string& path) {
+    if (!ReadWav(path, input_, input_sample_rate_) || input_.empty()) {
+        ESP_LOGE(TAG, "Failed to read %s, it must be a mono 16-bit WAV", path.c_str());
+        return false;
+    }
+    input_position_ = 0;
+    return true;
+}
+
+void WavAudioCodec::OpenOutput(const std::string& path, size_t max_samples) {
+    output_path_ = path;
+    output_.clear();
+    output_.reserve(max_samples);
+}
+
+bool WavAudioCodec::Close() {
+    if (output_path_.empty()) {
+        return true;
+    }
+    return WriteWav(output_path_, output_.data(), output_.size(), output_sample_rate_);
+}
+
+void WavAudioCodec::WaitUntil(Clock::time_point start, uint64_t samples, int rate) const {
+    if (speed_ <= 0) {
+        return;
+    }
+    std::this_thread::sleep_until(start + std::chrono::microseconds(static_cast<int64_t>(samples * 1e6 / rate / speed_)));
+}
+
+int WavAudioCodec::Read(int16_t* dest, int samples) {
+    if (input_.empty()) {
+        return 0;
+    }
+    uint64_t read = input_samples_;
+    if (read == 0) {
+        input_start_ = Clock::now();
+    }
+    for (int i = 0; i < samples; i++) {
+        dest[i] = input_[input_position_];
+        if (++input_position_ == input_.size()) {
+            input_position_ = 0;
+        }
+    }
+    input_samples_ = read + samples;
+    // The DMA hands the frame over once its last sample has been captured
+    WaitUntil(input_start_, read + samples, input_sample_rate_);
+    return samples;
+}
+
+int WavAudioCodec::Write(const int16_t* data, int samples) {
+    uint64_t written = output_samples_;
+    if (written == 0) {
+        output_start_ = Clock::now();
+    }
+    // The DMA takes the frame once the previous one has been played
+    WaitUntil(output_start_, written, output_sample_rate_);
+    size_t kept = std::min<size_t>(samples, output_.capacity() - output_.size());
+    output_.insert(output_.end(), data, data + kept);
+    output_samples_ = written + samples;
+    output_frames_++;
+    return samples;
+}
+
+bool WavAudioCodec::ReadWav(const std::string& path, std::vector<int16_t>& samples, int& sample_rate) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    WavHeader header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.riff, "RIFF", 4) == 0 &&
+        memcmp(header.wave, "WAVE", 4) == 0 && memcmp(header.fmt, "fmt ", 4) == 0 && header.format == 1 &&
+        header.channels == 1 && header.bits_per_sample == 16 && header.fmt_size >= 16;
+    if (ok) {
+        fseek(file, sizeof(WavChunk) + 12 + header.fmt_size, SEEK_SET);
+    }
+    /* Skip the chunks before the samples, such as LIST */
+    WavChunk chunk;
+    while (ok && (ok = fread(&chunk, sizeof(chunk), 1, file) == 1) && memcmp(chunk.id, "data", 4) != 0) {
+        ok = fseek(file, chunk.size + (chunk.size & 1), SEEK_CUR) == 0;
+    }
+    if (ok) {
+        samples.resize(chunk.size / sizeof(int16_t));
+        ok = fread(samples.data(), sizeof(int16_t), samples.size(), file) == samples.size();
+        sample_rate = header.sample_rate;
+    }
+    fclose(file);
+    return ok;
+}
+
+bool WavAudioCodec::WriteWav(const std::string& path, const int16_t* samples, size_t count, int sample_rate) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    uint32_t data_size = count * sizeof(int16_t);
+    WavHeader header;
+    memcpy(header.riff, "RIFF", 4);
+    header.riff_size = sizeof(header) - 8 + sizeof(WavChunk) + data_size;
+    memcpy(header.wave, "WAVE", 4);
+    memcpy(header.fmt, "fmt ", 4);
+    header.fmt_size = 16;
+    header.format = 1;
+    header.channels = 1;
+    header.sample_rate = sample_rate;
+    header.byte_rate = sample_rate * sizeof(int16_t);
+    header.block_align = sizeof(int16_t);
+    header.bits_per_sample = 16;
+    WavChunk chunk;
+    memcpy(chunk.id, "data", 4);
+    chunk.size = data_size;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(&chunk, sizeof(chunk), 1, file) == 1 &&
+        fwrite(samples, sizeof(int16_t), count, file) == count;
+    return fclose(file) == 0 && ok;
+}
@@ -0,0 +1,61 @@
+#ifndef WAV_AUDIO_CODEC_H
+#define WAV_AUDIO_CODEC_H
+
+#include "audio_codec.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * AudioCodec backed by WAV files, so AudioService runs on the host.
+ *
+ * The input is a mono 16-bit WAV played in a loop, the codec takes its sample rate. Everything
+ * written to the output is kept, up to the samples reserved by OpenOutput(), and Close() saves
+ * it as a WAV. With a speed above 0, Read() and Write() wait like the I2S DMA until the samples
+ * have been captured or the previous ones played, at that multiple of real time. With 0 they
+ * return at once and the pipeline runs as fast as its tasks go.
+ */
+class WavAudioCodec : public AudioCodec {
+public:
+    WavAudioCodec(int output_sample_rate, double speed);
+
+    bool OpenInput(const std::string& path);
+    // Reserves the samples up front, so Write() does not allocate
+    void OpenOutput(const std::string& path, size_t max_samples);
+    // Saves the output, returns false if it could not be written
+    bool Close();
+
+    uint64_t input_samples() const { return input_samples_; }
+    uint64_t output_samples() const { return output_samples_; }
+    uint32_t output_frames() const { return output_frames_; }
+
+    static bool ReadWav(const std::string& path, std::vector<int16_t>& samples, int& sample_rate);
+    static bool WriteWav(const std::string& path, const int16_t* samples, size_t count, int sample_rate);
+
+protected:
+    int Read(int16_t* dest, int samples) override;
+    int Write(const int16_t* data, int samples) override;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    double speed_;
+    std::vector<int16_t> input_;
+    size_t input_position_ = 0;
+    Clock::time_point input_start_;
+    std::atomic<uint64_t> input_samples_{0};
+
+    std::string output_path_;
+    std::vector<int16_t> output_;
+    Clock::time_point output_start_;
+    std::atomic<uint64_t> output_samples_{0};
+    std::atomic<uint32_t> output_frames_{0};
+
+    // Waits until samples at rate have passed since start, at speed_ times real time
+    void WaitUntil(Clock::time_point start, uint64_t samples, int rate) const;
+};
+
+#endif // WAV_AUDIO_CODEC_H